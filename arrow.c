@@ -0,0 +1,1112 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Export of the graph data as tables in Arrow IPC files, one file per
+ * kind of record, for dataframe libraries. The tables are written one
+ * at a time, in record batches of at most ARROW_BATCH_ROWS rows, so
+ * only one batch is ever held in memory. Times are integer nanoseconds
+ * of the clock of the log, and ids join the tables together.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "wesgr.h"
+
+#define ARROW_BATCH_ROWS 65536
+
+/* The most fields of a table in the Arrow metadata */
+#define FB_FIELDS_MAX 8
+
+static const char arrow_magic[8] = "ARROW1";
+
+/*
+ * Minimal FlatBuffers builder, enough for the Arrow Message and Footer
+ * tables. Like the reference builder it fills the buffer from the end,
+ * so that every offset points forward to something already built, and
+ * offsets are kept as distances from the end until written.
+ */
+
+struct fb_builder {
+	uint8_t *buf;
+	size_t alloc;
+	size_t size;		/* used, at the end of buf */
+	size_t minalign;
+	size_t table;		/* size when the open table was begun */
+	size_t field[FB_FIELDS_MAX];	/* where its fields start, or 0 */
+	unsigned nfields;
+	int error;
+};
+
+static void
+fb_reset(struct fb_builder *b)
+{
+	b->size = 0;
+	b->minalign = 1;
+	b->error = 0;
+}
+
+static void
+fb_release(struct fb_builder *b)
+{
+	free(b->buf);
+	memset(b, 0, sizeof *b);
+}
+
+static uint8_t *
+fb_data(struct fb_builder *b)
+{
+	return b->buf + b->alloc - b->size;
+}
+
+static void
+fb_push(struct fb_builder *b, const void *data, size_t len)
+{
+	uint8_t *d;
+	size_t sz;
+
+	if (b->error || len == 0)
+		return;
+
+	if (b->size + len > b->alloc) {
+		sz = (b->size + len) * 2;
+		d = malloc(sz);
+		if (!d) {
+			b->error = ERROR;
+			return;
+		}
+
+		if (b->buf)
+			memcpy(d + sz - b->size, fb_data(b), b->size);
+		free(b->buf);
+		b->buf = d;
+		b->alloc = sz;
+	}
+
+	b->size += len;
+	memcpy(fb_data(b), data, len);
+}
+
+static void
+fb_pad(struct fb_builder *b, size_t len)
+{
+	static const uint8_t zeros[8];
+
+	fb_push(b, zeros, len);
+}
+
+/* Pads so that the buffer is aligned after len more bytes. */
+static void
+fb_align(struct fb_builder *b, size_t align, size_t len)
+{
+	if (align > b->minalign)
+		b->minalign = align;
+
+	fb_pad(b, -(b->size + len) & (align - 1));
+}
+
+static size_t
+fb_scalar(struct fb_builder *b, uint64_t v, unsigned width)
+{
+	uint8_t bytes[8];
+	unsigned i;
+
+	for (i = 0; i < width; i++)
+		bytes[i] = v >> (8 * i);
+
+	fb_align(b, width, 0);
+	fb_push(b, bytes, width);
+
+	return b->size;
+}
+
+static size_t
+fb_offset(struct fb_builder *b, size_t off)
+{
+	fb_align(b, 4, 0);
+
+	return fb_scalar(b, b->size + 4 - off, 4);
+}
+
+static size_t
+fb_string(struct fb_builder *b, const char *str)
+{
+	size_t len = strlen(str);
+
+	fb_align(b, 4, len + 1);
+	fb_pad(b, 1);
+	fb_push(b, str, len);
+
+	return fb_scalar(b, len, 4);
+}
+
+/* The elements are then pushed from the last to the first. */
+static void
+fb_vector_begin(struct fb_builder *b, size_t elem_size, size_t n,
+		size_t align)
+{
+	fb_align(b, 4, elem_size * n);
+	fb_align(b, align, elem_size * n);
+}
+
+static size_t
+fb_vector_end(struct fb_builder *b, size_t n)
+{
+	return fb_scalar(b, n, 4);
+}
+
+static size_t
+fb_offset_vector(struct fb_builder *b, const size_t *offs, size_t n)
+{
+	size_t i;
+
+	fb_vector_begin(b, 4, n, 4);
+	for (i = n; i-- > 0;)
+		fb_offset(b, offs[i]);
+
+	return fb_vector_end(b, n);
+}
+
+static void
+fb_table_begin(struct fb_builder *b, unsigned nfields)
+{
+	assert(nfields <= FB_FIELDS_MAX);
+
+	b->table = b->size;
+	b->nfields = nfields;
+	memset(b->field, 0, sizeof b->field);
+}
+
+static void
+fb_field(struct fb_builder *b, unsigned id, uint64_t v, unsigned width)
+{
+	b->field[id] = fb_scalar(b, v, width);
+}
+
+static void
+fb_field_offset(struct fb_builder *b, unsigned id, size_t off)
+{
+	b->field[id] = fb_offset(b, off);
+}
+
+static size_t
+fb_table_end(struct fb_builder *b)
+{
+	size_t obj, vtable;
+	uint8_t *p;
+	unsigned i;
+
+	/* the offset to the vtable, filled in below */
+	obj = fb_scalar(b, 0, 4);
+
+	for (i = b->nfields; i-- > 0;)
+		fb_scalar(b, b->field[i] ? obj - b->field[i] : 0, 2);
+	fb_scalar(b, obj - b->table, 2);
+	vtable = fb_scalar(b, 4 + 2 * b->nfields, 2);
+
+	if (b->error)
+		return 0;
+
+	p = b->buf + b->alloc - obj;
+	for (i = 0; i < 4; i++)
+		p[i] = (vtable - obj) >> (8 * i);
+
+	return obj;
+}
+
+static void
+fb_finish(struct fb_builder *b, size_t root)
+{
+	fb_align(b, b->minalign, 4);
+	fb_offset(b, root);
+}
+
+/* From the Arrow format's Schema.fbs, Message.fbs and File.fbs */
+
+enum {
+	METADATA_V5 = 4,
+};
+
+enum {
+	HEADER_SCHEMA = 1,
+	HEADER_RECORD_BATCH = 3,
+};
+
+enum {
+	TYPE_INT = 2,
+	TYPE_UTF8 = 5,
+};
+
+enum {
+	FIELD_NAME,
+	FIELD_NULLABLE,
+	FIELD_TYPE_TYPE,
+	FIELD_TYPE,
+	FIELD_DICTIONARY,
+	FIELD_CHILDREN,
+	FIELD_FIELDS
+};
+
+enum {
+	INT_BIT_WIDTH,
+	INT_IS_SIGNED,
+	INT_FIELDS
+};
+
+enum {
+	SCHEMA_ENDIANNESS,
+	SCHEMA_FIELDS,
+	SCHEMA_FIELDS_COUNT
+};
+
+enum {
+	MESSAGE_VERSION,
+	MESSAGE_HEADER_TYPE,
+	MESSAGE_HEADER,
+	MESSAGE_BODY_LENGTH,
+	MESSAGE_FIELDS
+};
+
+enum {
+	BATCH_LENGTH,
+	BATCH_NODES,
+	BATCH_BUFFERS,
+	BATCH_FIELDS
+};
+
+enum {
+	FOOTER_VERSION,
+	FOOTER_SCHEMA,
+	FOOTER_DICTIONARIES,
+	FOOTER_RECORD_BATCHES,
+	FOOTER_FIELDS
+};
+
+enum arrow_type {
+	ARROW_UINT32,
+	ARROW_INT64,
+	ARROW_UINT64,
+	ARROW_UTF8,
+};
+
+struct arrow_field {
+	const char *name;
+	enum arrow_type type;
+	int nullable;
+};
+
+struct arrow_buf {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+};
+
+struct arrow_column {
+	const struct arrow_field *field;
+	struct arrow_buf validity;
+	struct arrow_buf offsets;	/* of strings */
+	struct arrow_buf values;
+	uint64_t null_count;
+};
+
+/* Where a record batch is in the file, for the footer */
+struct arrow_block {
+	uint64_t offset;
+	uint32_t meta_len;
+	uint64_t body_len;
+};
+
+struct arrow_table {
+	FILE *fp;
+	const struct arrow_field *fields;
+	unsigned nfields;
+	struct arrow_column cols[FB_FIELDS_MAX];
+	unsigned col;		/* the next one of the row */
+	unsigned rows;		/* in the batch */
+	uint64_t written;	/* bytes of the file */
+	struct arrow_block *blocks;
+	unsigned nblocks;
+	unsigned blocks_alloc;
+	struct fb_builder fb;
+	int error;
+};
+
+static void
+arrow_buf_release(struct arrow_buf *ab)
+{
+	free(ab->data);
+	memset(ab, 0, sizeof *ab);
+}
+
+static int
+arrow_buf_append(struct arrow_buf *ab, const void *data, size_t len)
+{
+	uint8_t *d;
+	size_t sz;
+
+	if (ab->len + len > ab->alloc) {
+		sz = (ab->len + len) * 2;
+		d = realloc(ab->data, sz);
+		if (!d)
+			return ERROR;
+
+		ab->data = d;
+		ab->alloc = sz;
+	}
+
+	memcpy(ab->data + ab->len, data, len);
+	ab->len += len;
+
+	return 0;
+}
+
+static int
+arrow_buf_le(struct arrow_buf *ab, uint64_t v, unsigned width)
+{
+	uint8_t bytes[8];
+	unsigned i;
+
+	for (i = 0; i < width; i++)
+		bytes[i] = v >> (8 * i);
+
+	return arrow_buf_append(ab, bytes, width);
+}
+
+static int
+arrow_write(struct arrow_table *t, const void *data, size_t len)
+{
+	static const uint8_t zeros[8];
+	size_t pad = -len & 7;
+
+	if (len == 0)
+		return 0;
+
+	if (fwrite(data, 1, len, t->fp) != len ||
+	    fwrite(zeros, 1, pad, t->fp) != pad)
+		return ERROR;
+
+	t->written += len + pad;
+
+	return 0;
+}
+
+static size_t
+arrow_field_to_fb(struct fb_builder *b, const struct arrow_field *f)
+{
+	size_t type, name, children;
+	unsigned type_type;
+
+	if (f->type == ARROW_UTF8) {
+		type_type = TYPE_UTF8;
+		fb_table_begin(b, 0);
+		type = fb_table_end(b);
+	} else {
+		type_type = TYPE_INT;
+		fb_table_begin(b, INT_FIELDS);
+		fb_field(b, INT_BIT_WIDTH, f->type == ARROW_UINT32 ? 32 : 64, 4);
+		fb_field(b, INT_IS_SIGNED, f->type == ARROW_INT64, 1);
+		type = fb_table_end(b);
+	}
+
+	name = fb_string(b, f->name);
+	fb_vector_begin(b, 4, 0, 4);
+	children = fb_vector_end(b, 0);
+
+	fb_table_begin(b, FIELD_FIELDS);
+	fb_field_offset(b, FIELD_NAME, name);
+	fb_field(b, FIELD_NULLABLE, f->nullable, 1);
+	fb_field(b, FIELD_TYPE_TYPE, type_type, 1);
+	fb_field_offset(b, FIELD_TYPE, type);
+	fb_field_offset(b, FIELD_CHILDREN, children);
+
+	return fb_table_end(b);
+}
+
+static size_t
+arrow_schema_to_fb(struct arrow_table *t)
+{
+	size_t fields[FB_FIELDS_MAX];
+	size_t vec;
+	unsigned i;
+
+	for (i = 0; i < t->nfields; i++)
+		fields[i] = arrow_field_to_fb(&t->fb, &t->fields[i]);
+	vec = fb_offset_vector(&t->fb, fields, t->nfields);
+
+	fb_table_begin(&t->fb, SCHEMA_FIELDS_COUNT);
+	fb_field(&t->fb, SCHEMA_ENDIANNESS, 0, 2);
+	fb_field_offset(&t->fb, SCHEMA_FIELDS, vec);
+
+	return fb_table_end(&t->fb);
+}
+
+/*
+ * Writes the message built in t->fb, of the given header, in the
+ * encapsulated format: a continuation marker, the length of the
+ * metadata, the metadata and then the body, all padded to 8 bytes.
+ */
+static int
+arrow_write_message(struct arrow_table *t, unsigned header_type,
+		    size_t header, uint64_t body_len,
+		    struct arrow_block *block)
+{
+	struct fb_builder *b = &t->fb;
+	uint8_t prefix[8];
+	size_t msg, len;
+	unsigned i;
+
+	fb_table_begin(b, MESSAGE_FIELDS);
+	fb_field(b, MESSAGE_BODY_LENGTH, body_len, 8);
+	fb_field_offset(b, MESSAGE_HEADER, header);
+	fb_field(b, MESSAGE_VERSION, METADATA_V5, 2);
+	fb_field(b, MESSAGE_HEADER_TYPE, header_type, 1);
+	msg = fb_table_end(b);
+	fb_finish(b, msg);
+
+	if (b->error)
+		return ERROR;
+
+	len = (b->size + 7) & ~(size_t)7;
+	for (i = 0; i < 4; i++) {
+		prefix[i] = 0xff;
+		prefix[4 + i] = len >> (8 * i);
+	}
+
+	block->offset = t->written;
+	block->meta_len = sizeof prefix + len;
+	block->body_len = body_len;
+
+	if (arrow_write(t, prefix, sizeof prefix) < 0 ||
+	    arrow_write(t, fb_data(b), b->size) < 0)
+		return ERROR;
+
+	return 0;
+}
+
+static unsigned
+arrow_type_width(enum arrow_type type)
+{
+	switch (type) {
+	case ARROW_UINT32:
+		return 4;
+	case ARROW_INT64:
+	case ARROW_UINT64:
+		return 8;
+	case ARROW_UTF8:
+		break;
+	}
+
+	return 0;
+}
+
+/* The buffers of a column in the order of the Arrow layout */
+static unsigned
+arrow_column_buffers(const struct arrow_column *col,
+		     const struct arrow_buf **bufs)
+{
+	unsigned n = 0;
+
+	bufs[n++] = &col->validity;
+	if (col->field->type == ARROW_UTF8)
+		bufs[n++] = &col->offsets;
+	bufs[n++] = &col->values;
+
+	return n;
+}
+
+/* The validity bitmap can be left out when nothing is null. */
+static size_t
+arrow_buffer_len(const struct arrow_column *col, const struct arrow_buf *ab)
+{
+	if (ab == &col->validity && col->null_count == 0)
+		return 0;
+
+	return ab->len;
+}
+
+static int
+arrow_flush(struct arrow_table *t)
+{
+	struct fb_builder *b = &t->fb;
+	const struct arrow_buf *bufs[FB_FIELDS_MAX][3];
+	struct arrow_column *col;
+	struct arrow_block *block;
+	unsigned nbufs[FB_FIELDS_MAX];
+	uint64_t body_len = 0;
+	uint64_t offset;
+	size_t nodes, buffers, batch;
+	size_t len;
+	unsigned i, j, n = 0;
+	void *p;
+
+	if (t->rows == 0)
+		return 0;
+
+	if (t->nblocks == t->blocks_alloc) {
+		p = realloc(t->blocks, (t->blocks_alloc * 2 + 8) *
+				       sizeof *t->blocks);
+		if (!p)
+			return ERROR;
+
+		t->blocks = p;
+		t->blocks_alloc = t->blocks_alloc * 2 + 8;
+	}
+	block = &t->blocks[t->nblocks];
+
+	for (i = 0; i < t->nfields; i++) {
+		nbufs[i] = arrow_column_buffers(&t->cols[i], bufs[i]);
+		for (j = 0; j < nbufs[i]; j++)
+			body_len += (arrow_buffer_len(&t->cols[i],
+						      bufs[i][j]) + 7) & ~7;
+		n += nbufs[i];
+	}
+
+	fb_reset(b);
+
+	/* Buffer structs, of an offset into the body and a length */
+	fb_vector_begin(b, 16, n, 8);
+	offset = body_len;
+	for (i = t->nfields; i-- > 0;) {
+		for (j = nbufs[i]; j-- > 0;) {
+			len = arrow_buffer_len(&t->cols[i], bufs[i][j]);
+			offset -= (len + 7) & ~7;
+			fb_scalar(b, len, 8);
+			fb_scalar(b, offset, 8);
+		}
+	}
+	buffers = fb_vector_end(b, n);
+
+	/* FieldNode structs, of a length and a null count */
+	fb_vector_begin(b, 16, t->nfields, 8);
+	for (i = t->nfields; i-- > 0;) {
+		fb_scalar(b, t->cols[i].null_count, 8);
+		fb_scalar(b, t->rows, 8);
+	}
+	nodes = fb_vector_end(b, t->nfields);
+
+	fb_table_begin(b, BATCH_FIELDS);
+	fb_field(b, BATCH_LENGTH, t->rows, 8);
+	fb_field_offset(b, BATCH_NODES, nodes);
+	fb_field_offset(b, BATCH_BUFFERS, buffers);
+	batch = fb_table_end(b);
+
+	if (arrow_write_message(t, HEADER_RECORD_BATCH, batch, body_len,
+				block) < 0)
+		return ERROR;
+
+	for (i = 0; i < t->nfields; i++) {
+		col = &t->cols[i];
+		for (j = 0; j < nbufs[i]; j++)
+			if (arrow_write(t, bufs[i][j]->data,
+					arrow_buffer_len(col, bufs[i][j])) < 0)
+				return ERROR;
+
+		col->validity.len = 0;
+		col->offsets.len = 0;
+		col->values.len = 0;
+		col->null_count = 0;
+		if (col->field->type == ARROW_UTF8 &&
+		    arrow_buf_le(&col->offsets, 0, 4) < 0)
+			return ERROR;
+	}
+
+	t->nblocks++;
+	t->rows = 0;
+
+	return 0;
+}
+
+static int
+arrow_table_open(struct arrow_table *t, const char *dir, const char *name,
+		 const struct arrow_field *fields, unsigned nfields)
+{
+	struct arrow_block block;
+	char *filename;
+	unsigned i;
+
+	assert(nfields <= FB_FIELDS_MAX);
+
+	memset(t, 0, sizeof *t);
+	t->fields = fields;
+	t->nfields = nfields;
+
+	for (i = 0; i < nfields; i++) {
+		t->cols[i].field = &fields[i];
+		if (fields[i].type == ARROW_UTF8 &&
+		    arrow_buf_le(&t->cols[i].offsets, 0, 4) < 0)
+			return ERROR;
+	}
+
+	if (asprintf(&filename, "%s/%s.arrow", dir, name) < 0)
+		return ERROR;
+
+	t->fp = fopen(filename, "w");
+	if (!t->fp) {
+		fprintf(stderr, "Error: cannot write '%s': %s\n", filename,
+			strerror(errno));
+		free(filename);
+		return -1;
+	}
+	free(filename);
+
+	if (arrow_write(t, arrow_magic, sizeof arrow_magic) < 0)
+		return ERROR;
+
+	fb_reset(&t->fb);
+
+	return arrow_write_message(t, HEADER_SCHEMA, arrow_schema_to_fb(t), 0,
+				   &block);
+}
+
+static int
+arrow_table_write_footer(struct arrow_table *t)
+{
+	static const uint8_t end_of_stream[8] = { 0xff, 0xff, 0xff, 0xff };
+	struct fb_builder *b = &t->fb;
+	struct arrow_block *block;
+	size_t schema, dictionaries, batches, footer;
+	uint8_t len[4];
+	unsigned i;
+
+	if (arrow_write(t, end_of_stream, sizeof end_of_stream) < 0)
+		return ERROR;
+
+	fb_reset(b);
+	schema = arrow_schema_to_fb(t);
+
+	fb_vector_begin(b, 24, 0, 8);
+	dictionaries = fb_vector_end(b, 0);
+
+	/* Block structs, of an offset, a metadata length and a body length */
+	fb_vector_begin(b, 24, t->nblocks, 8);
+	for (i = t->nblocks; i-- > 0;) {
+		block = &t->blocks[i];
+		fb_scalar(b, block->body_len, 8);
+		fb_pad(b, 4);
+		fb_scalar(b, block->meta_len, 4);
+		fb_scalar(b, block->offset, 8);
+	}
+	batches = fb_vector_end(b, t->nblocks);
+
+	fb_table_begin(b, FOOTER_FIELDS);
+	fb_field_offset(b, FOOTER_SCHEMA, schema);
+	fb_field_offset(b, FOOTER_DICTIONARIES, dictionaries);
+	fb_field_offset(b, FOOTER_RECORD_BATCHES, batches);
+	fb_field(b, FOOTER_VERSION, METADATA_V5, 2);
+	footer = fb_table_end(b);
+	fb_finish(b, footer);
+
+	if (b->error)
+		return ERROR;
+
+	for (i = 0; i < 4; i++)
+		len[i] = b->size >> (8 * i);
+
+	if (fwrite(fb_data(b), 1, b->size, t->fp) != b->size ||
+	    fwrite(len, 1, sizeof len, t->fp) != sizeof len ||
+	    fwrite(arrow_magic, 1, 6, t->fp) != 6)
+		return ERROR;
+
+	return 0;
+}
+
+/* Writes what is left of the table and closes it, or only closes it. */
+static int
+arrow_table_close(struct arrow_table *t, int ret)
+{
+	unsigned i;
+
+	if (ret == 0 && t->error)
+		ret = -1;
+
+	if (ret == 0 && (arrow_flush(t) < 0 ||
+			 arrow_table_write_footer(t) < 0))
+		ret = -1;
+
+	if (t->fp && fclose(t->fp) != 0)
+		ret = ERROR;
+
+	for (i = 0; i < t->nfields; i++) {
+		arrow_buf_release(&t->cols[i].validity);
+		arrow_buf_release(&t->cols[i].offsets);
+		arrow_buf_release(&t->cols[i].values);
+	}
+	free(t->blocks);
+	fb_release(&t->fb);
+
+	return ret;
+}
+
+/*
+ * Adds the validity bit of the next column of the row, and returns the
+ * column for the value. The columns of a row are added in order.
+ */
+static struct arrow_column *
+arrow_next(struct arrow_table *t, int valid)
+{
+	struct arrow_column *col = &t->cols[t->col++];
+	uint8_t zero = 0;
+
+	assert(t->col <= t->nfields);
+	assert(valid || col->field->nullable);
+
+	if (t->rows % 8 == 0 &&
+	    arrow_buf_append(&col->validity, &zero, 1) < 0) {
+		t->error = -1;
+		return col;
+	}
+
+	if (valid)
+		col->validity.data[t->rows / 8] |= 1 << (t->rows % 8);
+	else
+		col->null_count++;
+
+	return col;
+}
+
+static void
+arrow_null(struct arrow_table *t)
+{
+	struct arrow_column *col = arrow_next(t, 0);
+	int ret;
+
+	if (col->field->type == ARROW_UTF8)
+		ret = arrow_buf_le(&col->offsets, col->values.len, 4);
+	else
+		ret = arrow_buf_le(&col->values, 0,
+				   arrow_type_width(col->field->type));
+
+	if (ret < 0)
+		t->error = -1;
+}
+
+static void
+arrow_uint(struct arrow_table *t, uint64_t v)
+{
+	struct arrow_column *col = arrow_next(t, 1);
+
+	if (arrow_buf_le(&col->values, v,
+			 arrow_type_width(col->field->type)) < 0)
+		t->error = -1;
+}
+
+/* Invalid times are null. */
+static void
+arrow_time(struct arrow_table *t, const struct timespec *ts)
+{
+	if (timespec_is_valid(ts))
+		arrow_uint(t, timespec_to_nsec(ts));
+	else
+		arrow_null(t);
+}
+
+/* NULL is null. */
+static void
+arrow_string(struct arrow_table *t, const char *str)
+{
+	struct arrow_column *col;
+
+	if (!str) {
+		arrow_null(t);
+		return;
+	}
+
+	col = arrow_next(t, 1);
+	if (arrow_buf_append(&col->values, str, strlen(str)) < 0 ||
+	    arrow_buf_le(&col->offsets, col->values.len, 4) < 0)
+		t->error = -1;
+}
+
+static int
+arrow_row_end(struct arrow_table *t)
+{
+	assert(t->col == t->nfields);
+
+	t->col = 0;
+	t->rows++;
+
+	if (t->error)
+		return ERROR;
+
+	if (t->rows == ARROW_BATCH_ROWS)
+		return arrow_flush(t);
+
+	return 0;
+}
+
+static const struct arrow_field output_fields[] = {
+	{ "output_id",         ARROW_UINT32, 0 },
+	{ "name",              ARROW_UTF8,   0 },
+	{ "refresh_period_ns", ARROW_UINT64, 1 },
+	{ "frames",            ARROW_UINT64, 0 },
+	{ "missed_frames",     ARROW_UINT64, 0 },
+};
+
+static const struct arrow_field surface_fields[] = {
+	{ "surface_id",        ARROW_UINT32, 0 },
+	{ "output_id",         ARROW_UINT32, 0 },
+	{ "description",       ARROW_UTF8,   0 },
+};
+
+static const struct arrow_field line_block_fields[] = {
+	{ "output_id",         ARROW_UINT32, 0 },
+	{ "lane",              ARROW_UTF8,   0 },
+	{ "begin_ns",          ARROW_INT64,  1 },
+	{ "end_ns",            ARROW_INT64,  1 },
+	{ "description",       ARROW_UTF8,   1 },
+};
+
+static const struct arrow_field update_fields[] = {
+	{ "output_id",         ARROW_UINT32, 0 },
+	{ "surface_id",        ARROW_UINT32, 0 },
+	{ "damage_ns",         ARROW_INT64,  1 },
+	{ "flush_ns",          ARROW_INT64,  1 },
+	{ "vblank_ns",         ARROW_INT64,  1 },
+};
+
+static const struct arrow_field vblank_fields[] = {
+	{ "output_id",         ARROW_UINT32, 0 },
+	{ "ts_ns",             ARROW_INT64,  0 },
+	{ "interval_ns",       ARROW_UINT64, 1 },
+	{ "missed",            ARROW_UINT32, 0 },
+	{ "cause",             ARROW_UTF8,   1 },
+};
+
+static const struct arrow_field activity_fields[] = {
+	{ "output_id",         ARROW_UINT32, 0 },
+	{ "activity",          ARROW_UTF8,   0 },
+	{ "begin_ns",          ARROW_INT64,  1 },
+	{ "end_ns",            ARROW_INT64,  1 },
+};
+
+static int
+outputs_to_arrow(struct graph_data *gdata, struct arrow_table *t)
+{
+	struct output_graph *og;
+	uint64_t period;
+	unsigned id = 0;
+
+	for (og = gdata->output; og; og = og->next) {
+		period = og->misses.refresh.period;
+
+		arrow_uint(t, id++);
+		arrow_string(t, output_graph_name(og));
+		if (period)
+			arrow_uint(t, period);
+		else
+			arrow_null(t);
+		arrow_uint(t, og->misses.frames);
+		arrow_uint(t, og->misses.missed_frames);
+		if (arrow_row_end(t) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+surfaces_to_arrow(struct graph_data *gdata, struct arrow_table *t)
+{
+	struct output_graph *og;
+	struct update_graph *upg;
+	unsigned output_id = 0;
+	unsigned id = 0;
+
+	for (og = gdata->output; og; og = og->next, output_id++) {
+		for (upg = og->updates; upg; upg = upg->next) {
+			arrow_uint(t, id++);
+			arrow_uint(t, output_id);
+			arrow_string(t, upg->label);
+			if (arrow_row_end(t) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+line_graph_to_arrow(struct line_graph *linegr, unsigned output_id,
+		    struct arrow_table *t)
+{
+	struct line_block *lb;
+
+	for (lb = linegr->block; lb; lb = lb->next) {
+		arrow_uint(t, output_id);
+		arrow_string(t, linegr->style);
+		arrow_time(t, &lb->begin);
+		arrow_time(t, &lb->end);
+		arrow_string(t, lb->desc);
+		if (arrow_row_end(t) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+line_blocks_to_arrow(struct graph_data *gdata, struct arrow_table *t)
+{
+	struct output_graph *og;
+	unsigned output_id = 0;
+
+	for (og = gdata->output; og; og = og->next, output_id++) {
+		if (line_graph_to_arrow(&og->delay_line, output_id, t) < 0 ||
+		    line_graph_to_arrow(&og->submit_line, output_id, t) < 0 ||
+		    line_graph_to_arrow(&og->gpu_line, output_id, t) < 0 ||
+		    line_graph_to_arrow(&og->renderer_gpu_line, output_id,
+					t) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+updates_to_arrow(struct graph_data *gdata, struct arrow_table *t)
+{
+	struct output_graph *og;
+	struct update_graph *upg;
+	struct update *up;
+	unsigned output_id = 0;
+	unsigned id = 0;
+
+	for (og = gdata->output; og; og = og->next, output_id++) {
+		for (upg = og->updates; upg; upg = upg->next, id++) {
+			for (up = upg->updates; up; up = up->next) {
+				arrow_uint(t, output_id);
+				arrow_uint(t, id);
+				arrow_time(t, &up->damage);
+				arrow_time(t, &up->flush);
+				arrow_time(t, &up->vblank);
+				if (arrow_row_end(t) < 0)
+					return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+vblanks_to_arrow(struct graph_data *gdata, struct arrow_table *t)
+{
+	struct output_graph *og;
+	struct vblank *vbl;
+	unsigned output_id = 0;
+
+	for (og = gdata->output; og; og = og->next, output_id++) {
+		for (vbl = og->vblanks.vbl; vbl; vbl = vbl->next) {
+			arrow_uint(t, output_id);
+			arrow_time(t, &vbl->ts);
+			if (vbl->interval)
+				arrow_uint(t, vbl->interval);
+			else
+				arrow_null(t);
+			arrow_uint(t, vbl->missed);
+			arrow_string(t, vbl->missed ?
+					miss_cause_to_str(vbl->cause) : NULL);
+			if (arrow_row_end(t) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+activities_to_arrow(struct graph_data *gdata, struct arrow_table *t)
+{
+	struct output_graph *og;
+	struct activity *act;
+	unsigned output_id = 0;
+
+	for (og = gdata->output; og; og = og->next, output_id++) {
+		for (act = og->not_looping.act; act; act = act->next) {
+			arrow_uint(t, output_id);
+			arrow_string(t, "not_looping");
+			arrow_time(t, &act->begin);
+			arrow_time(t, &act->end);
+			if (arrow_row_end(t) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+struct arrow_table_desc {
+	const char *name;
+	const struct arrow_field *fields;
+	unsigned nfields;
+	int (*write)(struct graph_data *gdata, struct arrow_table *t);
+};
+
+#define ARROW_TABLE(name, fields, write) \
+	{ name, fields, ARRAY_LENGTH(fields), write }
+
+static const struct arrow_table_desc arrow_tables[] = {
+	ARROW_TABLE("outputs", output_fields, outputs_to_arrow),
+	ARROW_TABLE("surfaces", surface_fields, surfaces_to_arrow),
+	ARROW_TABLE("line_blocks", line_block_fields, line_blocks_to_arrow),
+	ARROW_TABLE("updates", update_fields, updates_to_arrow),
+	ARROW_TABLE("vblanks", vblank_fields, vblanks_to_arrow),
+	ARROW_TABLE("activities", activity_fields, activities_to_arrow),
+};
+
+/*
+ * Writes every table as DIR/<table>.arrow, creating DIR if need be.
+ * Output ids are the order of the outputs in the graph data, and
+ * surface ids the order of their update graphs over all outputs.
+ */
+int
+graph_data_to_arrow(struct graph_data *gdata, const char *dir)
+{
+	const struct arrow_table_desc *desc;
+	struct arrow_table t;
+	unsigned i;
+	int ret;
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Error: cannot create '%s': %s\n", dir,
+			strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(arrow_tables); i++) {
+		desc = &arrow_tables[i];
+
+		ret = arrow_table_open(&t, dir, desc->name, desc->fields,
+				       desc->nfields);
+		if (ret == 0)
+			ret = desc->write(gdata, &t);
+
+		if (arrow_table_close(&t, ret) < 0)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+#!/bin/sh
+#
+# Runs wesgr over synthetic recordings of a few typical shapes, and
+# collects the --profile of every run as bench/results.json.
+#
+#   ./bench.sh [BASELINE.json]
+#
+# With a baseline from an earlier run, exits with status 2 if the parse
+# throughput of any scenario dropped, or its peak memory or SVG or report
+# time grew, by more than BENCH_TOLERANCE percent. Times that grew by
+# less than BENCH_MIN_MS milliseconds are noise. Each scenario is run
+# BENCH_RUNS times and the fastest run is kept, to keep the noise down.
+# BENCH_SCALE multiplies the length of every recording.
+
+set -e
+
+WESGR=${WESGR:-./wesgr}
+GEN=${GEN:-./wesgr-gen}
+DIR=${BENCH_DIR:-bench}
+SCALE=${BENCH_SCALE:-1}
+TOLERANCE=${BENCH_TOLERANCE:-15}
+RUNS=${BENCH_RUNS:-3}
+MIN_MS=${BENCH_MIN_MS:-5}
+BASELINE=$1
+RESULTS=$DIR/results.json
+
+mkdir -p "$DIR"
+
+# name, wesgr-gen options, seconds at scale 1, wesgr options
+SCENARIOS="\
+desktop|-n 2 -s 8|300|-o DIR/desktop.svg -r DIR/desktop.txt
+gaming|-n 1 -s 2 -r 144 -c 144 -m 0.02 -g|300|-o DIR/gaming.svg -r DIR/gaming.txt
+videowall|-n 8 -s 64 -r 60,75,120,144 -c 60 -g|60|-S -r DIR/videowall.txt
+retained|-n 2 -s 8 -g|1200|-R 10 -o DIR/retained.svg -r DIR/retained.txt"
+
+# Prints the value of a key of the profile, the first one after the
+# line matching the given object, if any.
+profile_value()
+{
+	awk -v obj="\"$2\":{" -v key="\"$3\":" '
+		obj != "\"\":{" && index($0, obj) { found = 1 }
+		(obj == "\"\":{" || found) && index($0, key) {
+			sub(/.*:/, ""); sub(/,$/, ""); print; exit
+		}' "$1"
+}
+
+# Prints the value of a key of a scenario in a results file, the first
+# one after the line matching the given object of the scenario, if any.
+results_value()
+{
+	awk -v name="\"$2\":{" -v obj="\"$3\":{" -v key="\"$4\":" '
+		index($0, name) == 3 { found = 1 }
+		found && (obj == "\"\":{" || index($0, obj)) { in_obj = 1 }
+		in_obj && index($0, key) {
+			sub(/.*:/, ""); sub(/,$/, ""); print; exit
+		}' "$1"
+}
+
+echo "{" > "$RESULTS.tmp"
+sep=""
+
+printf "%-10s %9s %9s %12s %9s %9s %10s\n" scenario "log MiB" "MiB/s" \
+	"events/s" "svg ms" "report ms" "peak KiB"
+
+echo "$SCENARIOS" | while IFS='|' read -r name genopts sec opts; do
+	log=$DIR/$name-x$SCALE.log
+	dur=$(awk "BEGIN { print $sec * $SCALE }")
+
+	if [ ! -f "$log" ] || [ "$GEN" -nt "$log" ]; then
+		$GEN $genopts -d "$dur" -o "$log"
+	fi
+
+	opts=$(echo "$opts" | sed "s|DIR|$DIR|g")
+	best=0
+	run=0
+	while [ $run -lt "$RUNS" ]; do
+		$WESGR -i "$log" $opts -j -P "$DIR/$name.run.json" 2>/dev/null
+		speed=$(profile_value "$DIR/$name.run.json" "" parse_mib_per_sec)
+		if awk "BEGIN { exit !($speed > $best) }"; then
+			best=$speed
+			mv "$DIR/$name.run.json" "$DIR/$name.json"
+		fi
+		run=$((run + 1))
+	done
+	rm -f "$DIR/$name.run.json"
+
+	printf "%-10s %9.1f %9.1f %12.0f %9.1f %9.1f %10s\n" "$name" \
+		"$(awk "BEGIN { print $(wc -c < "$log") / 1048576 }")" \
+		"$(profile_value "$DIR/$name.json" "" parse_mib_per_sec)" \
+		"$(profile_value "$DIR/$name.json" "" events_per_sec)" \
+		"$(profile_value "$DIR/$name.json" svg total)" \
+		"$(profile_value "$DIR/$name.json" report total)" \
+		"$(profile_value "$DIR/$name.json" "" peak_rss_kib)"
+
+	printf '%s  "%s":%s' "$sep" "$name" \
+		"$(sed '2,$s/^/  /' "$DIR/$name.json")" >> "$RESULTS.tmp"
+	sep=",
+"
+done
+
+printf '\n}\n' >> "$RESULTS.tmp"
+
+failed=0
+
+# Compares a value of a scenario with the baseline, where higher is
+# worse, or lower with "lower", and for times beyond BENCH_MIN_MS.
+check()
+{
+	old=$(results_value "$BASELINE" "$1" "$2" "$3")
+	new=$(results_value "$RESULTS.tmp" "$1" "$2" "$3")
+	[ -n "$old" ] && [ -n "$new" ] || return 0
+
+	if [ "$4" = lower ]; then
+		worse="$new < $old * (100 - $TOLERANCE) / 100"
+	else
+		worse="$new > $old * (100 + $TOLERANCE) / 100"
+	fi
+	if [ "$5" = ms ]; then
+		worse="$worse && $new - $old > $MIN_MS"
+	fi
+
+	if awk "BEGIN { exit !($worse) }"; then
+		echo "$1: ${2:+$2 }$3 regressed from $old to $new."
+		failed=1
+	fi
+}
+
+# The baseline is read before the results replace it, as they may be
+# the same file.
+if [ -n "$BASELINE" ]; then
+	for name in $(echo "$SCENARIOS" | cut -d'|' -f1); do
+		check "$name" "" parse_mib_per_sec lower
+		check "$name" "" peak_rss_kib
+		check "$name" svg total higher ms
+		check "$name" report total higher ms
+	done
+fi
+
+mv "$RESULTS.tmp" "$RESULTS"
+echo "Results written to $RESULTS."
+
+[ $failed -eq 0 ] || exit 2
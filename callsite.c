@@ -0,0 +1,363 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Profile of the code paths that request repaints. core_repaint_req
+ * carries the call sites of weston_*_schedule_repaint() with the
+ * surface or output they were called for.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "wesgr.h"
+
+static void
+callsite_destroy(struct callsite *cs)
+{
+	free(cs->func);
+	free(cs->label);
+	free(cs);
+}
+
+void
+repaint_requests_release(struct repaint_requests *rr)
+{
+	struct callsite *cs, *tmp;
+
+	for (cs = rr->sites; cs; cs = tmp) {
+		tmp = cs->next;
+		callsite_destroy(cs);
+	}
+
+	memset(rr, 0, sizeof *rr);
+}
+
+static struct callsite *
+get_callsite(struct repaint_requests *rr, const char *func, int64_t line,
+	     unsigned object_id)
+{
+	struct callsite *cs;
+
+	for (cs = rr->sites; cs; cs = cs->next)
+		if (cs->line == line && cs->object_id == object_id &&
+		    strcmp(cs->func, func) == 0)
+			return cs;
+
+	cs = calloc(1, sizeof *cs);
+	if (!cs)
+		return ERROR_NULL;
+
+	cs->func = strdup(func);
+	if (!cs->func) {
+		free(cs);
+		return ERROR_NULL;
+	}
+
+	cs->line = line;
+	cs->object_id = object_id;
+	cs->next = rr->sites;
+	rr->sites = cs;
+
+	return cs;
+}
+
+/*
+ * Counts one call site. The object info may only follow the first
+ * request for it, so label is NULL until it is known. The id goes in
+ * the label, as objects such as cursors share their descriptions.
+ * Every call site after the first one before the repaint begins is
+ * redundant.
+ */
+int
+repaint_requests_add(struct repaint_requests *rr, const char *func,
+		     int64_t line, unsigned object_id, const char *label)
+{
+	struct callsite *cs;
+
+	cs = get_callsite(rr, func, line, object_id);
+	if (!cs)
+		return ERROR;
+
+	if (!cs->label && label) {
+		if (asprintf(&cs->label, "%s [%u]", label, object_id) < 0) {
+			cs->label = NULL;
+			return ERROR;
+		}
+	}
+
+	cs->count++;
+	rr->requests++;
+
+	if (rr->pending > 0) {
+		cs->redundant++;
+		rr->redundant++;
+	} else {
+		rr->trigger = cs;
+	}
+
+	rr->pending++;
+	if (rr->pending > rr->max_per_frame)
+		rr->max_per_frame = rr->pending;
+
+	return 0;
+}
+
+/* A repaint began, serving all the pending requests. */
+void
+repaint_requests_frame(struct repaint_requests *rr)
+{
+	if (rr->pending > 0)
+		rr->frames++;
+
+	rr->serving = rr->trigger;
+	rr->trigger = NULL;
+	rr->pending = 0;
+}
+
+/*
+ * The repaint was submitted. When it flushed no damage, the request
+ * that triggered it was needless.
+ */
+void
+repaint_requests_posted(struct repaint_requests *rr, int empty)
+{
+	if (empty && rr->serving) {
+		rr->serving->without_damage++;
+		rr->without_damage++;
+	}
+
+	rr->serving = NULL;
+}
+
+static const char *
+callsite_label(const struct callsite *cs, char *buf, size_t len)
+{
+	if (cs->label)
+		return cs->label;
+
+	snprintf(buf, len, "[id:%u]", cs->object_id);
+
+	return buf;
+}
+
+static int
+compare_callsite(const void *a, const void *b)
+{
+	const struct callsite *ca = *(const struct callsite * const *)a;
+	const struct callsite *cb = *(const struct callsite * const *)b;
+
+	if (ca->count != cb->count)
+		return ca->count < cb->count ? 1 : -1;
+
+	if (ca->line != cb->line)
+		return ca->line < cb->line ? -1 : 1;
+
+	if (ca->object_id != cb->object_id)
+		return ca->object_id < cb->object_id ? -1 : 1;
+
+	return strcmp(ca->func, cb->func);
+}
+
+/* Returns the call sites most requested first, or NULL with none. */
+static struct callsite **
+repaint_requests_sorted(struct repaint_requests *rr, unsigned *count)
+{
+	struct callsite **arr;
+	struct callsite *cs;
+	unsigned n = 0;
+
+	for (cs = rr->sites; cs; cs = cs->next)
+		n++;
+
+	*count = n;
+	if (n == 0)
+		return NULL;
+
+	arr = calloc(n, sizeof *arr);
+	if (!arr)
+		return ERROR_NULL;
+
+	n = 0;
+	for (cs = rr->sites; cs; cs = cs->next)
+		arr[n++] = cs;
+
+	qsort(arr, n, sizeof *arr, compare_callsite);
+
+	return arr;
+}
+
+static void
+callsite_to_report(const struct callsite *cs, int damage_seen,
+		   struct report *r)
+{
+	char buf[32];
+	const char *label = callsite_label(cs, buf, sizeof buf);
+
+	if (r->format == REPORT_JSON) {
+		report_begin_object(r, NULL);
+		report_string(r, "function", cs->func);
+		report_uint(r, "line", cs->line);
+		report_string(r, "target", label);
+		report_uint(r, "count", cs->count);
+		report_uint(r, "redundant", cs->redundant);
+		if (damage_seen)
+			report_uint(r, "without_damage", cs->without_damage);
+		report_end_object(r);
+		return;
+	}
+
+	/* In text, one call site is one table row. */
+	report_indent(r);
+	fprintf(r->fp, "%8" PRIu64 " %9" PRIu64, cs->count, cs->redundant);
+	if (damage_seen)
+		fprintf(r->fp, " %9" PRIu64, cs->without_damage);
+	fprintf(r->fp, "  %s:%" PRId64 "  %s\n", cs->func, cs->line, label);
+}
+
+/* Damage is only known with core_flush_damage in the log. */
+int
+repaint_requests_to_report(struct repaint_requests *rr, int damage_seen,
+			   struct report *r)
+{
+	struct callsite **sorted;
+	unsigned count;
+	unsigned i;
+
+	sorted = repaint_requests_sorted(rr, &count);
+	if (!sorted && count > 0)
+		return ERROR;
+
+	report_begin_object(r, "repaint_requests");
+	report_uint(r, "requests", rr->requests);
+	report_uint(r, "redundant", rr->redundant);
+	if (damage_seen)
+		report_uint(r, "without_damage", rr->without_damage);
+	report_uint(r, "requested_frames", rr->frames);
+	report_uint(r, "max_per_frame", rr->max_per_frame);
+
+	report_begin_array(r, "call_sites");
+	if (r->format == REPORT_TEXT) {
+		report_indent(r);
+		fprintf(r->fp, "%8s %9s", "count", "redundant");
+		if (damage_seen)
+			fprintf(r->fp, " %9s", "no damage");
+		fprintf(r->fp, "  %s\n", "function:line  target");
+	}
+	for (i = 0; i < count; i++)
+		callsite_to_report(sorted[i], damage_seen, r);
+	report_end_array(r);
+
+	report_end_object(r);
+
+	free(sorted);
+
+	return 0;
+}
+
+/* Frame names cannot contain the separator of folded stacks. */
+static void
+fputs_frame(const char *name, FILE *fp)
+{
+	for (; *name; name++)
+		fputc(*name == ';' ? ',' : *name, fp);
+}
+
+static void
+callsite_to_folded_line(const struct callsite *cs, const char *output,
+			const char *leaf, uint64_t n, FILE *fp)
+{
+	char buf[32];
+
+	if (n == 0)
+		return;
+
+	fputs_frame(output, fp);
+	fputc(';', fp);
+	fputs_frame(cs->func, fp);
+	fprintf(fp, ":%" PRId64 ";", cs->line);
+	fputs_frame(callsite_label(cs, buf, sizeof buf), fp);
+	if (leaf)
+		fprintf(fp, ";%s", leaf);
+	fprintf(fp, " %" PRIu64 "\n", n);
+}
+
+/* Needless requests get a frame of their own above the target. */
+static void
+callsite_to_folded(const struct callsite *cs, const char *output,
+		   int damage_seen, FILE *fp)
+{
+	uint64_t without_damage = damage_seen ? cs->without_damage : 0;
+
+	callsite_to_folded_line(cs, output, NULL,
+				cs->count - cs->redundant - without_damage,
+				fp);
+	callsite_to_folded_line(cs, output, "redundant", cs->redundant, fp);
+	callsite_to_folded_line(cs, output, "no damage", without_damage, fp);
+}
+
+/*
+ * Writes the call sites in the folded stack format of flame graph
+ * tools: output, call site and target as the frames, then the count.
+ */
+int
+graph_data_to_folded(struct graph_data *gdata, const char *filename)
+{
+	struct output_graph *og;
+	struct callsite **sorted;
+	unsigned count;
+	unsigned i;
+	int ret = 0;
+	FILE *fp;
+
+	if (strcmp(filename, "-") == 0)
+		fp = stdout;
+	else
+		fp = fopen(filename, "w");
+	if (!fp)
+		return ERROR;
+
+	for (og = gdata->output; og; og = og->next) {
+		sorted = repaint_requests_sorted(&og->requests, &count);
+		if (!sorted && count > 0) {
+			ret = ERROR;
+			break;
+		}
+
+		for (i = 0; i < count; i++)
+			callsite_to_folded(sorted[i], output_graph_name(og),
+					   gdata->damage_seen, fp);
+
+		free(sorted);
+	}
+
+	if (fp == stdout) {
+		if (fflush(fp) != 0)
+			ret = ERROR;
+	} else if (fclose(fp) != 0) {
+		ret = ERROR;
+	}
+
+	return ret;
+}
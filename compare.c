@@ -0,0 +1,349 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Comparison of two recordings, typically before and after a compositor
+ * change, with latency budgets for regression gating.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "wesgr.h"
+
+/* p-values below this are reported as significant differences */
+#define SIGNIFICANCE_LEVEL 0.01
+
+static const char * const output_histogram_names[] = {
+	"delay_line",
+	"submit_line",
+	"gpu_line",
+	"renderer_gpu_line",
+	"vblank_interval",
+};
+
+static const char * const surface_histogram_names[] = {
+	"commit_to_flush",
+	"flush_to_vblank",
+};
+
+static int
+is_histogram_name(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(output_histogram_names); i++)
+		if (strcmp(output_histogram_names[i], name) == 0)
+			return 1;
+
+	for (i = 0; i < ARRAY_LENGTH(surface_histogram_names); i++)
+		if (strcmp(surface_histogram_names[i], name) == 0)
+			return 1;
+
+	return 0;
+}
+
+struct budget *
+budget_parse(const char *spec)
+{
+	struct budget *b;
+	const char *stat;
+	const char *limit;
+	char *end;
+	double ms;
+
+	stat = strchr(spec, ':');
+	if (!stat)
+		return NULL;
+	stat++;
+
+	limit = strchr(stat, ':');
+	if (!limit)
+		return NULL;
+	limit++;
+
+	ms = strtod(limit, &end);
+	if (*end != '\0' || end == limit || ms < 0.0)
+		return NULL;
+
+	b = calloc(1, sizeof *b);
+	if (!b)
+		return ERROR_NULL;
+
+	b->name = strndup(spec, stat - 1 - spec);
+	b->stat = strndup(stat, limit - 1 - stat);
+	b->limit = ms * 1e6;
+
+	if (!b->name || !b->stat || !is_histogram_name(b->name))
+		goto err;
+
+	if (strcmp(b->stat, "mean") == 0) {
+		b->quantile = -1.0;
+	} else if (strcmp(b->stat, "max") == 0) {
+		b->quantile = 1.0;
+	} else if (b->stat[0] == 'p') {
+		b->quantile = strtod(b->stat + 1, &end) / 100.0;
+		if (*end != '\0' || end == b->stat + 1 ||
+		    b->quantile <= 0.0 || b->quantile > 1.0)
+			goto err;
+	} else {
+		goto err;
+	}
+
+	return b;
+
+err:
+	free(b->name);
+	free(b->stat);
+	free(b);
+
+	return NULL;
+}
+
+void
+budget_list_destroy(struct budget *list)
+{
+	struct budget *b, *tmp;
+
+	for (b = list; b; b = tmp) {
+		tmp = b->next;
+		free(b->name);
+		free(b->stat);
+		free(b);
+	}
+}
+
+static uint64_t
+budget_value(const struct budget *b, const struct histogram *h)
+{
+	if (b->quantile < 0.0)
+		return histogram_mean(h);
+
+	if (b->quantile >= 1.0)
+		return h->max;
+
+	return histogram_quantile(h, b->quantile);
+}
+
+struct histogram *
+output_graph_get_histogram(struct output_graph *og, const char *name)
+{
+	struct line_graph *lanes[OUTPUT_LANES];
+	unsigned i;
+
+	output_graph_lanes(og, lanes);
+	for (i = 0; i < ARRAY_LENGTH(lanes); i++)
+		if (strcmp(lanes[i]->style, name) == 0)
+			return &lanes[i]->durations;
+
+	if (strcmp(name, "vblank_interval") == 0)
+		return &og->vblank_intervals;
+
+	return NULL;
+}
+
+static struct histogram *
+surface_report_get_histogram(struct surface_report *sr, const char *name)
+{
+	if (strcmp(name, "commit_to_flush") == 0)
+		return &sr->commit_to_flush;
+
+	if (strcmp(name, "flush_to_vblank") == 0)
+		return &sr->flush_to_vblank;
+
+	return NULL;
+}
+
+static void
+comparison_to_report(struct report *r, const char *key,
+		     const struct histogram *before,
+		     const struct histogram *after)
+{
+	double p = histogram_mann_whitney(before, after);
+	double mean_a = histogram_mean(before);
+	double change = 0.0;
+
+	if (mean_a > 0.0)
+		change = (histogram_mean(after) - mean_a) / mean_a * 100.0;
+
+	report_begin_object(r, key);
+	report_histogram_header(r);
+	report_histogram(r, "before", before);
+	report_histogram(r, "after", after);
+	report_double(r, "mean_change_percent", change);
+	report_double(r, "p_value", p);
+	report_string(r, "significant", p < SIGNIFICANCE_LEVEL ? "yes" : "no");
+	report_end_object(r);
+}
+
+static void
+output_compare_to_report(struct output_graph *a, struct output_graph *b,
+			 struct report *r)
+{
+	const char *name;
+	unsigned i;
+
+	report_begin_object(r, output_graph_name(a));
+	for (i = 0; i < ARRAY_LENGTH(output_histogram_names); i++) {
+		name = output_histogram_names[i];
+		comparison_to_report(r, name,
+				     output_graph_get_histogram(a, name),
+				     output_graph_get_histogram(b, name));
+	}
+	report_end_object(r);
+}
+
+static struct surface_report *
+find_surface_report(struct surface_report *list, const char *label)
+{
+	struct surface_report *sr;
+
+	for (sr = list; sr; sr = sr->next)
+		if (strcmp(sr->label, label) == 0)
+			return sr;
+
+	return NULL;
+}
+
+static void
+budget_result_to_report(struct report *r, const struct budget *b,
+			const char *where, uint64_t value)
+{
+	int over = value > b->limit;
+
+	report_begin_object(r, NULL);
+	report_string(r, "lane", b->name);
+	report_string(r, "of", where);
+	report_string(r, "stat", b->stat);
+	report_msec(r, "limit", b->limit);
+	report_msec(r, "value", value);
+	report_string(r, "result", over ? "FAIL" : "pass");
+	report_end_object(r);
+}
+
+/* Returns the number of exceeded budgets. */
+static int
+budgets_to_report(struct budget *budgets, struct graph_data *after,
+		  struct surface_report *surfaces, struct report *r)
+{
+	struct budget *b;
+	struct output_graph *og;
+	struct surface_report *sr;
+	struct histogram *h;
+	uint64_t value;
+	int failed = 0;
+
+	report_begin_array(r, "budgets");
+
+	for (b = budgets; b; b = b->next) {
+		for (og = after->output; og; og = og->next) {
+			h = output_graph_get_histogram(og, b->name);
+			if (!h || h->count == 0)
+				continue;
+
+			value = budget_value(b, h);
+			budget_result_to_report(r, b, output_graph_name(og),
+						value);
+			failed += value > b->limit;
+		}
+
+		for (sr = surfaces; sr; sr = sr->next) {
+			h = surface_report_get_histogram(sr, b->name);
+			if (!h || h->count == 0)
+				continue;
+
+			value = budget_value(b, h);
+			budget_result_to_report(r, b, sr->label, value);
+			failed += value > b->limit;
+		}
+	}
+
+	report_end_array(r);
+
+	return failed;
+}
+
+/*
+ * Writes the comparison report, and returns the number of budgets the
+ * after recording exceeds, or -1 on error.
+ */
+int
+graph_data_compare_to_report(struct graph_data *before,
+			     struct graph_data *after,
+			     struct budget *budgets, const char *filename,
+			     enum report_format format)
+{
+	struct surface_report *sa = NULL;
+	struct surface_report *sb = NULL;
+	struct surface_report *sr, *other;
+	struct output_graph *og, *other_og;
+	struct report r;
+	int ret = -1;
+
+	if (surface_report_list_collect(before, &sa) < 0 ||
+	    surface_report_list_collect(after, &sb) < 0)
+		goto out;
+
+	if (report_init(&r, filename, format, before) < 0)
+		goto out;
+
+	report_begin_object(&r, "outputs");
+	for (og = before->output; og; og = og->next) {
+		other_og = graph_data_find_output(after, output_graph_name(og));
+		if (other_og)
+			output_compare_to_report(og, other_og, &r);
+	}
+	report_end_object(&r);
+
+	report_begin_object(&r, "surfaces");
+	for (sr = sa; sr; sr = sr->next) {
+		other = find_surface_report(sb, sr->label);
+		if (!other)
+			continue;
+
+		report_begin_object(&r, sr->label);
+		comparison_to_report(&r, "commit_to_flush",
+				     &sr->commit_to_flush,
+				     &other->commit_to_flush);
+		comparison_to_report(&r, "flush_to_vblank",
+				     &sr->flush_to_vblank,
+				     &other->flush_to_vblank);
+		report_end_object(&r);
+	}
+	report_end_object(&r);
+
+	ret = budgets_to_report(budgets, after, sb, &r);
+
+	if (report_finish(&r) < 0)
+		ret = -1;
+
+out:
+	surface_report_list_destroy(sa);
+	surface_report_list_destroy(sb);
+
+	if (ret < 0)
+		return ERROR;
+
+	return ret;
+}
@@ -0,0 +1,2 @@
+DEP_CFLAGS=-I/tmp/jsonshim 
+DEP_LIBS=/tmp/jsonshim/libjson-c.a 
@@ -0,0 +1,762 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * wesgr-gen writes synthetic Weston timeline logs for benchmarking. The
+ * repaint loop of every output is simulated after Weston's, driven by
+ * surfaces committing damage at random.
+ * The same options and seed always give the same log.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_USEC 1000
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+/* Weston starts repainting this long before the next vblank. */
+#define REPAINT_WINDOW_NSEC (7 * NSEC_PER_MSEC)
+
+/* Far more than the simulation ever has pending at once */
+#define EVENT_QUEUE_SIZE 4096
+
+/* The clock of the log starts here, like a CLOCK_MONOTONIC of a while. */
+#define START_SEC 1000
+
+enum event_type {
+	EV_COMMIT_DAMAGE,
+	EV_REPAINT_REQ,
+	EV_ENTER_LOOP,
+	EV_EXIT_LOOP,
+	EV_FINISHED,
+	EV_BEGIN,
+	EV_FLUSH_DAMAGE,
+	EV_POSTED,
+	EV_GPU_BEGIN,
+	EV_GPU_END,
+};
+
+struct event {
+	uint64_t t;
+	uint64_t seq;		/* keeps events at the same time in order */
+	enum event_type type;
+	unsigned wo;
+	unsigned ws;
+	uint64_t aux;		/* vblank or GPU time */
+};
+
+struct callsite {
+	const char *func;
+	int line;
+};
+
+static const struct callsite callsites[] = {
+	{ "weston_view_schedule_repaint", 1249 },
+	{ "weston_surface_schedule_repaint", 1262 },
+	{ "weston_output_damage", 1680 },
+	{ "weston_surface_commit", 2540 },
+	{ "notify_motion", 1033 },
+};
+
+struct surface {
+	unsigned id;
+	unsigned output;
+	uint64_t next_commit;
+	uint64_t mean_interval;	/* 0 for a surface that never commits */
+	int damaged;
+};
+
+struct output {
+	unsigned id;
+	uint64_t period;
+	uint64_t phase;		/* time of some vblank */
+	uint64_t next_vblank;	/* when looping */
+	uint64_t idle_since;	/* when not looping */
+	int looping;
+	int requested;		/* since the last repaint began */
+};
+
+struct gen_options {
+	const char *outfile;
+	unsigned outputs;
+	unsigned surfaces;
+	double refresh_hz[8];
+	unsigned refresh_count;
+	double commit_hz;
+	double miss_rate;
+	double duration_sec;
+	uint64_t max_bytes;	/* 0 for no limit */
+	uint64_t seed;
+	int gpu;
+	int vblank_stamps;
+};
+
+struct gen {
+	struct gen_options opts;
+	FILE *fp;
+	uint64_t bytes;
+	uint64_t rng;
+	struct output *output;
+	struct surface *surface;
+	struct event queue[EVENT_QUEUE_SIZE];	/* a binary min-heap */
+	unsigned queued;
+	uint64_t seq;
+};
+
+/* xorshift64*, so that the log is the same on every libc */
+static uint64_t
+gen_random(struct gen *g)
+{
+	g->rng ^= g->rng >> 12;
+	g->rng ^= g->rng << 25;
+	g->rng ^= g->rng >> 27;
+
+	return g->rng * UINT64_C(2685821657736338717);
+}
+
+/* uniform in [0, 1) */
+static double
+gen_uniform(struct gen *g)
+{
+	return (gen_random(g) >> 11) * (1.0 / (UINT64_C(1) << 53));
+}
+
+static uint64_t
+gen_exponential(struct gen *g, uint64_t mean)
+{
+	return -log(1.0 - gen_uniform(g)) * mean;
+}
+
+static uint64_t
+gen_between(struct gen *g, uint64_t a, uint64_t b)
+{
+	return a + gen_uniform(g) * (b - a);
+}
+
+static int
+event_before(const struct event *a, const struct event *b)
+{
+	if (a->t != b->t)
+		return a->t < b->t;
+
+	return a->seq < b->seq;
+}
+
+static void
+event_swap(struct event *a, struct event *b)
+{
+	struct event tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+static void
+queue_push(struct gen *g, uint64_t t, enum event_type type,
+	   unsigned wo, unsigned ws, uint64_t aux)
+{
+	struct event *q = g->queue;
+	unsigned i = g->queued++;
+
+	if (g->queued > EVENT_QUEUE_SIZE) {
+		fprintf(stderr, "Error: event queue overflow.\n");
+		exit(1);
+	}
+
+	q[i] = (struct event){ t, g->seq++, type, wo, ws, aux };
+
+	while (i > 0 && event_before(&q[i], &q[(i - 1) / 2])) {
+		event_swap(&q[i], &q[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+}
+
+static struct event
+queue_pop(struct gen *g)
+{
+	struct event *q = g->queue;
+	struct event top = q[0];
+	unsigned i = 0;
+	unsigned c;
+
+	q[0] = q[--g->queued];
+
+	while ((c = 2 * i + 1) < g->queued) {
+		if (c + 1 < g->queued && event_before(&q[c + 1], &q[c]))
+			c++;
+		if (!event_before(&q[c], &q[i]))
+			break;
+		event_swap(&q[c], &q[i]);
+		i = c;
+	}
+
+	return top;
+}
+
+static void
+gen_printf(struct gen *g, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void
+gen_printf(struct gen *g, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vfprintf(g->fp, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+		g->bytes += n;
+}
+
+static void
+print_ts(struct gen *g, const char *key, uint64_t t)
+{
+	gen_printf(g, "\"%s\":[%llu, %llu]", key,
+		   (unsigned long long)(START_SEC + t / NSEC_PER_SEC),
+		   (unsigned long long)(t % NSEC_PER_SEC));
+}
+
+static void
+print_callsite(struct gen *g, unsigned ws)
+{
+	const struct callsite *cs = &callsites[ws % ARRAY_LENGTH(callsites)];
+
+	gen_printf(g, ",\n\t\"C\": [\n\t\t{ \"f\":\"%s\", \"l\":%d, \"ws\":%u }"
+		   "\n\t] }\n", cs->func, cs->line, ws);
+}
+
+static void
+print_event(struct gen *g, const struct event *ev)
+{
+	static const char * const names[] = {
+		[EV_COMMIT_DAMAGE] = "core_commit_damage",
+		[EV_REPAINT_REQ] = "core_repaint_req",
+		[EV_ENTER_LOOP] = "core_repaint_enter_loop",
+		[EV_EXIT_LOOP] = "core_repaint_exit_loop",
+		[EV_FINISHED] = "core_repaint_finished",
+		[EV_BEGIN] = "core_repaint_begin",
+		[EV_FLUSH_DAMAGE] = "core_flush_damage",
+		[EV_POSTED] = "core_repaint_posted",
+		[EV_GPU_BEGIN] = "renderer_gpu_begin",
+		[EV_GPU_END] = "renderer_gpu_end",
+	};
+
+	gen_printf(g, "{ ");
+	print_ts(g, "T", ev->t);
+	gen_printf(g, ", \"N\":\"%s\"", names[ev->type]);
+
+	switch (ev->type) {
+	case EV_COMMIT_DAMAGE:
+		gen_printf(g, ", \"ws\":%u }\n", ev->ws);
+		break;
+	case EV_FLUSH_DAMAGE:
+		gen_printf(g, ", \"ws\":%u, \"wo\":%u }\n", ev->ws, ev->wo);
+		break;
+	case EV_REPAINT_REQ:
+	case EV_ENTER_LOOP:
+		gen_printf(g, ", \"wo\":%u", ev->wo);
+		print_callsite(g, ev->ws);
+		break;
+	case EV_FINISHED:
+		gen_printf(g, ", \"wo\":%u", ev->wo);
+		if (g->opts.vblank_stamps) {
+			gen_printf(g, ", ");
+			print_ts(g, "vblank", ev->aux);
+		}
+		gen_printf(g, " }\n");
+		break;
+	case EV_GPU_BEGIN:
+	case EV_GPU_END:
+		gen_printf(g, ", \"wo\":%u, ", ev->wo);
+		print_ts(g, "gpu", ev->aux);
+		gen_printf(g, " }\n");
+		break;
+	default:
+		gen_printf(g, ", \"wo\":%u }\n", ev->wo);
+		break;
+	}
+}
+
+/* Writes out every queued event from before t. */
+static void
+gen_flush(struct gen *g, uint64_t t)
+{
+	struct event ev;
+
+	while (g->queued > 0 && g->queue[0].t <= t) {
+		ev = queue_pop(g);
+		print_event(g, &ev);
+	}
+}
+
+static uint64_t
+output_vblank_after(const struct output *o, uint64_t t)
+{
+	uint64_t n;
+
+	if (t <= o->phase)
+		return o->phase;
+
+	n = (t - o->phase + o->period - 1) / o->period;
+
+	return o->phase + n * o->period;
+}
+
+static void
+gen_commit(struct gen *g, struct surface *s, uint64_t t)
+{
+	struct output *o = &g->output[s->output];
+	uint64_t start;
+
+	queue_push(g, t, EV_COMMIT_DAMAGE, 0, s->id, 0);
+	s->damaged = 1;
+
+	if (!o->looping) {
+		/* the loop cannot restart before its exit is logged */
+		start = t > o->idle_since ? t : o->idle_since;
+		queue_push(g, start, EV_REPAINT_REQ, o->id, s->id, 0);
+		queue_push(g, start + gen_between(g, 10, 100) * NSEC_PER_USEC,
+			   EV_ENTER_LOOP, o->id, s->id, 0);
+		o->looping = 1;
+		o->requested = 1;
+		o->next_vblank = output_vblank_after(o, start + NSEC_PER_MSEC);
+	} else if (!o->requested) {
+		queue_push(g, t, EV_REPAINT_REQ, o->id, s->id, 0);
+		o->requested = 1;
+	}
+
+	s->next_commit = t + gen_exponential(g, s->mean_interval);
+}
+
+/* Time to render n damaged surfaces, now and then too long for a frame */
+static uint64_t
+gen_render_time(struct gen *g, struct output *o, unsigned n)
+{
+	if (gen_uniform(g) < g->opts.miss_rate)
+		return gen_between(g, o->period, o->period * 5 / 2);
+
+	return (300 + 150 * n) * NSEC_PER_USEC +
+	       gen_exponential(g, 300 * NSEC_PER_USEC);
+}
+
+static void
+gen_vblank(struct gen *g, struct output *o)
+{
+	uint64_t vblank = o->next_vblank;
+	uint64_t finished = vblank + gen_between(g, 40, 150) * NSEC_PER_USEC;
+	uint64_t begin, posted, gpu_begin, gpu_end;
+	unsigned damaged = 0;
+	unsigned i;
+
+	queue_push(g, finished, EV_FINISHED, o->id, 0, vblank);
+
+	if (!o->requested) {
+		o->idle_since = finished + gen_between(g, 5, 30) *
+				NSEC_PER_USEC;
+		queue_push(g, o->idle_since, EV_EXIT_LOOP, o->id, 0, 0);
+		o->looping = 0;
+		return;
+	}
+
+	begin = vblank + o->period - REPAINT_WINDOW_NSEC;
+	if (begin < finished)
+		begin = finished;
+	begin += gen_between(g, 0, 200) * NSEC_PER_USEC;
+	queue_push(g, begin, EV_BEGIN, o->id, 0, 0);
+
+	for (i = 0; i < g->opts.surfaces; i++) {
+		struct surface *s = &g->surface[i];
+
+		if (s->output != o->id - 1 || !s->damaged)
+			continue;
+
+		queue_push(g, begin + (10 + damaged * 5) * NSEC_PER_USEC,
+			   EV_FLUSH_DAMAGE, o->id, s->id, 0);
+		s->damaged = 0;
+		damaged++;
+	}
+
+	posted = begin + gen_render_time(g, o, damaged);
+	queue_push(g, posted, EV_POSTED, o->id, 0, 0);
+
+	if (g->opts.gpu) {
+		gpu_begin = begin + (posted - begin) / 4;
+		gpu_end = posted + gen_exponential(g, 2 * NSEC_PER_MSEC);
+		queue_push(g, posted, EV_GPU_BEGIN, o->id, 0, gpu_begin);
+		queue_push(g, posted, EV_GPU_END, o->id, 0, gpu_end);
+	}
+
+	o->requested = 0;
+	o->next_vblank = output_vblank_after(o, posted + 1);
+}
+
+static void
+gen_objects(struct gen *g)
+{
+	unsigned i;
+
+	for (i = 0; i < g->opts.outputs; i++)
+		gen_printf(g, "{ \"id\":%u, \"type\":\"weston_output\", "
+			   "\"name\":\"OUT-%u\" }\n", g->output[i].id, i + 1);
+
+	for (i = 0; i < g->opts.surfaces; i++)
+		gen_printf(g, "{ \"id\":%u, \"type\":\"weston_surface\", "
+			   "\"desc\":\"surface %u on OUT-%u\" }\n",
+			   g->surface[i].id, i + 1, g->surface[i].output + 1);
+}
+
+static int
+gen_init(struct gen *g, const struct gen_options *opts)
+{
+	unsigned i;
+
+	memset(g, 0, sizeof *g);
+	g->opts = *opts;
+	g->rng = opts->seed * UINT64_C(0x9e3779b97f4a7c15) | 1;
+
+	g->output = calloc(opts->outputs, sizeof *g->output);
+	g->surface = calloc(opts->surfaces, sizeof *g->surface);
+	if (!g->output || !g->surface)
+		return -1;
+
+	for (i = 0; i < opts->outputs; i++) {
+		struct output *o = &g->output[i];
+		double hz = opts->refresh_hz[i % opts->refresh_count];
+
+		o->id = i + 1;
+		o->period = NSEC_PER_SEC / hz;
+		o->phase = gen_between(g, 0, o->period);
+	}
+
+	/*
+	 * Surfaces are spread over the outputs, and the first surfaces
+	 * commit most often, like a game next to a clock.
+	 */
+	for (i = 0; i < opts->surfaces; i++) {
+		struct surface *s = &g->surface[i];
+		double hz = opts->commit_hz / (1 + i / opts->outputs);
+
+		s->id = opts->outputs + i + 1;
+		s->output = i % opts->outputs;
+		if (hz > 0.0) {
+			s->mean_interval = NSEC_PER_SEC / hz;
+			s->next_commit = gen_exponential(g, s->mean_interval);
+		} else {
+			s->next_commit = UINT64_MAX;
+		}
+	}
+
+	return 0;
+}
+
+static void
+gen_release(struct gen *g)
+{
+	free(g->output);
+	free(g->surface);
+}
+
+/* Runs the simulation event by event, the earliest first. */
+static int
+gen_run(struct gen *g)
+{
+	uint64_t end = g->opts.duration_sec * NSEC_PER_SEC;
+	struct surface *next_s;
+	struct output *next_o;
+	uint64_t t;
+	unsigned i;
+
+	gen_objects(g);
+
+	while (!g->opts.max_bytes || g->bytes < g->opts.max_bytes) {
+		next_s = NULL;
+		next_o = NULL;
+		t = UINT64_MAX;
+
+		for (i = 0; i < g->opts.surfaces; i++) {
+			if (g->surface[i].next_commit < t) {
+				next_s = &g->surface[i];
+				t = next_s->next_commit;
+			}
+		}
+
+		for (i = 0; i < g->opts.outputs; i++) {
+			if (g->output[i].looping &&
+			    g->output[i].next_vblank < t) {
+				next_o = &g->output[i];
+				t = next_o->next_vblank;
+				next_s = NULL;
+			}
+		}
+
+		if (t >= end)
+			break;
+
+		gen_flush(g, t);
+
+		if (next_o)
+			gen_vblank(g, next_o);
+		else
+			gen_commit(g, next_s, t);
+
+		if (ferror(g->fp))
+			return -1;
+	}
+
+	gen_flush(g, UINT64_MAX);
+
+	return ferror(g->fp) ? -1 : 0;
+}
+
+static uint64_t
+parse_size(const char *str)
+{
+	char *end;
+	double v = strtod(str, &end);
+
+	switch (*end) {
+	case 'G':
+		v *= 1024;
+		/* fall through */
+	case 'M':
+		v *= 1024;
+		/* fall through */
+	case 'K':
+		v *= 1024;
+		end++;
+		break;
+	}
+
+	if (*end != '\0' || end == str || v <= 0.0)
+		return 0;
+
+	return v;
+}
+
+static unsigned
+parse_refresh(struct gen_options *opts, const char *str)
+{
+	char *end;
+
+	opts->refresh_count = 0;
+
+	while (opts->refresh_count < ARRAY_LENGTH(opts->refresh_hz)) {
+		double hz = strtod(str, &end);
+
+		if (end == str || hz < 1.0)
+			return 0;
+
+		opts->refresh_hz[opts->refresh_count++] = hz;
+		if (*end != ',')
+			break;
+		str = end + 1;
+	}
+
+	return *end == '\0' ? opts->refresh_count : 0;
+}
+
+static void
+print_usage(const char *prog)
+{
+	printf("Usage:\n  %s [options]\n"
+	"Writes a synthetic Weston timeline log.\n"
+	"Options:\n"
+	"  -h, --help                Print this help and exit.\n"
+	"  -o, --output=FILE         Write the log to FILE instead of\n"
+	"                            standard output.\n"
+	"  -n, --outputs=N           Simulate N outputs (default 2).\n"
+	"  -s, --surfaces=N          Simulate N surfaces (default 4), spread\n"
+	"                            over the outputs.\n"
+	"  -r, --refresh=HZ[,HZ...]  Refresh rates of the outputs, repeated\n"
+	"                            as needed (default 60).\n"
+	"  -c, --commit-rate=HZ      Damage commits per second of the\n"
+	"                            busiest surface (default 30). Surface N\n"
+	"                            of an output commits at 1/N of this.\n"
+	"  -m, --miss-rate=FRACTION  Frames rendered too slowly for their\n"
+	"                            vblank (default 0.01).\n"
+	"  -d, --duration=SEC        Length of the recording (default 60).\n"
+	"  -l, --limit=SIZE          Stop after SIZE bytes, with an optional\n"
+	"                            K, M or G suffix.\n"
+	"  -S, --seed=N              Seed of the random numbers (default 1).\n"
+	"  -g, --gpu                 Add GPU timestamps.\n"
+	"  -V, --no-vblank           Leave vblank timestamps out, like old\n"
+	"                            Weston versions.\n",
+	prog);
+}
+
+static int
+parse_opts(struct gen_options *opts, int argc, char *argv[])
+{
+	static const char short_opts[] = "ho:n:s:r:c:m:d:l:S:gV";
+	static const struct option long_opts[] = {
+		{ "help",        no_argument,       0, 'h' },
+		{ "output",      required_argument, 0, 'o' },
+		{ "outputs",     required_argument, 0, 'n' },
+		{ "surfaces",    required_argument, 0, 's' },
+		{ "refresh",     required_argument, 0, 'r' },
+		{ "commit-rate", required_argument, 0, 'c' },
+		{ "miss-rate",   required_argument, 0, 'm' },
+		{ "duration",    required_argument, 0, 'd' },
+		{ "limit",       required_argument, 0, 'l' },
+		{ "seed",        required_argument, 0, 'S' },
+		{ "gpu",         no_argument,       0, 'g' },
+		{ "no-vblank",   no_argument,       0, 'V' },
+		{ NULL, 0, 0, 0 }
+	};
+
+	while (1) {
+		int c;
+		int longindex;
+
+		c = getopt_long(argc, argv, short_opts, long_opts, &longindex);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case '?':
+			return -1;
+		case 'h':
+			print_usage(argv[0]);
+			return -1;
+		case 'o':
+			opts->outfile = optarg;
+			break;
+		case 'n':
+			opts->outputs = atoi(optarg);
+			break;
+		case 's':
+			opts->surfaces = atoi(optarg);
+			break;
+		case 'r':
+			if (parse_refresh(opts, optarg) == 0) {
+				fprintf(stderr, "Error: bad refresh rates "
+					"'%s'.\n", optarg);
+				return -1;
+			}
+			break;
+		case 'c':
+			opts->commit_hz = atof(optarg);
+			break;
+		case 'm':
+			opts->miss_rate = atof(optarg);
+			break;
+		case 'd':
+			opts->duration_sec = atof(optarg);
+			break;
+		case 'l':
+			opts->max_bytes = parse_size(optarg);
+			if (opts->max_bytes == 0) {
+				fprintf(stderr, "Error: bad size '%s'.\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 'S':
+			opts->seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'g':
+			opts->gpu = 1;
+			break;
+		case 'V':
+			opts->vblank_stamps = 0;
+			break;
+		}
+	}
+
+	if (optind < argc) {
+		fprintf(stderr, "Error: unexpected argument '%s'.\n",
+			argv[optind]);
+		return -1;
+	}
+
+	if (opts->outputs < 1 || opts->commit_hz < 0.0 ||
+	    opts->miss_rate < 0.0 || opts->miss_rate > 1.0) {
+		fprintf(stderr, "Error: bad simulation parameters.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct gen_options opts = {
+		.outputs = 2,
+		.surfaces = 4,
+		.refresh_hz = { 60.0 },
+		.refresh_count = 1,
+		.commit_hz = 30.0,
+		.miss_rate = 0.01,
+		.duration_sec = -1.0,
+		.seed = 1,
+		.vblank_stamps = 1,
+	};
+	static struct gen g;
+	int ret;
+
+	if (parse_opts(&opts, argc, argv) < 0)
+		return 1;
+
+	if (opts.duration_sec < 0.0)
+		opts.duration_sec = opts.max_bytes ? 1e9 : 60.0;
+
+	if (gen_init(&g, &opts) < 0) {
+		fprintf(stderr, "Error: out of memory.\n");
+		return 1;
+	}
+
+	if (opts.outfile)
+		g.fp = fopen(opts.outfile, "w");
+	else
+		g.fp = stdout;
+	if (!g.fp) {
+		fprintf(stderr, "Error: cannot open '%s'.\n", opts.outfile);
+		return 1;
+	}
+
+	setvbuf(g.fp, NULL, _IOFBF, 1 << 20);
+
+	ret = gen_run(&g);
+	if (fclose(g.fp) != 0)
+		ret = -1;
+
+	gen_release(&g);
+
+	if (ret < 0) {
+		fprintf(stderr, "Error: writing the log failed.\n");
+		return 1;
+	}
+
+	return 0;
+}
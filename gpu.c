@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * GPU utilization from the renderer_gpu_line blocks, and how often the
+ * GPU is still rendering one frame when the CPU starts on the next.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "wesgr.h"
+
+/*
+ * Adds the time covered by the blocks of a lane to n buckets of step
+ * nanoseconds each, the first starting at from nanoseconds after begin.
+ */
+void
+line_graph_busy_time(const struct line_graph *lg,
+		     const struct timespec *begin,
+		     uint64_t from, uint64_t step, unsigned n,
+		     uint64_t *busy)
+{
+	const struct line_block *lb;
+	uint64_t end = from + step * n;
+	uint64_t a, b, t, next;
+	unsigned i;
+
+	for (lb = lg->block; lb; lb = lb->next) {
+		if (!timespec_is_valid(&lb->end) ||
+		    timespec_cmp(&lb->end, begin) < 0)
+			continue;
+
+		a = timespec_sub_to_nsec(&lb->begin, begin);
+		b = timespec_sub_to_nsec(&lb->end, begin);
+		if (a < from)
+			a = from;
+		if (b > end)
+			b = end;
+
+		for (t = a; t < b; t = next) {
+			i = (t - from) / step;
+			next = from + (uint64_t)(i + 1) * step;
+			if (next > b)
+				next = b;
+
+			busy[i] += next - t;
+		}
+	}
+}
+
+void
+gpu_stats_init(struct gpu_stats *gs)
+{
+	memset(gs, 0, sizeof *gs);
+	histogram_init(&gs->overlap);
+	gs->window = GPU_WINDOW_NSEC;
+	timespec_invalidate(&gs->last_begin);
+}
+
+void
+gpu_stats_release(struct gpu_stats *gs)
+{
+	histogram_release(&gs->overlap);
+}
+
+static void
+gpu_stats_retire_window(struct gpu_stats *gs)
+{
+	uint64_t *busy = &gs->window_busy[gs->window_first % GPU_WINDOW_RING];
+
+	if (*busy > gs->peak_busy)
+		gs->peak_busy = *busy;
+
+	*busy = 0;
+	gs->window_first++;
+}
+
+/*
+ * Only the last few windows are kept. GPU work that ends up in a window
+ * already retired still counts towards the total.
+ */
+static void
+gpu_stats_add_busy(struct gpu_stats *gs, uint64_t a, uint64_t b)
+{
+	uint64_t t, next, w;
+	unsigned i;
+
+	for (t = a; t < b; t = next) {
+		w = t / gs->window;
+		next = (w + 1) * gs->window;
+		if (next > b)
+			next = b;
+
+		gs->busy += next - t;
+
+		if (w < gs->window_first)
+			continue;
+
+		/* skip over idle windows at once */
+		if (w >= gs->window_first + 2 * GPU_WINDOW_RING) {
+			for (i = 0; i < GPU_WINDOW_RING; i++)
+				gpu_stats_retire_window(gs);
+			gs->window_first = w;
+		}
+
+		while (w >= gs->window_first + GPU_WINDOW_RING)
+			gpu_stats_retire_window(gs);
+
+		gs->window_busy[w % GPU_WINDOW_RING] += next - t;
+	}
+}
+
+/* Whether the GPU was still busy when this output_repaint() began */
+static int
+gpu_stats_pair_submit(struct gpu_stats *gs, const struct gpu_interval *submit)
+{
+	uint64_t overlap;
+
+	if (!timespec_is_valid(&gs->last_begin))
+		return 0;
+
+	gs->frames++;
+
+	if (timespec_cmp(&gs->last_end, &submit->begin) <= 0)
+		return 0;
+
+	if (timespec_cmp(&gs->last_end, &submit->end) < 0)
+		overlap = timespec_sub_to_nsec(&gs->last_end, &submit->begin);
+	else
+		overlap = timespec_sub_to_nsec(&submit->end, &submit->begin);
+
+	gs->overlapping++;
+
+	return histogram_add(&gs->overlap, overlap);
+}
+
+static int
+gpu_stats_pair_pending(struct gpu_stats *gs, const struct timespec *until)
+{
+	unsigned i = 0;
+
+	while (i < gs->pending_count &&
+	       (!until || timespec_cmp(&gs->pending[i].begin, until) <= 0)) {
+		if (gpu_stats_pair_submit(gs, &gs->pending[i]) < 0)
+			return ERROR;
+		i++;
+	}
+
+	gs->pending_count -= i;
+	memmove(gs->pending, gs->pending + i,
+		gs->pending_count * sizeof gs->pending[0]);
+
+	return 0;
+}
+
+/*
+ * GPU timestamps arrive after the frame, so an output_repaint() waits
+ * here until GPU work that started after it is seen. Until then, the
+ * GPU work it follows may still be unknown.
+ */
+int
+gpu_stats_add_submit(struct gpu_stats *gs, const struct timespec *begin,
+		     const struct timespec *end)
+{
+	if (gs->pending_count == GPU_PENDING &&
+	    gpu_stats_pair_pending(gs, &gs->pending[0].begin) < 0)
+		return ERROR;
+
+	gs->pending[gs->pending_count].begin = *begin;
+	gs->pending[gs->pending_count].end = *end;
+	gs->pending_count++;
+
+	return 0;
+}
+
+int
+gpu_stats_add_render(struct gpu_stats *gs, const struct timespec *origin,
+		     const struct timespec *begin, const struct timespec *end)
+{
+	if (gpu_stats_pair_pending(gs, begin) < 0)
+		return ERROR;
+
+	if (timespec_cmp(begin, end) < 0)
+		gpu_stats_add_busy(gs, timespec_sub_to_nsec(begin, origin),
+				   timespec_sub_to_nsec(end, origin));
+
+	gs->last_begin = *begin;
+	gs->last_end = *end;
+
+	return 0;
+}
+
+int
+gpu_stats_finish(struct gpu_stats *gs)
+{
+	unsigned i;
+
+	for (i = 0; i < GPU_WINDOW_RING; i++)
+		gpu_stats_retire_window(gs);
+
+	return gpu_stats_pair_pending(gs, NULL);
+}
@@ -26,9 +26,13 @@
 #include <math.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "wesgr.h"
 
+/* Evictions per retention period */
+#define RETAIN_STEPS 8
+
 struct svg_context {
 	FILE *fp;
 	struct timespec begin;
@@ -40,6 +44,18 @@ struct svg_context {
 	struct {
 		uint64_t a, b;
 	} time_range;
+
+	const struct svg_options *opts;
+	const char *caption;	/* after the output titles, or NULL */
+
+	/* with anomalies_only, the sorted spans of the current output */
+	struct time_window *window;
+	unsigned window_count;
+	unsigned window_alloc;
+};
+
+struct time_window {
+	uint64_t a, b;
 };
 
 int
@@ -51,24 +67,15 @@ graph_data_init(struct graph_data *gdata)
 	return 0;
 }
 
-static void
-update_destroy(struct update *update)
-{
-	free(update);
-}
-
 static void
 update_graph_destroy(struct update_graph *update_gr)
 {
-	struct update *update, *tmp;
-
 	assert(update_gr->need_vblank == NULL);
 
-	for (update = update_gr->updates; update; update = tmp) {
-		tmp = update->next;
-		update_destroy(update);
-	}
-
+	node_pool_release(&update_gr->pool);
+	histogram_release(&update_gr->latency.commit_to_flush);
+	histogram_release(&update_gr->latency.flush_to_vblank);
+	histogram_release(&update_gr->latency.total);
 	free(update_gr->label);
 	free(update_gr);
 }
@@ -84,73 +91,11 @@ update_graph_list_destroy(struct update_graph *update_gr)
 	}
 }
 
-static void
-activity_destroy(struct activity *act)
-{
-	free(act);
-}
-
-static void
-activity_set_release(struct activity_set *acts)
-{
-	struct activity *act, *tmp;
-
-	for (act = acts->act; act; act = tmp) {
-		tmp = act->next;
-		activity_destroy(act);
-	}
-}
-
-static void
-vblank_destroy(struct vblank *vbl)
-{
-	free(vbl);
-}
-
-static void
-vblank_set_release(struct vblank_set *vblanks)
-{
-	struct vblank *vbl, *tmp;
-
-	for (vbl = vblanks->vbl; vbl; vbl = tmp) {
-		tmp = vbl->next;
-		vblank_destroy(vbl);
-	}
-}
-
-static void
-transition_destroy(struct transition *tr)
-{
-	free(tr);
-}
-
-static void
-transition_set_release(struct transition_set *tset)
-{
-	struct transition *tr, *tmp;
-
-	for (tr = tset->trans; tr; tr = tmp) {
-		tmp = tr->next;
-		transition_destroy(tr);
-	}
-}
-
-static void
-line_block_destroy(struct line_block *bl)
-{
-	free(bl->desc);
-	free(bl);
-}
-
 static void
 line_graph_release(struct line_graph *linegr)
 {
-	struct line_block *lb, *tmp;
-
-	for (lb = linegr->block; lb; lb = tmp) {
-		tmp = lb->next;
-		line_block_destroy(lb);
-	}
+	node_pool_release(&linegr->pool);
+	histogram_release(&linegr->durations);
 }
 
 static void
@@ -160,11 +105,16 @@ output_graph_destroy(struct output_graph *og)
 	line_graph_release(&og->submit_line);
 	line_graph_release(&og->gpu_line);
 	line_graph_release(&og->renderer_gpu_line);
-	transition_set_release(&og->begins);
-	transition_set_release(&og->posts);
-	vblank_set_release(&og->vblanks);
-	activity_set_release(&og->not_looping);
+	node_pool_release(&og->begins.pool);
+	node_pool_release(&og->posts.pool);
+	node_pool_release(&og->vblanks.pool);
+	node_pool_release(&og->not_looping.pool);
 	update_graph_list_destroy(og->updates);
+	histogram_release(&og->vblank_intervals);
+	histogram_release(&og->loops.busy);
+	histogram_release(&og->loops.idle);
+	gpu_stats_release(&og->gpu);
+	repaint_requests_release(&og->requests);
 	free(og);
 }
 
@@ -179,69 +129,91 @@ graph_data_release(struct graph_data *gdata)
 	}
 }
 
-void
-graph_data_time(struct graph_data *gdata, const struct timespec *ts)
+struct output_graph *
+graph_data_find_output(struct graph_data *gdata, const char *name)
 {
-	if (!timespec_is_valid(&gdata->begin))
-		gdata->begin = *ts;
-	gdata->end = *ts;
-}
-
-#define NSEC_PER_SEC 1000000000
+	struct output_graph *og;
 
-static int
-timespec_cmp(const struct timespec *a, const struct timespec *b)
-{
-	assert(a->tv_nsec >= 0 && a->tv_nsec < NSEC_PER_SEC);
-	assert(b->tv_nsec >= 0 && b->tv_nsec < NSEC_PER_SEC);
+	for (og = gdata->output; og; og = og->next)
+		if (strcmp(output_graph_name(og), name) == 0)
+			return og;
 
-	if (a->tv_sec < b->tv_sec)
-		return -1;
+	return NULL;
+}
 
-	if (a->tv_sec > b->tv_sec)
-		return 1;
+/* Fills lanes with the OUTPUT_LANES lanes of og, in drawing order. */
+void
+output_graph_lanes(struct output_graph *og, struct line_graph **lanes)
+{
+	lanes[0] = &og->delay_line;
+	lanes[1] = &og->submit_line;
+	lanes[2] = &og->gpu_line;
+	lanes[3] = &og->renderer_gpu_line;
+}
 
-	if (a->tv_nsec < b->tv_nsec)
-		return -1;
+static void
+output_graph_evict(struct output_graph *og, const struct timespec *horizon)
+{
+	struct update_graph *upg;
 
-	if (a->tv_nsec > b->tv_nsec)
-		return 1;
+	node_pool_evict(&og->delay_line.pool, horizon);
+	node_pool_evict(&og->submit_line.pool, horizon);
+	node_pool_evict(&og->gpu_line.pool, horizon);
+	node_pool_evict(&og->renderer_gpu_line.pool, horizon);
+	node_pool_evict(&og->begins.pool, horizon);
+	node_pool_evict(&og->posts.pool, horizon);
+	node_pool_evict(&og->vblanks.pool, horizon);
+	node_pool_evict(&og->not_looping.pool, horizon);
 
-	return 0;
+	for (upg = og->updates; upg; upg = upg->next)
+		node_pool_evict(&upg->pool, horizon);
 }
 
+/*
+ * Drops the graph nodes from more than retain_ns before ts. The graph
+ * keeps up to a RETAIN_STEPS-th more than asked for, plus the chunks
+ * that are not full of old nodes yet.
+ */
 static void
-timespec_sub(struct timespec *r,
-	     const struct timespec *a, const struct timespec *b)
+graph_data_evict(struct graph_data *gdata, const struct timespec *ts)
 {
-	r->tv_sec = a->tv_sec - b->tv_sec;
-	r->tv_nsec = a->tv_nsec - b->tv_nsec;
-	if (r->tv_nsec < 0) {
-		r->tv_sec--;
-		r->tv_nsec += NSEC_PER_SEC;
-	}
-}
+	struct output_graph *og;
+	struct timespec horizon;
 
-static uint64_t
-timespec_sub_to_nsec(const struct timespec *a, const struct timespec *b)
-{
-	struct timespec d;
-	uint64_t sec, nsec;
+	timespec_add_nsec(&gdata->next_evict, ts,
+			  gdata->retain_ns / RETAIN_STEPS);
+	timespec_add_nsec(&horizon, ts, -(int64_t)gdata->retain_ns);
 
-	if (!timespec_is_valid(a))
-		return UINT64_MAX;
+	for (og = gdata->output; og; og = og->next)
+		output_graph_evict(og, &horizon);
+}
 
-	if (timespec_cmp(a, b) < 0)
+/* Whether graph_data_time() at ts drops old nodes of every output */
+int
+graph_data_evicts_at(struct graph_data *gdata, const struct timespec *ts)
+{
+	if (!gdata->retain_ns)
 		return 0;
 
-	timespec_sub(&d, a, b);
+	if (!timespec_is_valid(&gdata->begin))
+		return 1;
+
+	return timespec_cmp(ts, &gdata->next_evict) >= 0;
+}
 
-	sec  = d.tv_sec;
-	nsec = d.tv_nsec;
+void
+graph_data_time(struct graph_data *gdata, const struct timespec *ts)
+{
+	int evict = graph_data_evicts_at(gdata, ts);
 
-	nsec = sec * NSEC_PER_SEC + nsec;
+	if (!timespec_is_valid(&gdata->begin)) {
+		gdata->begin = *ts;
+		gdata->next_evict = *ts;
+	}
+	gdata->end = *ts;
 
-	return nsec;
+	if (evict)
+		graph_data_evict(gdata, ts);
 }
 
 static double
@@ -262,6 +234,29 @@ svg_get_x(struct svg_context *ctx, const struct timespec *ts)
 	return svg_get_x_from_nsec(ctx, timespec_sub_to_nsec(ts, &ctx->begin));
 }
 
+/* Whether [begin, end] is near an anomaly, when only those are drawn. */
+static int
+is_in_window(struct svg_context *ctx, uint64_t begin, uint64_t end)
+{
+	unsigned lo = 0;
+	unsigned hi = ctx->window_count;
+
+	if (!ctx->opts->anomalies_only)
+		return 1;
+
+	/* the first window not ending before begin */
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+
+		if (ctx->window[mid].b < begin)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < ctx->window_count && ctx->window[lo].a <= end;
+}
+
 static int
 is_in_range(struct svg_context *ctx, const struct timespec *a,
 	    const struct timespec *b)
@@ -271,16 +266,20 @@ is_in_range(struct svg_context *ctx, const struct timespec *a,
 	begin = timespec_sub_to_nsec(a, &ctx->begin);
 
 	if (!timespec_is_valid(b))
-		return begin <= ctx->time_range.b;
+		return begin <= ctx->time_range.b &&
+		       is_in_window(ctx, begin, UINT64_MAX);
 
 	assert(timespec_cmp(a, b) <= 0);
 
-	if (timespec_cmp(b, &ctx->begin) < 0)
+	/* what is over by the beginning is not squashed onto it */
+	if (timespec_cmp(b, &ctx->begin) < 0 ||
+	    (timespec_cmp(b, &ctx->begin) == 0 && timespec_cmp(a, b) < 0))
 		return 0;
 
 	end = timespec_sub_to_nsec(b, &ctx->begin);
 
-	return !(end < ctx->time_range.a || begin > ctx->time_range.b);
+	return !(end < ctx->time_range.a || begin > ctx->time_range.b) &&
+	       is_in_window(ctx, begin, end);
 }
 
 static int
@@ -288,7 +287,7 @@ is_point_in_range(struct svg_context *ctx, const struct timespec *a)
 {
 	uint64_t pt;
 
-	if (!timespec_is_valid(a))
+	if (!timespec_is_valid(a) || timespec_cmp(a, &ctx->begin) < 0)
 		return 0;
 
 	pt = timespec_sub_to_nsec(a, &ctx->begin);
@@ -297,7 +296,64 @@ is_point_in_range(struct svg_context *ctx, const struct timespec *a)
 }
 
 static int
-line_block_to_svg(struct line_block *lb, struct svg_context *ctx, double y)
+line_block_is_anomaly(const struct line_graph *linegr,
+		      const struct line_block *lb)
+{
+	return linegr->threshold > 0 && timespec_is_valid(&lb->end) &&
+	       timespec_sub_to_nsec(&lb->end, &lb->begin) > linegr->threshold;
+}
+
+static int
+update_is_anomaly(const struct update_graph *update_gr,
+		  const struct update *up)
+{
+	return update_gr->threshold > 0 && timespec_is_valid(&up->vblank) &&
+	       timespec_is_valid(&up->flush) &&
+	       update_latency_total(up) > update_gr->threshold;
+}
+
+/* Counts of anomalies left and right of the time range */
+struct anomaly_edges {
+	unsigned before;
+	unsigned after;
+};
+
+static void
+anomaly_edges_add(struct anomaly_edges *edges, struct svg_context *ctx,
+		  const struct timespec *begin, const struct timespec *end)
+{
+	if (timespec_cmp(end, &ctx->begin) < 0 ||
+	    timespec_sub_to_nsec(end, &ctx->begin) < ctx->time_range.a)
+		edges->before++;
+	else if (timespec_sub_to_nsec(begin, &ctx->begin) > ctx->time_range.b)
+		edges->after++;
+}
+
+static void
+anomaly_edges_to_svg(const struct anomaly_edges *edges,
+		     struct svg_context *ctx, double y)
+{
+	double left = svg_get_x_from_nsec(ctx, ctx->time_range.a);
+	double right = svg_get_x_from_nsec(ctx, ctx->time_range.b);
+
+	if (edges->before)
+		fprintf(ctx->fp,
+			"<path d=\"M %.2f %.2f l 6 -5 v 10 Z\" "
+			"class=\"anomaly_edge\">"
+			"<title>%u earlier anomalies</title></path>\n",
+			left - 8.0, y, edges->before);
+
+	if (edges->after)
+		fprintf(ctx->fp,
+			"<path d=\"M %.2f %.2f l -6 -5 v 10 Z\" "
+			"class=\"anomaly_edge\">"
+			"<title>%u later anomalies</title></path>\n",
+			right + 8.0, y, edges->after);
+}
+
+static int
+line_block_to_svg(struct line_block *lb, struct svg_context *ctx, double y,
+		  int anomaly)
 {
 	double a, b;
 
@@ -306,7 +362,8 @@ line_block_to_svg(struct line_block *lb, struct svg_context *ctx, double y)
 
 	a = svg_get_x(ctx, &lb->begin);
 	b = svg_get_x(ctx, &lb->end);
-	fprintf(ctx->fp, "<path d=\"M %.2f %.2f H %.2f\" />\n", a, y, b);
+	fprintf(ctx->fp, "<path d=\"M %.2f %.2f H %.2f\"%s />\n", a, y, b,
+		anomaly ? " class=\"anomaly\"" : "");
 
 	return 0;
 }
@@ -315,6 +372,8 @@ static int
 line_graph_to_svg(struct line_graph *linegr, struct svg_context *ctx)
 {
 	struct line_block *lb;
+	struct anomaly_edges edges = { 0, 0 };
+	int anomaly;
 
 	fprintf(ctx->fp, "<g class=\"%s\">\n", linegr->style);
 	fprintf(ctx->fp,
@@ -323,9 +382,16 @@ line_graph_to_svg(struct line_graph *linegr, struct svg_context *ctx)
 		"class=\"line_label\">%s</text>\n",
 		linegr->y, linegr->label);
 
-	for (lb = linegr->block; lb; lb = lb->next)
-		if (line_block_to_svg(lb, ctx, linegr->y) < 0)
+	for (lb = linegr->block; lb; lb = lb->next) {
+		anomaly = line_block_is_anomaly(linegr, lb);
+		if (anomaly)
+			anomaly_edges_add(&edges, ctx, &lb->begin, &lb->end);
+
+		if (line_block_to_svg(lb, ctx, linegr->y, anomaly) < 0)
 			return ERROR;
+	}
+
+	anomaly_edges_to_svg(&edges, ctx, linegr->y);
 
 	fprintf(ctx->fp, "</g>\n");
 
@@ -401,6 +467,52 @@ vblank_set_to_svg(struct vblank_set *vblanks, struct svg_context *ctx,
 	return 0;
 }
 
+static int
+missed_frame_to_svg(struct vblank *vbl, struct svg_context *ctx,
+		    double y1, double y2)
+{
+	static const char * const cause_class[] = {
+		[MISS_CAUSE_DELAY] = "miss_delay",
+		[MISS_CAUSE_REPAINT] = "miss_repaint",
+		[MISS_CAUSE_GPU] = "miss_gpu",
+	};
+	struct timespec prev;
+	double a, b;
+
+	timespec_add_nsec(&prev, &vbl->ts, -(int64_t)vbl->interval);
+
+	if (!is_in_range(ctx, &prev, &vbl->ts))
+		return 0;
+
+	a = svg_get_x(ctx, &prev);
+	b = svg_get_x(ctx, &vbl->ts);
+	fprintf(ctx->fp,
+		"<path d=\"M %.2f %.2f H %.2f V %.2f H %.2f Z\" "
+		"class=\"%s\"><title>%u missed, %s</title></path>\n",
+		a, y1, b, y2, a, cause_class[vbl->cause], vbl->missed,
+		miss_cause_to_str(vbl->cause));
+
+	return 0;
+}
+
+static int
+missed_frames_to_svg(struct vblank_set *vblanks, struct svg_context *ctx,
+		     double y1, double y2)
+{
+	struct vblank *vbl;
+
+	fprintf(ctx->fp, "<g class=\"missed_frame\">\n");
+
+	for (vbl = vblanks->vbl; vbl; vbl = vbl->next)
+		if (vbl->missed > 0 &&
+		    missed_frame_to_svg(vbl, ctx, y1, y2) < 0)
+			return ERROR;
+
+	fprintf(ctx->fp, "</g>\n");
+
+	return 0;
+}
+
 static int
 activity_to_svg(struct activity *act, struct svg_context *ctx,
 		double y1, double y2)
@@ -438,7 +550,7 @@ activity_set_to_svg(struct activity_set *acts, struct svg_context *ctx,
 
 static int
 update_to_svg(struct update *up, struct svg_context *ctx, double y,
-	      struct timespec **last_end)
+	      struct timespec **last_end, int anomaly)
 {
 	double a, b;
 	struct timespec *begin;
@@ -482,7 +594,8 @@ update_to_svg(struct update *up, struct svg_context *ctx, double y,
 
 	a = svg_get_x(ctx, begin);
 	b = svg_get_x(ctx, &up->vblank);
-	fprintf(ctx->fp, "<path d=\"M %.2f %.2f H %.2f\" />\n", a, y, b);
+	fprintf(ctx->fp, "<path d=\"M %.2f %.2f H %.2f\"%s />\n", a, y, b,
+		anomaly ? " class=\"anomaly\"" : "");
 
 	return 0;
 }
@@ -492,6 +605,8 @@ update_graph_to_svg(struct update_graph *update_gr, struct svg_context *ctx)
 {
 	struct update *upd;
 	struct timespec *last_end = NULL;
+	struct anomaly_edges edges = { 0, 0 };
+	int anomaly;
 
 	fprintf(ctx->fp, "<g class=\"%s\">\n", update_gr->style);
 	fprintf(ctx->fp,
@@ -500,100 +615,422 @@ update_graph_to_svg(struct update_graph *update_gr, struct svg_context *ctx)
 		"class=\"line_label\">%s</text>\n",
 		update_gr->y, update_gr->label);
 
-	for (upd = update_gr->updates; upd; upd = upd->next)
-		if (update_to_svg(upd, ctx, update_gr->y, &last_end) < 0)
+	for (upd = update_gr->updates; upd; upd = upd->next) {
+		anomaly = update_is_anomaly(update_gr, upd);
+		if (anomaly)
+			anomaly_edges_add(&edges, ctx,
+					  timespec_is_valid(&upd->damage) ?
+					  &upd->damage : &upd->flush,
+					  &upd->vblank);
+
+		if (update_to_svg(upd, ctx, update_gr->y, &last_end,
+				  anomaly) < 0)
 			return ERROR;
+	}
+
+	anomaly_edges_to_svg(&edges, ctx, update_gr->y);
 
 	fprintf(ctx->fp, "</g>\n");
 
 	return 0;
 }
 
+/* Whether the i-th column of step nanoseconds is near an anomaly */
 static int
-output_graph_to_svg(struct output_graph *og, struct svg_context *ctx)
+is_column_in_window(struct svg_context *ctx, uint64_t step, unsigned i)
 {
-	struct update_graph *upg;
+	uint64_t a = ctx->time_range.a + step * i;
 
-	fprintf(ctx->fp,
-		"<text x=\"10\" y=\"0\" "
-		"transform=\"translate(0,%.2f)\" "
-		"class=\"output_label\">Output %s</text>\n",
-		og->title_y, og->info->name);
+	return is_in_window(ctx, a, a + step);
+}
 
-	if (activity_set_to_svg(&og->not_looping, ctx, og->y1, og->y2) < 0)
-		return ERROR;
+struct fps_column {
+	double min;
+	double max;
+	double sum;
+	unsigned count;
+};
 
-	if (vblank_set_to_svg(&og->vblanks, ctx, og->y1, og->y2) < 0)
-		return ERROR;
+static void
+fps_column_path(struct svg_context *ctx, double x, double base,
+		double scale, const struct fps_column *col)
+{
+	fprintf(ctx->fp, " M %.2f %.2f V %.2f", x,
+		base - col->min * scale, base - col->max * scale);
+}
 
-	if (line_graph_to_svg(&og->delay_line, ctx) < 0)
-		return ERROR;
+/*
+ * The presented frame rate from consecutive vblanks, as the min-max
+ * envelope and the mean of each column of a few pixels.
+ */
+static int
+fps_lane_to_svg(struct output_graph *og, struct svg_context *ctx)
+{
+	const double column = 2.0;
+	const double height = 14.0;
+	double base = og->fps_y + height * 0.5;
+	double x0 = svg_get_x_from_nsec(ctx, ctx->time_range.a);
+	struct fps_column *cols;
+	struct vblank *vbl;
+	double top = 0.0;
+	double scale;
+	uint64_t step;
+	unsigned n, i, last;
+	int pen_down;
+
+	n = ctx->nsec_to_x * (ctx->time_range.b - ctx->time_range.a) / column;
+	step = n ? (ctx->time_range.b - ctx->time_range.a) / n : 0;
+	if (step == 0)
+		return 0;
 
-	if (line_graph_to_svg(&og->submit_line, ctx) < 0)
+	cols = calloc(n, sizeof *cols);
+	if (!cols)
 		return ERROR;
 
-	if (line_graph_to_svg(&og->gpu_line, ctx) < 0)
-		return ERROR;
+	/* Each rate holds for the whole interval it was measured over. */
+	for (vbl = og->vblanks.vbl; vbl; vbl = vbl->next) {
+		uint64_t a, b;
+		double fps;
 
-	if (line_graph_to_svg(&og->renderer_gpu_line, ctx) < 0)
-		return ERROR;
+		/* intervals over by the beginning are not drawn */
+		if (vbl->interval == 0 ||
+		    timespec_cmp(&vbl->ts, &ctx->begin) <= 0)
+			continue;
 
-	if (transition_set_to_svg(&og->begins, ctx,
-				  og->delay_line.y, og->submit_line.y) < 0)
-		return ERROR;
+		b = timespec_sub_to_nsec(&vbl->ts, &ctx->begin);
+		a = b > vbl->interval ? b - vbl->interval : 0;
+		if (b < ctx->time_range.a || a > ctx->time_range.b)
+			continue;
 
-	if (transition_set_to_svg(&og->posts, ctx,
-				  og->submit_line.y, og->gpu_line.y) < 0)
-		return ERROR;
+		a = a > ctx->time_range.a ? a - ctx->time_range.a : 0;
+		b = b - ctx->time_range.a;
+		last = b / step < n ? b / step : n - 1;
+
+		fps = 1e9 / vbl->interval;
+		for (i = a / step; i <= last; i++) {
+			if (cols[i].count == 0 || fps < cols[i].min)
+				cols[i].min = fps;
+			if (cols[i].count == 0 || fps > cols[i].max)
+				cols[i].max = fps;
+			cols[i].sum += fps;
+			cols[i].count++;
+		}
 
-	for (upg = og->updates; upg; upg = upg->next)
-		if (update_graph_to_svg(upg, ctx) < 0)
-			return ERROR;
+		if (fps > top)
+			top = fps;
+	}
 
-	return 0;
-}
+	/* with anomalies_only, columns away from them are left out */
+	for (i = 0; i < n; i++)
+		if (!is_column_in_window(ctx, step, i))
+			cols[i].count = 0;
 
-static uint64_t
-round_up(uint64_t nsec, uint64_t f)
-{
-	return (nsec + f - 1) / f * f;
+	/* scale to the next multiple of ten frames per second */
+	top = ceil(top / 10.0) * 10.0;
+	scale = top > 0.0 ? height / top : 0.0;
+
+	fprintf(ctx->fp, "<g class=\"fps\">\n");
+	fprintf(ctx->fp,
+		"<text x=\"10\" y=\"0.5em\" "
+		"transform=\"translate(0,%.2f)\" "
+		"class=\"line_label\">frame rate", og->fps_y);
+	if (top > 0.0)
+		fprintf(ctx->fp, ", 0 - %.0f fps", top);
+	fprintf(ctx->fp, "</text>\n");
+
+	fprintf(ctx->fp, "<path class=\"fps_envelope\" d=\"");
+	for (i = 0; i < n; i++)
+		if (cols[i].count)
+			fps_column_path(ctx, x0 + (i + 0.5) * column, base,
+					scale, &cols[i]);
+	fprintf(ctx->fp, "\" />\n");
+
+	fprintf(ctx->fp, "<path class=\"fps_mean\" d=\"");
+	for (i = 0, pen_down = 0; i < n; i++) {
+		if (cols[i].count == 0) {
+			pen_down = 0;
+			continue;
+		}
+
+		fprintf(ctx->fp, " %c %.2f %.2f", pen_down ? 'L' : 'M',
+			x0 + (i + 0.5) * column,
+			base - cols[i].sum / cols[i].count * scale);
+		pen_down = 1;
+	}
+	fprintf(ctx->fp, "\" />\n</g>\n");
+
+	free(cols);
+
+	return 0;
 }
 
-static uint64_t
-compute_big_skip_ns(struct svg_context *ctx)
+/* The share of each few pixels' worth of time the GPU was busy */
+static int
+gpu_utilization_to_svg(struct output_graph *og, struct svg_context *ctx)
 {
-	static const uint64_t mtick_levels[] = { 1, 5 };
-	uint64_t scale;
-	uint64_t skip_ms;
+	const double column = 2.0;
+	const double height = 12.0;
+	double base = og->gpu_util_y + height * 0.5;
+	double x;
+	uint64_t *busy;
+	uint64_t step;
+	unsigned n;
 	unsigned i;
+	int pen_down = 0;
+	int started = 0;
 
-	skip_ms = round(50.0 / ctx->nsec_to_x * 1e-6);
+	n = ctx->nsec_to_x * (ctx->time_range.b - ctx->time_range.a) / column;
+	if (n == 0)
+		return 0;
 
-	for (scale = 1; scale < 100001; scale *= 10) {
-		for (i = 0; i < ARRAY_LENGTH(mtick_levels); i++) {
-			uint64_t skip = mtick_levels[i] * scale;
+	step = (ctx->time_range.b - ctx->time_range.a) / n;
+	if (step == 0)
+		return 0;
 
-			if (skip_ms < skip)
-				return skip * 1000000;
+	busy = calloc(n, sizeof *busy);
+	if (!busy)
+		return ERROR;
+
+	line_graph_busy_time(&og->renderer_gpu_line, &ctx->begin,
+			     ctx->time_range.a, step, n, busy);
+
+	fprintf(ctx->fp, "<g class=\"gpu_util\">\n");
+	fprintf(ctx->fp,
+		"<text x=\"10\" y=\"0.5em\" "
+		"transform=\"translate(0,%.2f)\" "
+		"class=\"line_label\">gpu utilization</text>\n",
+		og->gpu_util_y);
+
+	x = svg_get_x_from_nsec(ctx, ctx->time_range.a);
+	fprintf(ctx->fp, "<path d=\"");
+	for (i = 0; i < n; i++) {
+		double u = busy[i] < step ? (double)busy[i] / step : 1.0;
+
+		/* with anomalies_only, one shape per run of columns near them */
+		if (!is_column_in_window(ctx, step, i)) {
+			if (pen_down)
+				fprintf(ctx->fp, " V %.2f Z", base);
+			pen_down = 0;
+			continue;
 		}
+
+		if (!pen_down)
+			fprintf(ctx->fp, "%sM %.2f %.2f", started ? " " : "",
+				x + i * column, base);
+		pen_down = 1;
+		started = 1;
+
+		fprintf(ctx->fp, " V %.2f H %.2f", base - u * height,
+			x + (i + 1) * column);
 	}
+	if (pen_down)
+		fprintf(ctx->fp, " V %.2f Z", base);
+	fprintf(ctx->fp, "\" />\n</g>\n");
 
-	return NSEC_PER_SEC;
+	free(busy);
+
+	return 0;
 }
 
-static void
-time_scale_to_svg(struct svg_context *ctx, double y)
+static int
+svg_context_add_window(struct svg_context *ctx, const struct timespec *begin,
+		       const struct timespec *end)
 {
-	uint64_t nsec;
-	uint64_t big_skip;
-	uint64_t lil_skip;
-	double left, right;
-	const double big_tick_size = 15.0;
-	const double lil_tick_size = 10.0;
-	const double tick_label_up = 5.0;
+	struct time_window *arr;
+	uint64_t a, b;
 
-	big_skip = compute_big_skip_ns(ctx);
-	lil_skip = big_skip / 5;
+	if (timespec_is_valid(end) && timespec_cmp(end, &ctx->begin) < 0)
+		return 0;
+
+	a = timespec_sub_to_nsec(begin, &ctx->begin);
+	b = timespec_sub_to_nsec(end, &ctx->begin);
+
+	if (ctx->window_count == ctx->window_alloc) {
+		unsigned n = ctx->window_alloc ? ctx->window_alloc * 2 : 64;
+
+		arr = realloc(ctx->window, n * sizeof *arr);
+		if (!arr)
+			return ERROR;
+
+		ctx->window = arr;
+		ctx->window_alloc = n;
+	}
+
+	arr = &ctx->window[ctx->window_count++];
+	arr->a = a > ctx->opts->context_ns ? a - ctx->opts->context_ns : 0;
+	arr->b = b + ctx->opts->context_ns;
+
+	return 0;
+}
+
+static int
+compare_time_windows(const void *a, const void *b)
+{
+	const struct time_window *wa = a;
+	const struct time_window *wb = b;
+
+	if (wa->a < wb->a)
+		return -1;
+
+	return wa->a > wb->a;
+}
+
+/*
+ * Collects the anomalies of an output with their context into sorted,
+ * non-overlapping windows, outside of which nothing is drawn.
+ */
+static int
+svg_context_set_windows(struct svg_context *ctx, struct output_graph *og)
+{
+	struct line_graph *lanes[OUTPUT_LANES];
+	struct line_block *lb;
+	struct update_graph *upg;
+	struct update *up;
+	unsigned i, n;
+
+	ctx->window_count = 0;
+	output_graph_lanes(og, lanes);
+
+	for (i = 0; i < ARRAY_LENGTH(lanes); i++) {
+		for (lb = lanes[i]->block; lb; lb = lb->next) {
+			if (!line_block_is_anomaly(lanes[i], lb))
+				continue;
+
+			if (svg_context_add_window(ctx, &lb->begin,
+						   &lb->end) < 0)
+				return ERROR;
+		}
+	}
+
+	for (upg = og->updates; upg; upg = upg->next) {
+		for (up = upg->updates; up; up = up->next) {
+			if (!update_is_anomaly(upg, up))
+				continue;
+
+			if (svg_context_add_window(ctx,
+					timespec_is_valid(&up->damage) ?
+					&up->damage : &up->flush,
+					&up->vblank) < 0)
+				return ERROR;
+		}
+	}
+
+	if (ctx->window_count == 0)
+		return 0;
+
+	qsort(ctx->window, ctx->window_count, sizeof ctx->window[0],
+	      compare_time_windows);
+
+	for (i = 1, n = 0; i < ctx->window_count; i++) {
+		if (ctx->window[i].a <= ctx->window[n].b) {
+			if (ctx->window[i].b > ctx->window[n].b)
+				ctx->window[n].b = ctx->window[i].b;
+		} else {
+			ctx->window[++n] = ctx->window[i];
+		}
+	}
+	ctx->window_count = n + 1;
+
+	return 0;
+}
+
+static int
+output_graph_to_svg(struct output_graph *og, struct svg_context *ctx)
+{
+	struct update_graph *upg;
+
+	if (ctx->opts->anomalies_only && svg_context_set_windows(ctx, og) < 0)
+		return ERROR;
+
+	fprintf(ctx->fp,
+		"<text x=\"10\" y=\"0\" "
+		"transform=\"translate(0,%.2f)\" "
+		"class=\"output_label\">Output %s%s</text>\n",
+		og->title_y, og->info->name, ctx->caption ? ctx->caption : "");
+
+	if (activity_set_to_svg(&og->not_looping, ctx, og->y1, og->y2) < 0)
+		return ERROR;
+
+	if (missed_frames_to_svg(&og->vblanks, ctx, og->y1, og->y2) < 0)
+		return ERROR;
+
+	if (vblank_set_to_svg(&og->vblanks, ctx, og->y1, og->y2) < 0)
+		return ERROR;
+
+	if (line_graph_to_svg(&og->delay_line, ctx) < 0)
+		return ERROR;
+
+	if (line_graph_to_svg(&og->submit_line, ctx) < 0)
+		return ERROR;
+
+	if (line_graph_to_svg(&og->gpu_line, ctx) < 0)
+		return ERROR;
+
+	if (line_graph_to_svg(&og->renderer_gpu_line, ctx) < 0)
+		return ERROR;
+
+	if (og->gpu_util_y > 0.0 && gpu_utilization_to_svg(og, ctx) < 0)
+		return ERROR;
+
+	if (fps_lane_to_svg(og, ctx) < 0)
+		return ERROR;
+
+	if (transition_set_to_svg(&og->begins, ctx,
+				  og->delay_line.y, og->submit_line.y) < 0)
+		return ERROR;
+
+	if (transition_set_to_svg(&og->posts, ctx,
+				  og->submit_line.y, og->gpu_line.y) < 0)
+		return ERROR;
+
+	for (upg = og->updates; upg; upg = upg->next)
+		if (update_graph_to_svg(upg, ctx) < 0)
+			return ERROR;
+
+	return 0;
+}
+
+static uint64_t
+round_up(uint64_t nsec, uint64_t f)
+{
+	return (nsec + f - 1) / f * f;
+}
+
+static uint64_t
+compute_big_skip_ns(struct svg_context *ctx)
+{
+	static const uint64_t mtick_levels[] = { 1, 5 };
+	uint64_t scale;
+	uint64_t skip_ms;
+	unsigned i;
+
+	skip_ms = round(50.0 / ctx->nsec_to_x * 1e-6);
+
+	for (scale = 1; scale < 100001; scale *= 10) {
+		for (i = 0; i < ARRAY_LENGTH(mtick_levels); i++) {
+			uint64_t skip = mtick_levels[i] * scale;
+
+			if (skip_ms < skip)
+				return skip * 1000000;
+		}
+	}
+
+	return NSEC_PER_SEC;
+}
+
+static void
+time_scale_to_svg(struct svg_context *ctx, double y)
+{
+	uint64_t nsec;
+	uint64_t big_skip;
+	uint64_t lil_skip;
+	double left, right;
+	const double big_tick_size = 15.0;
+	const double lil_tick_size = 10.0;
+	const double tick_label_up = 5.0;
+
+	big_skip = compute_big_skip_ns(ctx);
+	lil_skip = big_skip / 5;
 
 	fprintf(ctx->fp, "<path d=\"");
 	for (nsec = round_up(ctx->time_range.a, big_skip);
@@ -703,34 +1140,57 @@ legend_to_svg(struct svg_context *ctx, double y)
 	return 0;
 }
 
+/*
+ * Sets up drawing the span nanoseconds from begin on, or the last
+ * retain_ns of them by default when not 0.
+ */
 static void
-svg_context_init(struct svg_context *ctx, struct graph_data *gdata,
-		 int from_ms, int to_ms, double width, double height)
+svg_context_init_span(struct svg_context *ctx, const struct timespec *begin,
+		      uint64_t span, uint64_t retain_ns,
+		      const struct svg_options *opts, double width,
+		      double height)
 {
 	const double margin = 5.0;
 	const double left_pad = 250.0;
 	const double right_pad = 20.0;
 
-	if (from_ms < 0)
-		ctx->time_range.a = 0;
+	/* by default, draw what is retained */
+	if (opts->from_ms >= 0)
+		ctx->time_range.a = (uint64_t)opts->from_ms * 1000000;
+	else if (retain_ns && span > retain_ns)
+		ctx->time_range.a = span - retain_ns;
 	else
-		ctx->time_range.a = (uint64_t)from_ms * 1000000;
+		ctx->time_range.a = 0;
 
-	if (to_ms < 0)
-		ctx->time_range.b = timespec_sub_to_nsec(&gdata->end,
-							 &gdata->begin);
+	if (opts->to_ms < 0)
+		ctx->time_range.b = span;
 	else
-		ctx->time_range.b = (uint64_t)to_ms * 1000000;
+		ctx->time_range.b = (uint64_t)opts->to_ms * 1000000;
+
+	ctx->opts = opts;
+	ctx->caption = NULL;
+	ctx->window = NULL;
+	ctx->window_count = 0;
+	ctx->window_alloc = 0;
 
 	ctx->width = width;
 	ctx->height = height;
-	ctx->begin = gdata->begin;
+	ctx->begin = *begin;
 	ctx->offset_x = margin + left_pad;
 
 	ctx->nsec_to_x = (ctx->width - 2 * margin - left_pad - right_pad) /
 			 (ctx->time_range.b - ctx->time_range.a);
 }
 
+static void
+svg_context_init(struct svg_context *ctx, struct graph_data *gdata,
+		 const struct svg_options *opts, double width, double height)
+{
+	svg_context_init_span(ctx, &gdata->begin,
+			      timespec_sub_to_nsec(&gdata->end, &gdata->begin),
+			      gdata->retain_ns, opts, width, height);
+}
+
 static double
 update_graph_set_position(struct update_graph *update_gr, double y)
 {
@@ -740,7 +1200,7 @@ update_graph_set_position(struct update_graph *update_gr, double y)
 }
 
 static void
-graph_data_init_draw(struct graph_data *gdata, double *width, double *height)
+graph_data_init_draw(struct graph_data *gdata)
 {
 	struct output_graph *og;
 	struct update_graph *upg;
@@ -767,7 +1227,17 @@ graph_data_init_draw(struct graph_data *gdata, double *width, double *height)
 		y += line_step;
 
 		og->renderer_gpu_line.y = y;
-		y += line_step * 1.5;
+		y += line_step;
+
+		if (og->renderer_gpu_line.block) {
+			og->gpu_util_y = y;
+			y += line_step;
+		}
+
+		og->fps_y = y;
+		y += line_step;
+
+		y += line_step * 0.5;
 
 		for (upg = og->updates; upg; upg = upg->next)
 			y = update_graph_set_position(upg, y);
@@ -780,42 +1250,618 @@ graph_data_init_draw(struct graph_data *gdata, double *width, double *height)
 	gdata->legend_y = y;
 	y += 40.0;
 
-	*width = 1300;
-	*height = y + line_step;
+	gdata->width = 1300;
+	gdata->height = y + line_step;
+}
+
+/* Parses LANE:MS or LANE:pNN, where LANE is a lane style or "update". */
+struct threshold *
+threshold_parse(const char *spec)
+{
+	static const char * const lanes[] = {
+		"delay_line",
+		"submit_line",
+		"gpu_line",
+		"renderer_gpu_line",
+		"update",
+	};
+	struct threshold *th;
+	const char *value;
+	char *end;
+	double v;
+	unsigned i;
+
+	value = strchr(spec, ':');
+	if (!value)
+		return NULL;
+	value++;
+
+	for (i = 0; i < ARRAY_LENGTH(lanes); i++)
+		if (strlen(lanes[i]) == (size_t)(value - 1 - spec) &&
+		    strncmp(lanes[i], spec, value - 1 - spec) == 0)
+			break;
+
+	if (i == ARRAY_LENGTH(lanes))
+		return NULL;
+
+	if (value[0] == 'p') {
+		v = strtod(value + 1, &end);
+		if (*end != '\0' || end == value + 1 || v <= 0.0 || v >= 100.0)
+			return NULL;
+	} else {
+		v = strtod(value, &end);
+		if (*end != '\0' || end == value || v < 0.0)
+			return NULL;
+	}
+
+	th = calloc(1, sizeof *th);
+	if (!th)
+		return ERROR_NULL;
+
+	th->lane = strdup(lanes[i]);
+	if (!th->lane) {
+		free(th);
+		return ERROR_NULL;
+	}
+
+	if (value[0] == 'p')
+		th->quantile = v / 100.0;
+	else
+		th->limit = v * 1e6;
+
+	return th;
+}
+
+void
+threshold_list_destroy(struct threshold *list)
+{
+	struct threshold *th, *tmp;
+
+	for (th = list; th; th = tmp) {
+		tmp = th->next;
+		free(th->lane);
+		free(th);
+	}
+}
+
+static uint64_t
+threshold_resolve(struct threshold *list, const char *lane,
+		  const struct histogram *h)
+{
+	struct threshold *th;
+	uint64_t limit = 0;
+
+	/* the last one given for the lane wins */
+	for (th = list; th; th = th->next) {
+		if (strcmp(th->lane, lane) != 0)
+			continue;
+
+		if (th->quantile > 0.0)
+			limit = histogram_quantile(h, th->quantile);
+		else
+			limit = th->limit;
+	}
+
+	return limit;
 }
 
+static void
+graph_data_set_thresholds(struct graph_data *gdata, struct threshold *list)
+{
+	struct line_graph *lanes[OUTPUT_LANES];
+	struct output_graph *og;
+	struct update_graph *upg;
+	unsigned i;
+
+	for (og = gdata->output; og; og = og->next) {
+		output_graph_lanes(og, lanes);
+
+		for (i = 0; i < ARRAY_LENGTH(lanes); i++)
+			lanes[i]->threshold =
+				threshold_resolve(list, lanes[i]->style,
+						  &lanes[i]->durations);
+
+		for (upg = og->updates; upg; upg = upg->next)
+			upg->threshold = threshold_resolve(list, "update",
+							   &upg->latency.total);
+	}
+}
+
+/*
+ * Resolves the thresholds and lays out the lanes. This is all of drawing
+ * that changes the graph data, so graph_data_write_svg() can run
+ * alongside the other writers.
+ */
+void
+graph_data_layout_svg(struct graph_data *gdata, const struct svg_options *opts)
+{
+	graph_data_set_thresholds(gdata, opts->thresholds);
+	graph_data_init_draw(gdata);
+}
+
+/* Draws the graph as laid out by graph_data_layout_svg() into fp. */
 int
-graph_data_to_svg(struct graph_data *gdata, int from_ms, int to_ms,
-		  const char *filename)
+graph_data_write_svg_fp(struct graph_data *gdata,
+			const struct svg_options *opts, FILE *fp)
 {
 	struct output_graph *og;
 	struct svg_context ctx;
-	double w, h;
+	int ret = -1;
 
-	graph_data_init_draw(gdata, &w, &h);
-	svg_context_init(&ctx, gdata, from_ms, to_ms, w, h);
-
-	ctx.fp = fopen(filename, "w");
-	if (!ctx.fp)
-		return ERROR;
+	svg_context_init(&ctx, gdata, opts, gdata->width, gdata->height);
+	ctx.fp = fp;
 
 	if (headers_to_svg(&ctx) < 0)
-		return ERROR;
+		goto out;
 
 	time_scale_to_svg(&ctx, gdata->time_axis_y);
 
 	for (og = gdata->output; og; og = og->next)
 		if (output_graph_to_svg(og, &ctx) < 0)
-			return ERROR;
+			goto out;
 
 	if (legend_to_svg(&ctx, gdata->legend_y) < 0)
+		goto out;
+
+	footers_to_svg(&ctx);
+	ret = 0;
+
+out:
+	free(ctx.window);
+
+	if (ret < 0)
+		return ERROR;
+
+	return 0;
+}
+
+int
+graph_data_write_svg(struct graph_data *gdata, const struct svg_options *opts,
+		     const char *filename)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(filename, "w");
+	if (!fp)
+		return ERROR;
+
+	ret = graph_data_write_svg_fp(gdata, opts, fp);
+
+	if (fclose(fp) != 0 || ret < 0)
+		return ERROR;
+
+	return 0;
+}
+
+int
+graph_data_to_svg(struct graph_data *gdata, const struct svg_options *opts,
+		  const char *filename)
+{
+	graph_data_layout_svg(gdata, opts);
+
+	return graph_data_write_svg(gdata, opts, filename);
+}
+
+/*
+ * Side-by-side drawing of the outputs common to two recordings, each
+ * recording timed from one of its vblanks so that both line up.
+ */
+
+struct diff_output {
+	struct output_graph *og[2];
+	char *buf[2];		/* the drawing of each side */
+	size_t len[2];
+	double y[2];		/* where each side is moved to */
+	double delta_y;		/* the first delta lane */
+	unsigned lanes;		/* delta lanes drawn */
+};
+
+struct svg_diff {
+	const struct svg_options *opts;
+	struct graph_data *gdata[2];
+	struct timespec align[2];
+	uint64_t span;
+	struct diff_output *pairs;
+	unsigned count;
+};
+
+struct diff_side_job {
+	struct svg_diff *diff;
+	unsigned side;
+	pthread_t thread;
+	int ret;
+};
+
+static const char * const diff_side_name[2] = { "before", "after" };
+
+/*
+ * Finds the vblank to align on: the index-th one, or with align <
+ * 0 the first one after a missed frame.
+ */
+static int
+output_graph_find_align(struct output_graph *og, int align,
+			struct timespec *ts)
+{
+	struct vblank *vbl;
+	unsigned n = 0;
+	int found = 0;
+
+	/* the list is newest first */
+	for (vbl = og->vblanks.vbl; vbl; vbl = vbl->next) {
+		if (align < 0 && vbl->missed > 0) {
+			*ts = vbl->ts;
+			found = 1;
+		}
+		n++;
+	}
+
+	if (align < 0)
+		return found ? 0 : -1;
+
+	if ((unsigned)align >= n)
+		return -1;
+
+	for (vbl = og->vblanks.vbl; n-- > (unsigned)align + 1; vbl = vbl->next)
+		;
+
+	*ts = vbl->ts;
+
+	return 0;
+}
+
+static int
+svg_diff_side_draw(struct svg_diff *diff, unsigned side)
+{
+	static const char * const caption[2] = { " (before)", " (after)" };
+	struct graph_data *gdata = diff->gdata[side];
+	struct diff_output *pair;
+	struct svg_context ctx;
+	unsigned i;
+	int ret = 0;
+
+	graph_data_layout_svg(gdata, diff->opts);
+
+	svg_context_init_span(&ctx, &diff->align[side], diff->span, 0,
+			      diff->opts, gdata->width, gdata->height);
+	ctx.caption = caption[side];
+
+	for (i = 0; i < diff->count && ret == 0; i++) {
+		pair = &diff->pairs[i];
+
+		ctx.fp = open_memstream(&pair->buf[side], &pair->len[side]);
+		if (!ctx.fp) {
+			ret = -1;
+			break;
+		}
+
+		ret = output_graph_to_svg(pair->og[side], &ctx);
+
+		if (fclose(ctx.fp) != 0)
+			ret = -1;
+	}
+
+	free(ctx.window);
+
+	if (ret < 0)
 		return ERROR;
 
+	return 0;
+}
+
+static void *
+svg_diff_side_run(void *data)
+{
+	struct diff_side_job *job = data;
+
+	job->ret = svg_diff_side_draw(job->diff, job->side);
+
+	return NULL;
+}
+
+/* The blocks of a lane from the aligned vblank on, oldest first. */
+static struct line_block **
+line_graph_blocks_from(struct line_graph *lg, const struct timespec *from,
+		       unsigned *count)
+{
+	struct line_block **blocks;
+	struct line_block *lb;
+	unsigned n = 0;
+
+	for (lb = lg->block; lb; lb = lb->next)
+		if (timespec_cmp(&lb->begin, from) >= 0 &&
+		    timespec_is_valid(&lb->end))
+			n++;
+
+	*count = n;
+	blocks = calloc(n ? n : 1, sizeof *blocks);
+	if (!blocks)
+		return ERROR_NULL;
+
+	for (lb = lg->block; lb; lb = lb->next)
+		if (timespec_cmp(&lb->begin, from) >= 0 &&
+		    timespec_is_valid(&lb->end))
+			blocks[--n] = lb;
+
+	return blocks;
+}
+
+/*
+ * Pairs the k-th frame of a lane on both sides, and marks where the
+ * after side took longer or shorter, more opaque the bigger the change.
+ */
+static int
+line_graph_delta_to_svg(struct svg_diff *diff, struct line_graph *lg[2],
+			struct svg_context *ctx, double y)
+{
+	struct line_block **blocks[2];
+	unsigned n[2];
+	unsigned i, k;
+	uint64_t was, now;
+	double delta, rel, a, b;
+
+	for (i = 0; i < 2; i++) {
+		blocks[i] = line_graph_blocks_from(lg[i], &diff->align[i],
+						   &n[i]);
+		if (!blocks[i]) {
+			if (i > 0)
+				free(blocks[0]);
+			return ERROR;
+		}
+	}
+
+	fprintf(ctx->fp, "<g class=\"delta\">\n");
+	fprintf(ctx->fp,
+		"<text x=\"10\" y=\"0.5em\" "
+		"transform=\"translate(0,%.2f)\" "
+		"class=\"line_label\">%s, change</text>\n",
+		y, lg[1]->label);
+
+	for (k = 0; k < n[0] && k < n[1]; k++) {
+		struct line_block *lb = blocks[1][k];
+
+		if (!is_in_range(ctx, &lb->begin, &lb->end))
+			continue;
+
+		was = timespec_sub_to_nsec(&blocks[0][k]->end,
+					   &blocks[0][k]->begin);
+		now = timespec_sub_to_nsec(&lb->end, &lb->begin);
+		if (was == now)
+			continue;
+
+		delta = (double)now - (double)was;
+		/* faint but visible for the smallest changes */
+		rel = was ? fabs(delta) / was : 1.0;
+		rel = 0.1 + 0.9 * (rel > 1.0 ? 1.0 : rel);
+
+		a = svg_get_x(ctx, &lb->begin);
+		b = svg_get_x(ctx, &lb->end);
+		if (b - a < 1.0)
+			b = a + 1.0;
+
+		fprintf(ctx->fp,
+			"<path d=\"M %.2f %.2f H %.2f V %.2f H %.2f Z\" "
+			"class=\"%s\" fill-opacity=\"%.2f\">"
+			"<title>%+.3f ms</title></path>\n",
+			a, y - 6.0, b, y + 6.0, a,
+			delta > 0 ? "delta_worse" : "delta_better", rel,
+			delta * 1e-6);
+	}
+
+	fprintf(ctx->fp, "</g>\n");
+
+	free(blocks[0]);
+	free(blocks[1]);
+
+	return 0;
+}
+
+/* Places both sides of every output and its delta lanes one below another. */
+static double
+svg_diff_layout(struct svg_diff *diff)
+{
+	struct line_graph *lanes[2][OUTPUT_LANES];
+	const double line_step = 20.0;
+	const double output_margin = 30.0;
+	double y = 50.5 + 20.0;
+	unsigned i, side, l;
+
+	for (i = 0; i < diff->count; i++) {
+		struct diff_output *pair = &diff->pairs[i];
+
+		for (side = 0; side < 2; side++) {
+			struct output_graph *og = pair->og[side];
+
+			pair->y[side] = y - og->y1;
+			y += og->y2 - og->y1 + 10.0;
+			output_graph_lanes(og, lanes[side]);
+		}
+
+		pair->delta_y = y + line_step * 0.5;
+		pair->lanes = 0;
+		for (l = 0; l < OUTPUT_LANES; l++)
+			if (lanes[0][l]->block || lanes[1][l]->block)
+				pair->lanes++;
+
+		y += line_step * pair->lanes + output_margin;
+	}
+
+	return y;
+}
+
+static int
+svg_diff_write(struct svg_diff *diff, FILE *fp)
+{
+	struct line_graph *lanes[2][OUTPUT_LANES];
+	struct line_graph *lg[2];
+	struct svg_context ctx;
+	double width = diff->gdata[1]->width;
+	double legend_y, y;
+	unsigned i, side, l;
+	int ret = -1;
+
+	legend_y = svg_diff_layout(diff);
+
+	svg_context_init_span(&ctx, &diff->align[1], diff->span, 0,
+			      diff->opts, width, legend_y + 40.0 + 20.0);
+	ctx.fp = fp;
+
+	if (headers_to_svg(&ctx) < 0)
+		goto out;
+
+	time_scale_to_svg(&ctx, 50.5);
+
+	for (i = 0; i < diff->count; i++) {
+		struct diff_output *pair = &diff->pairs[i];
+
+		for (side = 0; side < 2; side++) {
+			fprintf(fp, "<g class=\"%s\" "
+				"transform=\"translate(0,%.2f)\">\n",
+				diff_side_name[side], pair->y[side]);
+			if (fwrite(pair->buf[side], 1, pair->len[side], fp) !=
+			    pair->len[side])
+				goto out;
+			fprintf(fp, "</g>\n");
+
+			output_graph_lanes(pair->og[side], lanes[side]);
+		}
+
+		/* the delta lanes follow the after side's windows */
+		if (diff->opts->anomalies_only &&
+		    svg_context_set_windows(&ctx, pair->og[1]) < 0)
+			goto out;
+
+		y = pair->delta_y;
+		for (l = 0; l < OUTPUT_LANES; l++) {
+			lg[0] = lanes[0][l];
+			lg[1] = lanes[1][l];
+			if (!lg[0]->block && !lg[1]->block)
+				continue;
+
+			if (line_graph_delta_to_svg(diff, lg, &ctx, y) < 0)
+				goto out;
+			y += 20.0;
+		}
+	}
+
+	if (legend_to_svg(&ctx, legend_y) < 0)
+		goto out;
+
 	footers_to_svg(&ctx);
+	ret = 0;
+
+out:
+	free(ctx.window);
 
-	if (fclose(ctx.fp) != 0)
+	if (ret < 0)
 		return ERROR;
 
 	return 0;
 }
 
+/*
+ * Draws the outputs found in both recordings, before above after, each
+ * side timed from its align-th vblank, or with align < 0 from its first
+ * missed frame, on the first output in common or the one named. Each
+ * side is drawn on its own thread.
+ */
+int
+graph_data_diff_to_svg(struct graph_data *before, struct graph_data *after,
+		       const struct svg_options *opts, int align,
+		       const char *output, const char *filename)
+{
+	struct svg_diff diff;
+	struct diff_side_job job;
+	struct output_graph *og, *other;
+	FILE *fp;
+	uint64_t span;
+	unsigned i, side;
+	int ret = -1;
+
+	memset(&diff, 0, sizeof diff);
+	diff.opts = opts;
+	diff.gdata[0] = before;
+	diff.gdata[1] = after;
+
+	for (og = before->output; og; og = og->next)
+		diff.count++;
+
+	diff.pairs = calloc(diff.count ? diff.count : 1, sizeof *diff.pairs);
+	if (!diff.pairs)
+		return ERROR;
+
+	diff.count = 0;
+	for (og = before->output; og; og = og->next) {
+		if (output && strcmp(output_graph_name(og), output) != 0)
+			continue;
+
+		other = graph_data_find_output(after, output_graph_name(og));
+		if (!other)
+			continue;
+
+		diff.pairs[diff.count].og[0] = og;
+		diff.pairs[diff.count].og[1] = other;
+		diff.count++;
+	}
+
+	if (diff.count == 0) {
+		fprintf(stderr, "Error: no output %s%sin both recordings.\n",
+			output ? output : "", output ? " " : "");
+		goto out;
+	}
+
+	for (side = 0; side < 2; side++) {
+		if (output_graph_find_align(diff.pairs[0].og[side], align,
+					    &diff.align[side]) < 0) {
+			fprintf(stderr, "Error: the %s recording has no %s "
+				"on output %s to align on.\n",
+				diff_side_name[side],
+				align < 0 ? "missed frame" : "such vblank",
+				output_graph_name(diff.pairs[0].og[side]));
+			goto out;
+		}
+
+		span = timespec_sub_to_nsec(&diff.gdata[side]->end,
+					    &diff.align[side]);
+		if (span > diff.span)
+			diff.span = span;
+	}
+
+	if (diff.span == 0)
+		diff.span = 1;
+
+	job.diff = &diff;
+	job.side = 0;
+	if (pthread_create(&job.thread, NULL, svg_diff_side_run, &job) != 0)
+		goto out;
+
+	ret = svg_diff_side_draw(&diff, 1);
+
+	pthread_join(job.thread, NULL);
+	if (ret < 0 || job.ret < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	ret = -1;
+	fp = fopen(filename, "w");
+	if (!fp)
+		goto out;
+
+	ret = svg_diff_write(&diff, fp);
+
+	if (fclose(fp) != 0)
+		ret = -1;
+
+out:
+	for (i = 0; i < diff.count; i++) {
+		free(diff.pairs[i].buf[0]);
+		free(diff.pairs[i].buf[1]);
+	}
+	free(diff.pairs);
+
+	if (ret < 0)
+		return ERROR;
+
+	return 0;
+}
@@ -21,6 +21,7 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <inttypes.h>
@@ -32,66 +33,113 @@
 
 #include "wesgr.h"
 
-static struct activity *
-activity_create(struct activity_set *acts,
+/* Tells a library user about a complete block of a lane. */
+static void
+notify_interval(struct output_graph *og, const char *lane,
 		const struct timespec *begin, const struct timespec *end)
+{
+	if (og->hooks && og->hooks->interval &&
+	    timespec_is_valid(begin) && timespec_is_valid(end))
+		og->hooks->interval(og->hooks->data, og, lane, begin, end);
+}
+
+static int
+activity_add(struct output_graph *og, struct activity_set *acts,
+	     const struct timespec *begin, const struct timespec *end)
 {
 	struct activity *act;
 
-	act = calloc(1, sizeof *act);
+	if (og->streaming)
+		return 0;
+
+	act = node_pool_alloc(&acts->pool);
 	if (!act)
-		return ERROR_NULL;
+		return ERROR;
 
 	act->begin = *begin;
 	act->end = *end;
 	act->next = acts->act;
 	acts->act = act;
 
-	return act;
+	return 0;
+}
+
+static const struct timespec *
+activity_time(const void *node)
+{
+	return &((const struct activity *)node)->end;
 }
 
 static void
 activity_set_init(struct activity_set *acs)
 {
 	acs->act = NULL;
+	node_pool_init(&acs->pool, sizeof(struct activity),
+		       offsetof(struct activity, next), activity_time, NULL);
 }
 
+/* When streaming, the vblank is only valid until the next one. */
 static struct vblank *
-vblank_create(struct vblank_set *vblanks, const struct timespec *vbl_time)
+vblank_create(struct output_graph *og, const struct timespec *vbl_time)
 {
 	struct vblank *vbl;
 
-	vbl = calloc(1, sizeof *vbl);
-	if (!vbl)
-		return ERROR_NULL;
+	if (og->streaming) {
+		vbl = &og->stream_vblank;
+		memset(vbl, 0, sizeof *vbl);
+	} else {
+		vbl = node_pool_alloc(&og->vblanks.pool);
+		if (!vbl)
+			return ERROR_NULL;
+
+		vbl->next = og->vblanks.vbl;
+		og->vblanks.vbl = vbl;
+	}
 
 	vbl->ts = *vbl_time;
-	vbl->next = vblanks->vbl;
-	vblanks->vbl = vbl;
+	vbl->cause = MISS_CAUSE_COUNT;
 
 	return vbl;
 }
 
+static const struct timespec *
+vblank_time(const void *node)
+{
+	return &((const struct vblank *)node)->ts;
+}
+
 static void
 vblank_set_init(struct vblank_set *vblanks)
 {
 	vblanks->vbl = NULL;
+	node_pool_init(&vblanks->pool, sizeof(struct vblank),
+		       offsetof(struct vblank, next), vblank_time, NULL);
 }
 
-static struct transition *
-transition_create(struct transition_set *tset, const struct timespec *ts)
+static int
+transition_add(struct output_graph *og, struct transition_set *tset,
+	       const struct timespec *ts)
 {
 	struct transition *trans;
 
-	trans = calloc(1, sizeof *trans);
+	if (og->streaming)
+		return 0;
+
+	trans = node_pool_alloc(&tset->pool);
 	if (!trans)
-		return ERROR_NULL;
+		return ERROR;
 
 	trans->ts = *ts;
 	trans->next = tset->trans;
 	tset->trans = trans;
 
-	return trans;
+	return 0;
+}
+
+static const struct timespec *
+transition_time(const void *node)
+{
+	return &((const struct transition *)node)->ts;
 }
 
 static void
@@ -99,6 +147,125 @@ transition_set_init(struct transition_set *tset, const char *style)
 {
 	tset->trans = NULL;
 	tset->style = style;
+	node_pool_init(&tset->pool, sizeof(struct transition),
+		       offsetof(struct transition, next), transition_time, NULL);
+}
+
+static void
+frame_miss_stats_init(struct frame_miss_stats *fms)
+{
+	memset(fms, 0, sizeof *fms);
+	refresh_estimate_init(&fms->refresh);
+}
+
+const char *
+miss_cause_to_str(enum miss_cause cause)
+{
+	static const char * const names[] = {
+		[MISS_CAUSE_DELAY] = "repaint delay",
+		[MISS_CAUSE_REPAINT] = "output_repaint()",
+		[MISS_CAUSE_GPU] = "gpu",
+	};
+
+	if (cause >= MISS_CAUSE_COUNT)
+		return "none";
+
+	return names[cause];
+}
+
+/*
+ * Inserts elem into worst, *count elements of size bytes sorted from the
+ * largest key down, keeping only the WORST_COUNT largest. Returns 1 if
+ * elem was kept, 0 if not.
+ */
+static int
+worst_insert(void *worst, unsigned *count, size_t size, const void *elem,
+	     uint64_t (*key)(const void *elem))
+{
+	char *arr = worst;
+	uint64_t k = key(elem);
+	unsigned i;
+
+	if (*count == WORST_COUNT && key(arr + (WORST_COUNT - 1) * size) >= k)
+		return 0;
+
+	if (*count < WORST_COUNT)
+		(*count)++;
+
+	for (i = *count - 1; i > 0; i--) {
+		if (key(arr + (i - 1) * size) >= k)
+			break;
+		memcpy(arr + i * size, arr + (i - 1) * size, size);
+	}
+
+	memcpy(arr + i * size, elem, size);
+
+	return 1;
+}
+
+static void
+loop_stats_init(struct loop_stats *ls)
+{
+	memset(ls, 0, sizeof *ls);
+	histogram_init(&ls->busy);
+	histogram_init(&ls->idle);
+	timespec_invalidate(&ls->loop_begin);
+}
+
+static uint64_t
+wasted_loop_duration(const void *elem)
+{
+	const struct wasted_loop *wl = elem;
+
+	return timespec_sub_to_nsec(&wl->end, &wl->begin);
+}
+
+static void
+loop_stats_record_wasted(struct loop_stats *ls, const struct timespec *end)
+{
+	struct wasted_loop wl = {
+		.begin = ls->loop_begin,
+		.end = *end,
+		.repaints = ls->loop_repaints,
+	};
+
+	worst_insert(ls->worst, &ls->worst_count, sizeof ls->worst[0], &wl,
+		     wasted_loop_duration);
+}
+
+/* Loops that began before the recording are not counted. */
+static int
+loop_stats_end_loop(struct loop_stats *ls, const struct timespec *end)
+{
+	if (!timespec_is_valid(&ls->loop_begin))
+		return 0;
+
+	if (histogram_add(&ls->busy,
+			  timespec_sub_to_nsec(end, &ls->loop_begin)) < 0)
+		return ERROR;
+
+	ls->loops++;
+
+	if (ls->loop_flushes == 0) {
+		ls->wasted_loops++;
+		loop_stats_record_wasted(ls, end);
+	}
+
+	timespec_invalidate(&ls->loop_begin);
+
+	return 0;
+}
+
+static const struct timespec *
+line_block_time(const void *node)
+{
+	return &((const struct line_block *)node)->end;
+}
+
+static void
+line_block_release(void *node)
+{
+	free(((struct line_block *)node)->desc);
 }
 
 static void
@@ -107,6 +274,10 @@ line_graph_init(struct line_graph *lg, const char *style, const char *label)
 	lg->block = NULL;
 	lg->style = style;
 	lg->label = label;
+	histogram_init(&lg->durations);
+	node_pool_init(&lg->pool, sizeof(struct line_block),
+		       offsetof(struct line_block, next), line_block_time,
+		       line_block_release);
 }
 
 static struct output_graph *
@@ -136,6 +307,12 @@ get_output_graph(struct parse_context *ctx, struct object_info *output)
 	transition_set_init(&og->posts, "trans_post");
 	vblank_set_init(&og->vblanks);
 	activity_set_init(&og->not_looping);
+	histogram_init(&og->vblank_intervals);
+	frame_miss_stats_init(&og->misses);
+	loop_stats_init(&og->loops);
+	gpu_stats_init(&og->gpu);
+	og->streaming = ctx->gdata->streaming;
+	og->hooks = ctx->gdata->hooks;
 
 	timespec_invalidate(&og->last_req);
 	timespec_invalidate(&og->last_finished);
@@ -143,6 +320,7 @@ get_output_graph(struct parse_context *ctx, struct object_info *output)
 	timespec_invalidate(&og->last_posted);
 	timespec_invalidate(&og->last_exit_loop);
 	timespec_invalidate(&og->last_renderer_gpu_begin);
+	timespec_invalidate(&og->last_vblank);
 	og->info = wo;
 	og->next = ctx->gdata->output;
 	ctx->gdata->output = og;
@@ -152,15 +330,26 @@ get_output_graph(struct parse_context *ctx, struct object_info *output)
 	return og;
 }
 
-static struct line_block *
-line_block_create(struct line_graph *linegr, const struct timespec *begin,
-		  const struct timespec *end, const char *style)
+static int
+line_block_add(struct output_graph *og, struct line_graph *linegr,
+	       const struct timespec *begin, const struct timespec *end,
+	       const char *style)
 {
 	struct line_block *lb;
 
-	lb = calloc(1, sizeof *lb);
+	if (timespec_is_valid(begin) && timespec_is_valid(end) &&
+	    histogram_add(&linegr->durations,
+			  timespec_sub_to_nsec(end, begin)) < 0)
+		return ERROR;
+
+	notify_interval(og, linegr->style, begin, end);
+
+	if (og->streaming)
+		return 0;
+
+	lb = node_pool_alloc(&linegr->pool);
 	if (!lb)
-		return ERROR_NULL;
+		return ERROR;
 
 	lb->begin = *begin;
 	lb->end = *end;
@@ -168,7 +357,7 @@ line_block_create(struct line_graph *linegr, const struct timespec *begin,
 	lb->next = linegr->block;
 	linegr->block = lb;
 
-	return lb;
+	return 0;
 }
 
 static int
@@ -184,18 +373,19 @@ core_repaint_begin(struct parse_context *ctx, const struct timespec *ts,
 		return ERROR;
 
 	og->last_begin = *ts;
+	og->loops.loop_repaints++;
+	repaint_requests_frame(&og->requests);
+	og->loops.repaint_flushes = 0;
 
 	if (timespec_is_valid(&og->last_finished)) {
-		struct line_block *lb;
-		struct transition *trans;
-
-		lb = line_block_create(&og->delay_line, &og->last_finished,
-				       ts, "repaint_delay");
-		if (!lb)
+		if (line_block_add(og, &og->delay_line, &og->last_finished,
+				   ts, "repaint_delay") < 0)
 			return ERROR;
 
-		trans = transition_create(&og->begins, ts);
-		if (!trans)
+		og->misses.frame_delay =
+			timespec_sub_to_nsec(ts, &og->last_finished);
+
+		if (transition_add(og, &og->begins, ts) < 0)
 			return ERROR;
 	}
 
@@ -217,18 +407,23 @@ core_repaint_posted(struct parse_context *ctx, const struct timespec *ts,
 		return ERROR;
 
 	og->last_posted = *ts;
+	og->loops.repaints++;
+	if (og->loops.repaint_flushes == 0)
+		og->loops.empty_repaints++;
+	repaint_requests_posted(&og->requests, og->loops.repaint_flushes == 0);
 
 	if (timespec_is_valid(&og->last_begin)) {
-		struct line_block *lb;
-		struct transition *trans;
+		if (line_block_add(og, &og->submit_line, &og->last_begin,
+				   ts, "repaint_submit") < 0)
+			return ERROR;
 
-		lb = line_block_create(&og->submit_line, &og->last_begin,
-				       ts, "repaint_submit");
-		if (!lb)
+		if (gpu_stats_add_submit(&og->gpu, &og->last_begin, ts) < 0)
 			return ERROR;
 
-		trans = transition_create(&og->posts, ts);
-		if (!trans)
+		og->misses.frame_submit =
+			timespec_sub_to_nsec(ts, &og->last_begin);
+
+		if (transition_add(og, &og->posts, ts) < 0)
 			return ERROR;
 	}
 
@@ -237,28 +432,256 @@ core_repaint_posted(struct parse_context *ctx, const struct timespec *ts,
 	return 0;
 }
 
+/* From the commit, or the flush if the commit was not seen, to vblank */
+uint64_t
+update_latency_total(const struct update *update)
+{
+	if (timespec_is_valid(&update->damage))
+		return timespec_sub_to_nsec(&update->vblank, &update->damage);
+
+	return timespec_sub_to_nsec(&update->vblank, &update->flush);
+}
+
+static uint64_t
+update_latency_key(const void *elem)
+{
+	return update_latency_total(elem);
+}
+
+/* Returns 1 if the update was added to the list, 0 if not. */
+int
+update_latency_record_worst(struct update_latency *lat,
+			    const struct update *update)
+{
+	struct update copy = *update;
+
+	copy.next = NULL;
+
+	return worst_insert(lat->worst, &lat->worst_count,
+			    sizeof lat->worst[0], &copy, update_latency_key);
+}
+
+static int
+update_latency_add(struct update_latency *lat, const struct update *update)
+{
+	if (timespec_is_valid(&update->damage) &&
+	    histogram_add(&lat->commit_to_flush,
+			  timespec_sub_to_nsec(&update->flush,
+					       &update->damage)) < 0)
+		return ERROR;
+
+	if (!timespec_is_valid(&update->vblank))
+		return 0;
+
+	if (histogram_add(&lat->flush_to_vblank,
+			  timespec_sub_to_nsec(&update->vblank,
+					       &update->flush)) < 0)
+		return ERROR;
+
+	if (histogram_add(&lat->total, update_latency_total(update)) < 0)
+		return ERROR;
+
+	update_latency_record_worst(lat, update);
+
+	return 0;
+}
+
 static void
+update_list_destroy(struct update *update)
+{
+	struct update *tmp;
+
+	for (; update; update = tmp) {
+		tmp = update->next;
+		free(update);
+	}
+}
+
+/* Moves a finished update into the graph, or drops it when streaming. */
+static int
+update_graph_keep(struct update_graph *update_gr, struct update *update)
+{
+	struct update *node;
+
+	if (!update_gr->streaming) {
+		node = node_pool_alloc(&update_gr->pool);
+		if (!node) {
+			free(update);
+			return ERROR;
+		}
+
+		*node = *update;
+		node->next = update_gr->updates;
+		update_gr->updates = node;
+	}
+
+	free(update);
+
+	return 0;
+}
+
+static int
 process_need_list(struct update_graph *update_gr,
 		  const struct timespec *vblank)
 {
-	struct update *update;
+	struct update *update, *next;
+	struct update *oldest = NULL;
 
-	update = update_gr->need_vblank;
-	if (!update)
+	for (update = update_gr->need_vblank; update; update = update->next) {
+		update->vblank = *vblank;
+
+		if (update_latency_add(&update_gr->latency, update) < 0)
+			return ERROR;
+	}
+
+	/* Keep them oldest first, so the list stays in pool order. */
+	for (update = update_gr->need_vblank; update; update = next) {
+		next = update->next;
+		update->next = oldest;
+		oldest = update;
+	}
+	update_gr->need_vblank = NULL;
+
+	for (update = oldest; update; update = next) {
+		next = update->next;
+		update->next = NULL;
+
+		if (update_graph_keep(update_gr, update) < 0) {
+			update_list_destroy(next);
+			return ERROR;
+		}
+	}
+
+	return 0;
+}
+
+static uint64_t
+frame_miss_interval(const void *elem)
+{
+	const struct frame_miss *miss = elem;
+
+	return miss->interval;
+}
+
+/* Keeps the list sorted from the longest interval down. */
+static void
+frame_miss_record_worst(struct frame_miss_stats *fms,
+			const struct frame_miss *miss)
+{
+	worst_insert(fms->worst, &fms->worst_count, sizeof fms->worst[0],
+		     miss, frame_miss_interval);
+}
+
+static void
+typical_update(uint64_t *typical, uint64_t value)
+{
+	if (*typical == 0)
+		*typical = value;
+	else
+		*typical = (*typical * 7 + value) / 8;
+}
+
+/*
+ * Compares the vblank interval with the estimated refresh period, and
+ * when frames were missed, blames the repaint phase that exceeded its
+ * typical duration the most.
+ */
+static void
+detect_missed_frames(struct output_graph *og, struct vblank *vbl,
+		     uint64_t gpu)
+{
+	struct frame_miss_stats *fms = &og->misses;
+	uint64_t dur[MISS_CAUSE_COUNT];
+	struct frame_miss miss;
+	int64_t excess, worst;
+	unsigned periods;
+	unsigned i;
+
+	fms->frames++;
+
+	dur[MISS_CAUSE_DELAY] = fms->frame_delay;
+	dur[MISS_CAUSE_REPAINT] = fms->frame_submit;
+	dur[MISS_CAUSE_GPU] = gpu;
+
+	fms->frame_delay = 0;
+	fms->frame_submit = 0;
+
+	periods = vbl->interval ?
+		  refresh_estimate_add(&fms->refresh, vbl->interval) : 0;
+
+	if (periods < 2) {
+		for (i = 0; i < MISS_CAUSE_COUNT; i++)
+			typical_update(&fms->typical[i], dur[i]);
 		return;
+	}
 
-	while (1) {
-		update->vblank = *vblank;
+	vbl->missed = periods - 1;
+	vbl->cause = MISS_CAUSE_DELAY;
+	worst = INT64_MIN;
+	for (i = 0; i < MISS_CAUSE_COUNT; i++) {
+		excess = (int64_t)dur[i] - (int64_t)fms->typical[i];
+		if (excess > worst) {
+			worst = excess;
+			vbl->cause = i;
+		}
+	}
 
-		if (!update->next)
-			break;
+	fms->count[vbl->cause] += vbl->missed;
+	fms->missed_frames += vbl->missed;
+
+	miss.ts = vbl->ts;
+	miss.interval = vbl->interval;
+	miss.missed = vbl->missed;
+	miss.cause = vbl->cause;
+	frame_miss_record_worst(fms, &miss);
+}
+
+/* Anything further from the event is taken to be on another clock. */
+#define VBLANK_MAX_OFFSET_NSEC 1000000000
+
+static int
+vblank_time_is_plausible(const struct timespec *vblank,
+			 const struct timespec *ts)
+{
+	if (!timespec_is_valid(vblank))
+		return 0;
 
-		update = update->next;
+	if (timespec_cmp(vblank, ts) < 0)
+		return timespec_sub_to_nsec(ts, vblank) < VBLANK_MAX_OFFSET_NSEC;
+
+	return timespec_sub_to_nsec(vblank, ts) < VBLANK_MAX_OFFSET_NSEC;
+}
+
+/*
+ * Newer Weston versions log the vblank time with the event, as "vblank"
+ * on the presentation clock or as "vblank_monotonic". Older logs only
+ * have the time of the event, which is snapped to the estimated
+ * refresh grid.
+ */
+static void
+get_vblank_time(struct parse_context *ctx, struct output_graph *og,
+		struct json_object *jobj, const struct timespec *ts,
+		struct timespec *vblank)
+{
+	struct frame_miss_stats *fms = &og->misses;
+	static const char * const members[] = {
+		"vblank_monotonic",
+		"vblank",
+	};
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(members); i++) {
+		*vblank = get_timespec_from_timepoint(ctx, jobj, members[i]);
+		if (vblank_time_is_plausible(vblank, ts)) {
+			refresh_estimate_set_phase(&fms->refresh, vblank);
+			fms->stamped++;
+			return;
+		}
 	}
 
-	update->next = update_gr->updates;
-	update_gr->updates = update;
-	update_gr->need_vblank = NULL;
+	if (refresh_estimate_snap(&fms->refresh, ts, &og->last_posted,
+				  vblank))
+		fms->snapped++;
 }
 
 static int
@@ -273,25 +696,48 @@ core_repaint_finished(struct parse_context *ctx, const struct timespec *ts,
 	if (!og)
 		return ERROR;
 
+	/* the compositor only learns of the vblank, and reacts, from here */
 	og->last_finished = *ts;
 
 	if (timespec_is_valid(&og->last_posted)) {
-		struct line_block *lb;
+		const struct timespec *presented;
 		struct vblank *vbl;
 		struct update_graph *ugr;
 
-		lb = line_block_create(&og->gpu_line, &og->last_posted,
-				       ts, "repaint_gpu");
-		if (!lb)
+		vbl = vblank_create(og, ts);
+		if (!vbl)
 			return ERROR;
 
-		/* XXX: use the real vblank time, not ts */
-		vbl = vblank_create(&og->vblanks, ts);
-		if (!vbl)
+		get_vblank_time(ctx, og, jobj, ts, &vbl->ts);
+
+		/* a logged vblank can be a bit before the frame was posted */
+		presented = &vbl->ts;
+		if (timespec_cmp(presented, &og->last_posted) < 0)
+			presented = &og->last_posted;
+
+		if (line_block_add(og, &og->gpu_line, &og->last_posted,
+				   presented, "repaint_gpu") < 0)
 			return ERROR;
 
+		if (timespec_is_valid(&og->last_vblank)) {
+			vbl->interval = timespec_sub_to_nsec(&vbl->ts,
+							     &og->last_vblank);
+			if (histogram_add(&og->vblank_intervals,
+					  vbl->interval) < 0)
+				return ERROR;
+		}
+		og->last_vblank = vbl->ts;
+
+		detect_missed_frames(og, vbl,
+				     timespec_sub_to_nsec(presented,
+							  &og->last_posted));
+
+		if (og->hooks && og->hooks->vblank)
+			og->hooks->vblank(og->hooks->data, og, vbl);
+
 		for (ugr = og->updates; ugr; ugr = ugr->next)
-			process_need_list(ugr, &vbl->ts);
+			if (process_need_list(ugr, &vbl->ts) < 0)
+				return ERROR;
 	}
 
 	timespec_invalidate(&og->last_posted);
@@ -299,6 +745,69 @@ core_repaint_finished(struct parse_context *ctx, const struct timespec *ts,
 	return 0;
 }
 
+/* The surface or output a call site scheduled the repaint for */
+static const char *
+callsite_target(struct parse_context *ctx, struct json_object *site,
+		unsigned *id)
+{
+	static const char * const members[] = { "ws", "wo" };
+	struct json_object *id_jobj;
+	struct object_info *oi;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(members); i++) {
+		if (!json_object_object_get_ex(site, members[i], &id_jobj))
+			continue;
+
+		*id = json_object_get_int(id_jobj);
+		oi = get_object_info_from_timepoint(ctx, site, members[i]);
+		if (!oi)
+			return NULL;
+
+		if (oi->type == TYPE_WESTON_SURFACE)
+			return oi->info.ws.description;
+
+		return oi->info.wo.name;
+	}
+
+	return NULL;
+}
+
+static int
+repaint_requests_parse(struct parse_context *ctx, struct repaint_requests *rr,
+		       struct json_object *jobj)
+{
+	struct json_object *calls;
+	struct json_object *site;
+	struct json_object *f_jobj;
+	struct json_object *l_jobj;
+	const char *label;
+	unsigned id;
+	int i, n;
+
+	if (!json_object_object_get_ex(jobj, "C", &calls) ||
+	    !json_object_is_type(calls, json_type_array))
+		return 0;
+
+	n = json_object_array_length(calls);
+	for (i = 0; i < n; i++) {
+		site = json_object_array_get_idx(calls, i);
+		if (!json_object_object_get_ex(site, "f", &f_jobj) ||
+		    !json_object_object_get_ex(site, "l", &l_jobj))
+			continue;
+
+		id = 0;
+		label = callsite_target(ctx, site, &id);
+
+		if (repaint_requests_add(rr, json_object_get_string(f_jobj),
+					 json_object_get_int64(l_jobj),
+					 id, label) < 0)
+			return ERROR;
+	}
+
+	return 0;
+}
+
 static int
 core_repaint_req(struct parse_context *ctx, const struct timespec *ts,
 		 struct json_object *jobj)
@@ -313,7 +822,7 @@ core_repaint_req(struct parse_context *ctx, const struct timespec *ts,
 
 	og->last_req = *ts;
 
-	return 0;
+	return repaint_requests_parse(ctx, &og->requests, jobj);
 }
 
 static int
@@ -330,6 +839,12 @@ core_repaint_exit_loop(struct parse_context *ctx, const struct timespec *ts,
 
 	og->last_exit_loop = *ts;
 
+	if (loop_stats_end_loop(&og->loops, ts) < 0)
+		return ERROR;
+
+	/* The next vblank interval would include the idle time. */
+	timespec_invalidate(&og->last_vblank);
+
 	return 0;
 }
 
@@ -339,7 +854,6 @@ core_repaint_enter_loop(struct parse_context *ctx, const struct timespec *ts,
 {
 	struct object_info *output;
 	struct output_graph *og;
-	struct activity *act;
 
 	output = get_object_info_from_timepoint(ctx, jobj, "wo");
 	og = get_output_graph(ctx, output);
@@ -347,16 +861,29 @@ core_repaint_enter_loop(struct parse_context *ctx, const struct timespec *ts,
 		return ERROR;
 
 	if (!timespec_is_valid(&og->last_exit_loop)) {
+		og->loops.idle_total +=
+			timespec_sub_to_nsec(ts, &ctx->gdata->begin);
 		og->last_exit_loop.tv_sec = 0;
 		og->last_exit_loop.tv_nsec = 0;
+	} else {
+		uint64_t idle = timespec_sub_to_nsec(ts, &og->last_exit_loop);
+
+		og->loops.idle_total += idle;
+		if (histogram_add(&og->loops.idle, idle) < 0)
+			return ERROR;
+
+		notify_interval(og, "not_looping", &og->last_exit_loop, ts);
 	}
 
-	act = activity_create(&og->not_looping, &og->last_exit_loop, ts);
-	if (!act)
+	if (activity_add(og, &og->not_looping, &og->last_exit_loop, ts) < 0)
 		return ERROR;
 
 	timespec_invalidate(&og->last_exit_loop);
 
+	og->loops.loop_begin = *ts;
+	og->loops.loop_repaints = 0;
+	og->loops.loop_flushes = 0;
+
 	return 0;
 }
 
@@ -376,6 +903,21 @@ create_update(const struct timespec *damaged)
 	return update;
 }
 
+/* The vblank, or the latest time known for updates that never got one */
+static const struct timespec *
+update_time(const void *node)
+{
+	const struct update *update = node;
+
+	if (timespec_is_valid(&update->vblank))
+		return &update->vblank;
+
+	if (timespec_is_valid(&update->flush))
+		return &update->flush;
+
+	return &update->damage;
+}
+
 static struct update_graph *
 create_update_graph(struct output_graph *output_gr,
 		    struct info_weston_surface *iws)
@@ -388,15 +930,24 @@ create_update_graph(struct output_graph *output_gr,
 
 	update_gr->label = strdup(iws->description);
 	update_gr->style = "damage";
-	update_gr->next = output_gr->updates;
-	output_gr->updates = update_gr;
+	update_gr->streaming = output_gr->streaming;
+	node_pool_init(&update_gr->pool, sizeof(struct update),
+		       offsetof(struct update, next), update_time, NULL);
+	histogram_init(&update_gr->latency.commit_to_flush);
+	histogram_init(&update_gr->latency.flush_to_vblank);
+	histogram_init(&update_gr->latency.total);
 
 	return update_gr;
 }
 
+/*
+ * The new update graph is only added to the output by the handoff, as
+ * the output may be another thread's.
+ */
 static struct surface_graph_list *
 create_surface_graph_list(struct info_weston_surface *iws,
-			  struct output_graph *output_gr)
+			  struct output_graph *output_gr,
+			  struct surface_handoff *h)
 {
 	struct surface_graph_list *sgl;
 
@@ -408,6 +959,8 @@ create_surface_graph_list(struct info_weston_surface *iws,
 
 	sgl->update_gr = create_update_graph(output_gr, iws);
 	sgl->output_gr = output_gr;
+	h->og = output_gr;
+	h->new_graph = sgl->update_gr;
 	sgl->next = iws->glist;
 	iws->glist = sgl;
 
@@ -419,7 +972,8 @@ create_surface_graph_list(struct info_weston_surface *iws,
 
 static struct surface_graph_list *
 get_surface_graph_list_default(struct parse_context *ctx,
-			       struct info_weston_surface *iws)
+			       struct info_weston_surface *iws,
+			       struct surface_handoff *h)
 {
 	struct output_graph *output_gr;
 	struct surface_graph_list *sgl;
@@ -434,7 +988,7 @@ get_surface_graph_list_default(struct parse_context *ctx,
 	if (!output_gr)
 		return NULL;
 
-	sgl = create_surface_graph_list(iws, output_gr);
+	sgl = create_surface_graph_list(iws, output_gr, h);
 	if (!sgl)
 		return ERROR_NULL;
 
@@ -446,7 +1000,8 @@ get_surface_graph_list_default(struct parse_context *ctx,
 static struct surface_graph_list *
 get_surface_graph_list(struct parse_context *ctx,
 		       struct info_weston_surface *iws,
-		       struct output_graph *output_gr)
+		       struct output_graph *output_gr,
+		       struct surface_handoff *h)
 {
 	struct surface_graph_list *sgl;
 
@@ -460,7 +1015,7 @@ get_surface_graph_list(struct parse_context *ctx,
 			return sgl;
 	}
 
-	sgl = create_surface_graph_list(iws, output_gr);
+	sgl = create_surface_graph_list(iws, output_gr, h);
 	if (!sgl)
 		return ERROR_NULL;
 
@@ -469,35 +1024,48 @@ get_surface_graph_list(struct parse_context *ctx,
 	return sgl;
 }
 
-static int
-put_update_to_graph_list(struct surface_graph_list *sgl, struct update *update)
+/*
+ * Does the part of a surface timepoint that belongs to its output: adds
+ * a new update graph to it, counts a flush, and keeps the update or
+ * lets it wait for the next vblank. Also run after the surface part
+ * failed, to not lose what it handed over.
+ */
+int
+surface_handoff_run(struct surface_handoff *h)
 {
-	if (!update)
+	struct output_graph *og = h->og;
+	struct update *update = h->update;
+
+	if (!og)
 		return 0;
 
-	assert(update->next == NULL);
-	update->next = sgl->update_gr->updates;
-	sgl->update_gr->updates = update;
+	if (h->new_graph) {
+		h->new_graph->next = og->updates;
+		og->updates = h->new_graph;
+	}
 
-	return 0;
-}
+	if (h->flush) {
+		og->loops.loop_flushes++;
+		og->loops.repaint_flushes++;
+	}
 
-static int
-put_update_to_need_list(struct surface_graph_list *sgl, struct update *update)
-{
 	if (!update)
 		return 0;
 
 	assert(update->next == NULL);
-	update->next = sgl->update_gr->need_vblank;
-	sgl->update_gr->need_vblank = update;
+
+	if (!h->flush)
+		return update_graph_keep(h->update_gr, update);
+
+	update->next = h->update_gr->need_vblank;
+	h->update_gr->need_vblank = update;
 
 	return 0;
 }
 
 static int
-core_commit_damage(struct parse_context *ctx, const struct timespec *ts,
-		   struct json_object *jobj)
+surface_commit_damage(struct parse_context *ctx, const struct timespec *ts,
+		      struct json_object *jobj, struct surface_handoff *h)
 {
 	struct object_info *surface;
 	struct surface_graph_list *sgl;
@@ -506,16 +1074,36 @@ core_commit_damage(struct parse_context *ctx, const struct timespec *ts,
 	if (!surface || surface->type != TYPE_WESTON_SURFACE)
 		return ERROR;
 
-	sgl = get_surface_graph_list_default(ctx, &surface->info.ws);
+	if (surface->excluded)
+		return 0;
+
+	/*
+	 * With an output filter, the first output may not be the surface's,
+	 * so its updates are dropped until it is flushed on one.
+	 */
+	if (!surface->info.ws.last && ctx->filter.output) {
+		free(surface->info.ws.open_update);
+		surface->info.ws.open_update = create_update(ts);
+		if (!surface->info.ws.open_update)
+			return ERROR;
+
+		return 0;
+	}
+
+	sgl = get_surface_graph_list_default(ctx, &surface->info.ws, h);
 	if (!sgl) {
+		if (h->og)
+			return ERROR;
+
 		fprintf(stderr, "info: ignoring core_commit_damage event at"
 			" %" PRId64 ".%09ld\n",
 			(int64_t)ts->tv_sec, ts->tv_nsec);
 		return 0;
 	}
 
-	if (put_update_to_graph_list(sgl, surface->info.ws.open_update) < 0)
-		return ERROR;
+	h->og = sgl->output_gr;
+	h->update_gr = sgl->update_gr;
+	h->update = surface->info.ws.open_update;
 
 	surface->info.ws.open_update = create_update(ts);
 	if (!surface->info.ws.open_update)
@@ -525,8 +1113,8 @@ core_commit_damage(struct parse_context *ctx, const struct timespec *ts,
 }
 
 static int
-core_flush_damage(struct parse_context *ctx, const struct timespec *ts,
-		  struct json_object *jobj)
+surface_flush_damage(struct parse_context *ctx, const struct timespec *ts,
+		     struct json_object *jobj, struct surface_handoff *h)
 {
 	struct object_info *surface;
 	struct object_info *output;
@@ -538,6 +1126,19 @@ core_flush_damage(struct parse_context *ctx, const struct timespec *ts,
 	if (!surface || surface->type != TYPE_WESTON_SURFACE)
 		return ERROR;
 
+	output = get_object_info_from_timepoint(ctx, jobj, "wo");
+	og = get_output_graph(ctx, output);
+	if (!og)
+		return ERROR;
+
+	ctx->gdata->damage_seen = 1;
+	h->og = og;
+	h->flush = 1;
+
+	/* the output still counts the flush, for its repaint loops */
+	if (surface->excluded)
+		return 0;
+
 	update = surface->info.ws.open_update;
 	if (!update) {
 		update = create_update(ts);
@@ -547,22 +1148,51 @@ core_flush_damage(struct parse_context *ctx, const struct timespec *ts,
 		timespec_invalidate(&update->damage);
 	}
 	surface->info.ws.open_update = NULL;
+	update->flush = *ts;
 
-	output = get_object_info_from_timepoint(ctx, jobj, "wo");
-	og = get_output_graph(ctx, output);
-	if (!og)
+	sgl = get_surface_graph_list(ctx, &surface->info.ws, og, h);
+	if (!sgl) {
+		free(update);
 		return ERROR;
+	}
 
-	update->flush = *ts;
+	h->update_gr = sgl->update_gr;
+	h->update = update;
 
-	sgl = get_surface_graph_list(ctx, &surface->info.ws, og);
-	if (!sgl)
-		return ERROR;
+	return 0;
+}
 
-	if (put_update_to_need_list(sgl, update) < 0)
+/* Both parts of a surface timepoint at once, on one thread */
+static int
+run_surface_handler(int (*surface)(struct parse_context *ctx,
+				   const struct timespec *ts,
+				   struct json_object *jobj,
+				   struct surface_handoff *h),
+		    struct parse_context *ctx, const struct timespec *ts,
+		    struct json_object *jobj)
+{
+	struct surface_handoff h = { NULL };
+	int ret;
+
+	ret = surface(ctx, ts, jobj, &h);
+	if (surface_handoff_run(&h) < 0)
 		return ERROR;
 
-	return 0;
+	return ret;
+}
+
+static int
+core_commit_damage(struct parse_context *ctx, const struct timespec *ts,
+		   struct json_object *jobj)
+{
+	return run_surface_handler(surface_commit_damage, ctx, ts, jobj);
+}
+
+static int
+core_flush_damage(struct parse_context *ctx, const struct timespec *ts,
+		  struct json_object *jobj)
+{
+	return run_surface_handler(surface_flush_damage, ctx, ts, jobj);
 }
 
 static int
@@ -597,14 +1227,17 @@ renderer_gpu_end(struct parse_context *ctx, const struct timespec *ts,
 
 	if (timespec_is_valid(&og->last_renderer_gpu_begin)) {
 		struct timespec gpu_ts;
-		struct line_block *lb;
 
 		gpu_ts = get_timespec_from_timepoint(ctx, jobj, "gpu");
 
-		lb = line_block_create(&og->renderer_gpu_line,
-				       &og->last_renderer_gpu_begin,
-				       &gpu_ts, "renderer_gpu");
-		if (!lb)
+		if (line_block_add(og, &og->renderer_gpu_line,
+				   &og->last_renderer_gpu_begin,
+				   &gpu_ts, "renderer_gpu") < 0)
+			return ERROR;
+
+		if (gpu_stats_add_render(&og->gpu, &ctx->gdata->begin,
+					 &og->last_renderer_gpu_begin,
+					 &gpu_ts) < 0)
 			return ERROR;
 	}
 
@@ -624,32 +1257,54 @@ graph_data_end(struct graph_data *gdata)
 
 	for (og = gdata->output; og; og = og->next) {
 		if (timespec_is_valid(&og->last_exit_loop)) {
-			struct activity *act;
+			og->loops.idle_total +=
+				timespec_sub_to_nsec(&gdata->end,
+						     &og->last_exit_loop);
 
-			act = activity_create(&og->not_looping,
-					      &og->last_exit_loop, &invalid);
-			if (!act)
+			if (activity_add(og, &og->not_looping,
+					 &og->last_exit_loop, &invalid) < 0)
 				return ERROR;
 		}
 
+		if (gpu_stats_finish(&og->gpu) < 0)
+			return ERROR;
+
 		for (upg = og->updates; upg; upg = upg->next)
-			process_need_list(upg, &invalid);
+			if (process_need_list(upg, &invalid) < 0)
+				return ERROR;
 	}
 
 	return 0;
 }
 
+/*
+ * The output a timepoint is for, created when first seen, or NULL if it
+ * does not name a known one. Handlers without a surface part touch only
+ * this output.
+ */
+struct output_graph *
+timepoint_output_graph(struct parse_context *ctx, struct json_object *jobj)
+{
+	struct object_info *output;
+
+	output = find_object_info(ctx, jobj, "wo");
+	if (!output || output->type != TYPE_WESTON_OUTPUT)
+		return NULL;
+
+	return get_output_graph(ctx, output);
+}
+
 const struct tp_handler_item tp_handler_list[] = {
-	{ "core_repaint_enter_loop", core_repaint_enter_loop },
-	{ "core_repaint_exit_loop", core_repaint_exit_loop },
-	{ "core_repaint_finished", core_repaint_finished },
-	{ "core_repaint_begin", core_repaint_begin },
-	{ "core_repaint_posted", core_repaint_posted },
-	{ "core_repaint_req", core_repaint_req },
-	{ "core_commit_damage", core_commit_damage },
-	{ "core_flush_damage", core_flush_damage },
-	{ "renderer_gpu_begin", renderer_gpu_begin},
-	{ "renderer_gpu_end", renderer_gpu_end},
-	{ NULL, NULL }
+	{ "core_repaint_enter_loop", core_repaint_enter_loop, NULL },
+	{ "core_repaint_exit_loop", core_repaint_exit_loop, NULL },
+	{ "core_repaint_finished", core_repaint_finished, NULL },
+	{ "core_repaint_begin", core_repaint_begin, NULL },
+	{ "core_repaint_posted", core_repaint_posted, NULL },
+	{ "core_repaint_req", core_repaint_req, NULL },
+	{ "core_commit_damage", core_commit_damage, surface_commit_damage },
+	{ "core_flush_damage", core_flush_damage, surface_flush_damage },
+	{ "renderer_gpu_begin", renderer_gpu_begin, NULL },
+	{ "renderer_gpu_end", renderer_gpu_end, NULL },
+	{ NULL, NULL, NULL }
 };
 
@@ -0,0 +1,342 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The public API of libwesgr, a thin layer over the parse context and
+ * graph data that the wesgr tool is also built on.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <json.h>
+
+#include "wesgr.h"
+#include "libwesgr.h"
+
+#define READ_CHUNK_SIZE 8192
+
+struct wesgr {
+	struct graph_data gdata;
+	struct parse_context ctx;
+	struct json_tokener *jtok;
+	struct graph_hooks hooks;
+	struct wesgr_callbacks cb;
+	void *cb_data;
+	int pipelined;		/* parse files on threads */
+};
+
+static void
+hook_interval(void *data, const struct output_graph *og, const char *lane,
+	      const struct timespec *begin, const struct timespec *end)
+{
+	struct wesgr *w = data;
+
+	w->cb.interval(w->cb_data, output_graph_name(og), lane,
+		       timespec_to_nsec(begin), timespec_to_nsec(end));
+}
+
+static void
+hook_vblank(void *data, const struct output_graph *og,
+	    const struct vblank *vbl)
+{
+	struct wesgr *w = data;
+
+	w->cb.vblank(w->cb_data, output_graph_name(og),
+		     timespec_to_nsec(&vbl->ts), vbl->missed);
+}
+
+WESGR_EXPORT struct wesgr *
+wesgr_create(const struct wesgr_callbacks *cb, void *data, uint32_t flags)
+{
+	struct wesgr *w;
+
+	w = calloc(1, sizeof *w);
+	if (!w)
+		return ERROR_NULL;
+
+	if (graph_data_init(&w->gdata) < 0)
+		goto err_free;
+
+	w->gdata.streaming = !!(flags & WESGR_STREAMING);
+	w->pipelined = !(flags & WESGR_SERIAL) &&
+		       sysconf(_SC_NPROCESSORS_ONLN) > 1;
+
+	if (cb) {
+		w->cb = *cb;
+		w->cb_data = data;
+		w->hooks.interval = cb->interval ? hook_interval : NULL;
+		w->hooks.vblank = cb->vblank ? hook_vblank : NULL;
+		w->hooks.data = w;
+		w->gdata.hooks = &w->hooks;
+	}
+
+	if (parse_context_init(&w->ctx, &w->gdata) < 0)
+		goto err_gdata;
+
+	w->jtok = json_tokener_new();
+	if (!w->jtok)
+		goto err_ctx;
+
+	return w;
+
+err_ctx:
+	parse_context_release(&w->ctx);
+err_gdata:
+	graph_data_release(&w->gdata);
+err_free:
+	free(w);
+
+	return ERROR_NULL;
+}
+
+WESGR_EXPORT void
+wesgr_destroy(struct wesgr *w)
+{
+	json_tokener_free(w->jtok);
+	parse_context_release(&w->ctx);
+	graph_data_release(&w->gdata);
+	free(w);
+}
+
+WESGR_EXPORT int
+wesgr_set_retention(struct wesgr *w, uint64_t nsec)
+{
+	w->gdata.retain_ns = nsec;
+
+	return 0;
+}
+
+WESGR_EXPORT int
+wesgr_set_filter(struct wesgr *w, const char *output, const char *surface)
+{
+	return parse_context_set_filter(&w->ctx, output, surface);
+}
+
+static void
+profile_tokenize_end(struct parse_context *ctx, uint64_t since)
+{
+	if (ctx->prof)
+		profile_counter_add(&ctx->prof->phase[PROFILE_TOKENIZE], since);
+}
+
+/*
+ * Interprets all complete JSON objects in the buffer. The tokener
+ * keeps a partial object for the next call.
+ */
+WESGR_EXPORT int
+wesgr_feed(struct wesgr *w, const void *buf, size_t len)
+{
+	struct parse_context *ctx = &w->ctx;
+	const char *pos = buf;
+	const char *end = pos + len;
+	struct json_object *jobj;
+	uint64_t since = 0;
+
+	if (ctx->prof)
+		ctx->prof->bytes += len;
+
+	while (1) {
+		enum json_tokener_error jerr;
+		int r;
+
+		if (ctx->prof)
+			since = profile_now();
+
+		jobj = json_tokener_parse_ex(w->jtok, pos, end - pos);
+
+		profile_tokenize_end(ctx, since);
+		jerr = json_tokener_get_error(w->jtok);
+		if (!jobj && jerr == json_tokener_continue)
+			return 0;
+
+		if (!jobj) {
+			fprintf(stderr, "JSON parse failure: %d\n", jerr);
+			return -1;
+		}
+
+		pos += w->jtok->char_offset;
+
+		r = parse_context_process_object(ctx, jobj);
+		json_object_put(jobj);
+
+		if (r < 0) {
+			fprintf(stderr, "JSON interpretation error\n");
+			return -1;
+		}
+	}
+}
+
+WESGR_EXPORT int
+wesgr_finish(struct wesgr *w)
+{
+	return graph_data_end(&w->gdata);
+}
+
+WESGR_EXPORT int
+wesgr_parse_file(struct wesgr *w, const char *filename)
+{
+	char buf[READ_CHUNK_SIZE];
+	size_t len;
+	FILE *fp;
+	int ret = 0;
+
+	if (strcmp(filename, "-") == 0)
+		fp = stdin;
+	else
+		fp = fopen(filename, "r");
+	if (!fp)
+		return ERROR;
+
+	if (w->pipelined) {
+		ret = parse_pipeline_run(&w->ctx, fp);
+	} else {
+		while (ret == 0 &&
+		       (len = fread(buf, 1, sizeof buf, fp)) > 0)
+			ret = wesgr_feed(w, buf, len);
+
+		if (ferror(fp))
+			ret = ERROR;
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+
+	if (ret < 0)
+		return -1;
+
+	return wesgr_finish(w);
+}
+
+static struct output_graph *
+wesgr_get_output(struct wesgr *w, unsigned index)
+{
+	struct output_graph *og;
+
+	for (og = w->gdata.output; og && index > 0; og = og->next)
+		index--;
+
+	return og;
+}
+
+WESGR_EXPORT unsigned
+wesgr_output_count(struct wesgr *w)
+{
+	struct output_graph *og;
+	unsigned n = 0;
+
+	for (og = w->gdata.output; og; og = og->next)
+		n++;
+
+	return n;
+}
+
+WESGR_EXPORT int
+wesgr_output_get_info(struct wesgr *w, unsigned index,
+		      struct wesgr_output_info *info)
+{
+	struct output_graph *og = wesgr_get_output(w, index);
+
+	if (!og)
+		return -1;
+
+	info->name = output_graph_name(og);
+	info->refresh_period = og->misses.refresh.period;
+	info->frames = og->misses.frames;
+	info->missed_frames = og->misses.missed_frames;
+
+	return 0;
+}
+
+WESGR_EXPORT int
+wesgr_output_get_stats(struct wesgr *w, unsigned index, const char *name,
+		       struct wesgr_stats *stats)
+{
+	struct output_graph *og = wesgr_get_output(w, index);
+	struct histogram *h;
+
+	if (!og)
+		return -1;
+
+	h = output_graph_get_histogram(og, name);
+	if (!h)
+		return -1;
+
+	stats->count = h->count;
+	stats->mean = histogram_mean(h);
+	stats->p50 = histogram_quantile(h, 0.50);
+	stats->p90 = histogram_quantile(h, 0.90);
+	stats->p99 = histogram_quantile(h, 0.99);
+	stats->max = h->count ? h->max : 0;
+
+	return 0;
+}
+
+WESGR_EXPORT int
+wesgr_write_svg(struct wesgr *w, const char *filename, int from_ms, int to_ms)
+{
+	struct svg_options opts = {
+		.from_ms = from_ms,
+		.to_ms = to_ms,
+	};
+
+	return graph_data_to_svg(&w->gdata, &opts, filename);
+}
+
+WESGR_EXPORT int
+wesgr_write_report(struct wesgr *w, const char *filename, int json)
+{
+	return graph_data_to_report(&w->gdata, filename,
+				    json ? REPORT_JSON : REPORT_TEXT);
+}
+
+WESGR_EXPORT int
+wesgr_write_trace(struct wesgr *w, const char *filename)
+{
+	return graph_data_to_trace_json(&w->gdata, filename);
+}
+
+WESGR_EXPORT int
+wesgr_write_arrow(struct wesgr *w, const char *dir)
+{
+	return graph_data_to_arrow(&w->gdata, dir);
+}
+
+void
+generic_error(const char *file, int line, const char *func)
+{
+	fprintf(stderr, "Error in %s(), %s:%d\n", func, file, line);
+}
+
+struct graph_data *
+wesgr_get_graph_data(struct wesgr *w)
+{
+	return &w->gdata;
+}
+
+struct parse_context *
+wesgr_get_parse_context(struct wesgr *w)
+{
+	return &w->ctx;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBWESGR_H
+#define LIBWESGR_H
+
+/*
+ * libwesgr: parsing and analysis of Weston timeline logs in process.
+ *
+ * Create a context, feed it the log in pieces of any size as it is
+ * read, and call wesgr_finish() at the end. Callbacks report repaint
+ * intervals and vblanks as soon as they are complete, and the results
+ * can be queried or written out after finishing.
+ *
+ * Times are nanoseconds on the clock of the log, CLOCK_MONOTONIC for
+ * Weston. Functions returning int return 0 on success and -1 on error.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WESGR_API_VERSION 1
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define WESGR_EXPORT __attribute__((visibility("default")))
+#else
+#define WESGR_EXPORT
+#endif
+
+struct wesgr;
+
+/* Keep aggregate statistics only, in memory that does not grow. */
+#define WESGR_STREAMING (1u << 0)
+
+/*
+ * Parse files on the calling thread only. By default, on a machine with
+ * more than one CPU, wesgr_parse_file() reads and tokenizes on threads
+ * of its own, while callbacks are still called on the calling thread.
+ */
+#define WESGR_SERIAL (1u << 1)
+
+struct wesgr_callbacks {
+	/*
+	 * A block of a lane closed: "delay_line", "submit_line",
+	 * "gpu_line", "renderer_gpu_line" or "not_looping".
+	 */
+	void (*interval)(void *data, const char *output, const char *lane,
+			 uint64_t begin, uint64_t end);
+
+	/* A vblank, after missing the given number of refresh periods */
+	void (*vblank)(void *data, const char *output, uint64_t time,
+		       unsigned missed);
+};
+
+struct wesgr_output_info {
+	const char *name;
+	uint64_t refresh_period;
+	uint64_t frames;
+	uint64_t missed_frames;
+};
+
+struct wesgr_stats {
+	uint64_t count;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t max;
+};
+
+/* cb may be NULL, and is copied. */
+WESGR_EXPORT struct wesgr *
+wesgr_create(const struct wesgr_callbacks *cb, void *data, uint32_t flags);
+
+WESGR_EXPORT void
+wesgr_destroy(struct wesgr *w);
+
+/* Drops graph data older than nsec behind the latest event, 0 keeps all. */
+WESGR_EXPORT int
+wesgr_set_retention(struct wesgr *w, uint64_t nsec);
+
+/*
+ * Keeps only the output of the given name, and the surfaces with a
+ * description matching the POSIX extended regular expression surface.
+ * Either may be NULL for all. Events of the others are dropped as they
+ * are parsed. Set before feeding; fails on a bad expression.
+ */
+WESGR_EXPORT int
+wesgr_set_filter(struct wesgr *w, const char *output, const char *surface);
+
+WESGR_EXPORT int
+wesgr_feed(struct wesgr *w, const void *buf, size_t len);
+
+WESGR_EXPORT int
+wesgr_finish(struct wesgr *w);
+
+/* Feeds and finishes a whole file, '-' for standard input. */
+WESGR_EXPORT int
+wesgr_parse_file(struct wesgr *w, const char *filename);
+
+WESGR_EXPORT unsigned
+wesgr_output_count(struct wesgr *w);
+
+/* The strings are valid until wesgr_destroy(). */
+WESGR_EXPORT int
+wesgr_output_get_info(struct wesgr *w, unsigned index,
+		      struct wesgr_output_info *info);
+
+/*
+ * Durations of a lane, as named for the interval callback but
+ * "not_looping", or of "vblank_interval".
+ */
+WESGR_EXPORT int
+wesgr_output_get_stats(struct wesgr *w, unsigned index, const char *name,
+		       struct wesgr_stats *stats);
+
+/* from_ms and to_ms are from the beginning of the log, or -1 for all. */
+WESGR_EXPORT int
+wesgr_write_svg(struct wesgr *w, const char *filename, int from_ms, int to_ms);
+
+WESGR_EXPORT int
+wesgr_write_report(struct wesgr *w, const char *filename, int json);
+
+WESGR_EXPORT int
+wesgr_write_trace(struct wesgr *w, const char *filename);
+
+/* Writes the graph as Arrow IPC files of tables into dir. */
+WESGR_EXPORT int
+wesgr_write_arrow(struct wesgr *w, const char *dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBWESGR_H */
@@ -117,6 +117,47 @@ parse_context_init(struct parse_context *ctx, struct graph_data *gdata)
 {
 	lookup_table_init(&ctx->idmap);
 	ctx->gdata = gdata;
+	ctx->prof = NULL;
+	memset(&ctx->filter, 0, sizeof ctx->filter);
+
+	return 0;
+}
+
+static void
+parse_filter_release(struct parse_filter *filter)
+{
+	free(filter->output);
+	if (filter->has_surface)
+		regfree(&filter->surface);
+
+	memset(filter, 0, sizeof *filter);
+}
+
+/*
+ * Graphs only the output called output, and the surfaces with a
+ * description matching the extended regular expression surface. Either
+ * can be NULL for all. Only infos parsed after this are filtered.
+ */
+int
+parse_context_set_filter(struct parse_context *ctx, const char *output,
+			 const char *surface)
+{
+	struct parse_filter *filter = &ctx->filter;
+
+	parse_filter_release(filter);
+
+	if (surface) {
+		if (regcomp(&filter->surface, surface,
+			    REG_EXTENDED | REG_NOSUB) != 0)
+			return -1;
+		filter->has_surface = 1;
+	}
+
+	if (output) {
+		filter->output = strdup(output);
+		if (!filter->output)
+			return ERROR;
+	}
 
 	return 0;
 }
@@ -157,6 +198,19 @@ parse_context_release(struct parse_context *ctx)
 {
 	lookup_table_for_each(&ctx->idmap, free_item, NULL);
 	lookup_table_release(&ctx->idmap);
+	parse_filter_release(&ctx->filter);
+}
+
+void
+parse_context_for_each_object(struct parse_context *ctx,
+			      void (*func)(struct object_info *oi, void *data),
+			      void *data)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->idmap.alloc; i++)
+		if (ctx->idmap.array[i])
+			func(ctx->idmap.array[i], data);
 }
 
 static struct object_info *
@@ -237,6 +291,9 @@ parse_weston_output(struct parse_context *ctx, struct object_info *oi)
 		return ERROR;
 
 	oi->info.wo.name = json_object_get_string(name_jobj);
+	oi->excluded = ctx->filter.output &&
+		       (!oi->info.wo.name ||
+			strcmp(oi->info.wo.name, ctx->filter.output) != 0);
 
 	return 0;
 }
@@ -284,6 +341,10 @@ parse_weston_surface(struct parse_context *ctx, struct object_info *oi)
 	if (!oi->info.ws.description)
 		return ERROR;
 
+	oi->excluded = ctx->filter.has_surface &&
+		       regexec(&ctx->filter.surface, oi->info.ws.description,
+			       0, NULL, 0) != 0;
+
 	return 0;
 }
 
@@ -371,52 +432,180 @@ parse_timespec(struct timespec *ts_out, struct json_object *jobj)
 	return 0;
 }
 
+static void
+profile_count_object(struct parse_context *ctx, struct json_object *jobj,
+		     const char *member)
+{
+	struct json_object *mem_jobj;
+	struct object_info *oi;
+	unsigned id;
+
+	if (!json_object_object_get_ex(jobj, member, &mem_jobj) ||
+	    parse_id(&id, mem_jobj) < 0)
+		return;
+
+	oi = lookup_table_get(&ctx->idmap, id);
+	if (oi)
+		oi->events++;
+}
+
+/* Calls the i-th handler of tp_handler_list, and counts what it took. */
 static int
-parse_context_process_timepoint(struct parse_context *ctx,
-				struct json_object *jobj,
-				struct json_object *T_jobj)
+profile_timepoint(struct parse_context *ctx, unsigned i,
+		  const struct timespec *ts, struct json_object *jobj)
+{
+	uint64_t since;
+	int ret;
+
+	since = profile_now();
+	ret = tp_handler_list[i].func(ctx, ts, jobj);
+	profile_counter_add(&ctx->prof->handler[i], since);
+
+	return ret;
+}
+
+static void
+decode_timepoint(struct decoded_event *ev, struct json_object *T_jobj)
 {
-	struct timespec ts;
 	struct json_object *name_jobj;
 	const char *name;
 	unsigned i;
 
-	if (parse_timespec(&ts, T_jobj) < 0)
-		return ERROR;
+	ev->handler = DECODED_INVALID;
 
-	if (!json_object_object_get_ex(jobj, "N", &name_jobj))
-		return ERROR;
+	if (parse_timespec(&ev->ts, T_jobj) < 0)
+		return;
+
+	if (!json_object_object_get_ex(ev->jobj, "N", &name_jobj))
+		return;
 
 	if (!json_object_is_type(name_jobj, json_type_string))
-		return ERROR;
+		return;
 
-	graph_data_time(ctx->gdata, &ts);
+	ev->handler = DECODED_UNHANDLED;
 	name = json_object_get_string(name_jobj);
-	for (i = 0; tp_handler_list[i].tp_name; i++)
-		if (strcmp(tp_handler_list[i].tp_name, name) == 0)
-			return tp_handler_list[i].func(ctx, &ts, jobj);
+	for (i = 0; tp_handler_list[i].tp_name; i++) {
+		if (strcmp(tp_handler_list[i].tp_name, name) == 0) {
+			ev->handler = i;
+			return;
+		}
+	}
+}
 
-	fprintf(stderr, "unhandled timepoint '%s'\n", name);
+/*
+ * Classifies a JSON object of the log and finds its handler. This does
+ * not touch the parse context, so it can run on another thread than
+ * parse_context_dispatch().
+ */
+void
+parse_context_decode(struct json_object *jobj, struct decoded_event *ev)
+{
+	struct json_object *key_obj;
 
-	return 0;
+	ev->jobj = jobj;
+	ev->key = NULL;
+	ev->handler = DECODED_INVALID;
+
+	if (!json_object_is_type(jobj, json_type_object))
+		return;
+
+	if (json_object_object_get_ex(jobj, "id", &key_obj)) {
+		ev->key = key_obj;
+		ev->handler = DECODED_INFO;
+		return;
+	}
+
+	if (json_object_object_get_ex(jobj, "T", &key_obj))
+		decode_timepoint(ev, key_obj);
 }
 
+/*
+ * What is done for every timepoint in the order of the log, before its
+ * handler is called. Returns whether it has a handler to call.
+ */
 int
-parse_context_process_object(struct parse_context *ctx,
-			     struct json_object *jobj)
+parse_context_begin_timepoint(struct parse_context *ctx,
+			      const struct decoded_event *ev)
 {
-	struct json_object *key_obj;
+	struct json_object *name_jobj;
+	struct object_info *output;
 
-	if (!json_object_is_type(jobj, json_type_object))
+	graph_data_time(ctx->gdata, &ev->ts);
+
+	if (ev->handler >= 0) {
+		if (ctx->prof) {
+			profile_count_object(ctx, ev->jobj, "wo");
+			profile_count_object(ctx, ev->jobj, "ws");
+		}
+
+		/* filtered out surfaces are left to the handlers */
+		output = find_object_info(ctx, ev->jobj, "wo");
+
+		return !output || !output->excluded;
+	}
+
+	if (ctx->prof)
+		ctx->prof->phase[PROFILE_UNHANDLED].count++;
+
+	json_object_object_get_ex(ev->jobj, "N", &name_jobj);
+	fprintf(stderr, "unhandled timepoint '%s'\n",
+		json_object_get_string(name_jobj));
+
+	return 0;
+}
+
+static int
+parse_context_process_timepoint(struct parse_context *ctx,
+				const struct decoded_event *ev)
+{
+	if (!parse_context_begin_timepoint(ctx, ev))
+		return 0;
+
+	if (ctx->prof)
+		return profile_timepoint(ctx, ev->handler, &ev->ts, ev->jobj);
+
+	return tp_handler_list[ev->handler].func(ctx, &ev->ts, ev->jobj);
+}
+
+static int
+profile_info(struct parse_context *ctx, struct json_object *jobj,
+	     struct json_object *id_jobj)
+{
+	uint64_t since = profile_now();
+	int ret;
+
+	ret = parse_context_process_info(ctx, jobj, id_jobj);
+	profile_counter_add(&ctx->prof->phase[PROFILE_INFO], since);
+
+	return ret;
+}
+
+int
+parse_context_dispatch(struct parse_context *ctx,
+		       const struct decoded_event *ev)
+{
+	switch (ev->handler) {
+	case DECODED_INVALID:
 		return ERROR;
+	case DECODED_INFO:
+		if (ctx->prof)
+			return profile_info(ctx, ev->jobj, ev->key);
 
-	if (json_object_object_get_ex(jobj, "id", &key_obj))
-		return parse_context_process_info(ctx, jobj, key_obj);
+		return parse_context_process_info(ctx, ev->jobj, ev->key);
+	default:
+		return parse_context_process_timepoint(ctx, ev);
+	}
+}
 
-	if (json_object_object_get_ex(jobj, "T", &key_obj))
-		return parse_context_process_timepoint(ctx, jobj, key_obj);
+int
+parse_context_process_object(struct parse_context *ctx,
+			     struct json_object *jobj)
+{
+	struct decoded_event ev;
 
-	return ERROR;
+	parse_context_decode(jobj, &ev);
+
+	return parse_context_dispatch(ctx, &ev);
 }
 
 struct object_info *
@@ -437,6 +626,20 @@ get_object_info_from_timepoint(struct parse_context *ctx,
 	return lookup_table_get(&ctx->idmap, id);
 }
 
+/* Like get_object_info_from_timepoint(), but quiet when there is none */
+struct object_info *
+find_object_info(struct parse_context *ctx, struct json_object *jobj,
+		 const char *member)
+{
+	struct json_object *mem_jobj;
+
+	if (!json_object_object_get_ex(jobj, member, &mem_jobj) ||
+	    !json_object_is_type(mem_jobj, json_type_int))
+		return NULL;
+
+	return lookup_table_get(&ctx->idmap, json_object_get_int64(mem_jobj));
+}
+
 struct timespec
 get_timespec_from_timepoint(struct parse_context *ctx,
 			    struct json_object *jobj, const char *member)
@@ -0,0 +1,961 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Parsing of a whole file in three stages, each on its own thread: the
+ * reader reads chunks of the file and cuts them at object boundaries
+ * found by the structural scanner, the tokenizer turns each object into
+ * JSON and decodes it, and the calling thread dispatches the decoded
+ * events to the handlers. The stages are connected by
+ * single-producer single-consumer rings, which bound the memory in
+ * flight: a full ring stalls the stage before it.
+ *
+ * The handlers of the timepoints of each output only touch that output,
+ * so the dispatcher shards them by output over worker threads, the
+ * calling thread being one of them. It keeps the object infos and the
+ * surface state to itself: core_commit_damage and core_flush_damage
+ * run their surface part on the dispatcher, which hands the rest over to
+ * the output in order with its other timepoints. Object infos, and
+ * evicting old nodes of all outputs, wait for the workers to go idle.
+ * With library callbacks, everything stays on the calling thread, in
+ * the order of the file.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <json.h>
+
+#include "wesgr.h"
+
+#define PIPE_CHUNK_SIZE 65536
+#define PIPE_CHUNK_OBJECTS 1024
+#define PIPE_CHUNKS 8		/* in flight between reader and tokenizer */
+#define PIPE_BATCH_SIZE 256
+#define PIPE_BATCHES 16		/* in flight between tokenizer and handlers */
+
+/* Polls of an empty or full ring before sleeping on it */
+#define RING_SPINS 64
+
+#define SHARD_MAX 8		/* handler threads, the calling one included */
+#define SHARD_BATCH_SIZE 128
+#define SHARD_BATCHES 8		/* in flight to each worker */
+
+/*
+ * A ring of pointers. Only one side can be waiting at a time, as the
+ * ring cannot be both empty and full, and it sleeps on the condition
+ * only after announcing itself in waiting, so the other side knows to
+ * wake it up.
+ */
+struct spsc_ring {
+	void *slot[PIPE_BATCHES];
+	unsigned size;		/* a power of two, up to PIPE_BATCHES */
+	atomic_uint head;	/* next slot to write */
+	atomic_uint tail;	/* next slot to read */
+	atomic_int waiting;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/* Whole objects, and whatever follows the last one at the end of file */
+struct pipe_chunk {
+	size_t len;
+	size_t alloc;
+	unsigned count;
+	size_t ends[PIPE_CHUNK_OBJECTS];	/* of the objects in data */
+	char data[];
+};
+
+struct pipe_batch {
+	unsigned count;
+	struct decoded_event ev[PIPE_BATCH_SIZE];
+};
+
+/* A timepoint for one output, or its part of a surface timepoint */
+struct shard_event {
+	int handler;		/* index into tp_handler_list */
+	struct timespec ts;
+	struct json_object *jobj;	/* owned, or NULL for a handoff */
+	struct surface_handoff handoff;
+};
+
+struct shard_batch {
+	unsigned count;
+	struct shard_event ev[SHARD_BATCH_SIZE];
+};
+
+/* A worker thread, handling the timepoints of the outputs it owns */
+struct shard {
+	struct parse_context *ctx;
+	pthread_t thread;
+	struct spsc_ring todo;		/* of struct shard_batch, NULL ends */
+	struct spsc_ring done;		/* handled batches, for reuse */
+	atomic_int *never;		/* a cancel flag never set */
+	struct profile_counter *handler;	/* as tp_handler_list */
+	atomic_int error;
+
+	/* of the dispatcher */
+	struct shard_batch *batch;	/* being filled */
+	struct shard_batch *spare[SHARD_BATCHES];
+	unsigned spares;
+	unsigned allocated;
+};
+
+struct shard_route {
+	struct output_graph *og;
+	unsigned shard;
+};
+
+struct dispatcher {
+	struct parse_context *ctx;
+	struct shard *shard[SHARD_MAX];	/* 0 is the calling thread */
+	unsigned shards;
+	struct shard_route *route;	/* of every output seen */
+	unsigned routes;
+	atomic_int never;
+};
+
+struct pipeline {
+	struct parse_context *ctx;
+	FILE *fp;
+	struct spsc_ring chunks;	/* of struct pipe_chunk, NULL ends */
+	struct spsc_ring batches;	/* of struct pipe_batch, NULL ends */
+	atomic_int cancel;
+	int read_error;
+	int parse_error;
+};
+
+static void
+spsc_ring_init(struct spsc_ring *ring, unsigned size)
+{
+	memset(ring->slot, 0, sizeof ring->slot);
+	ring->size = size;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->waiting, 0);
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+}
+
+static void
+spsc_ring_release(struct spsc_ring *ring)
+{
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->cond);
+}
+
+static int
+spsc_ring_can_push(struct spsc_ring *ring)
+{
+	return atomic_load(&ring->head) - atomic_load(&ring->tail) <
+	       ring->size;
+}
+
+static int
+spsc_ring_can_pop(struct spsc_ring *ring)
+{
+	return atomic_load(&ring->head) != atomic_load(&ring->tail);
+}
+
+/* Returns -1 if the pipeline was cancelled while waiting. */
+static int
+spsc_ring_wait(struct spsc_ring *ring, int (*ready)(struct spsc_ring *),
+	       atomic_int *cancel)
+{
+	unsigned i;
+
+	for (i = 0; i < RING_SPINS; i++) {
+		if (ready(ring))
+			return 0;
+		sched_yield();
+	}
+
+	pthread_mutex_lock(&ring->lock);
+	atomic_store(&ring->waiting, 1);
+	while (!ready(ring) && !atomic_load(cancel))
+		pthread_cond_wait(&ring->cond, &ring->lock);
+	atomic_store(&ring->waiting, 0);
+	pthread_mutex_unlock(&ring->lock);
+
+	return ready(ring) ? 0 : -1;
+}
+
+static void
+spsc_ring_wake(struct spsc_ring *ring)
+{
+	if (!atomic_load(&ring->waiting))
+		return;
+
+	pthread_mutex_lock(&ring->lock);
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+static int
+spsc_ring_push(struct spsc_ring *ring, void *item, atomic_int *cancel)
+{
+	unsigned head;
+
+	if (!spsc_ring_can_push(ring) &&
+	    spsc_ring_wait(ring, spsc_ring_can_push, cancel) < 0)
+		return -1;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	ring->slot[head & (ring->size - 1)] = item;
+	atomic_store(&ring->head, head + 1);
+	spsc_ring_wake(ring);
+
+	return 0;
+}
+
+static int
+spsc_ring_pop(struct spsc_ring *ring, void **item, atomic_int *cancel)
+{
+	unsigned tail;
+
+	if (!spsc_ring_can_pop(ring) &&
+	    spsc_ring_wait(ring, spsc_ring_can_pop, cancel) < 0)
+		return -1;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	*item = ring->slot[tail & (ring->size - 1)];
+	atomic_store(&ring->tail, tail + 1);
+	spsc_ring_wake(ring);
+
+	return 0;
+}
+
+static void
+pipeline_cancel(struct pipeline *p)
+{
+	atomic_store(&p->cancel, 1);
+
+	pthread_mutex_lock(&p->chunks.lock);
+	pthread_cond_broadcast(&p->chunks.cond);
+	pthread_mutex_unlock(&p->chunks.lock);
+
+	pthread_mutex_lock(&p->batches.lock);
+	pthread_cond_broadcast(&p->batches.cond);
+	pthread_mutex_unlock(&p->batches.lock);
+}
+
+static void
+pipe_batch_destroy(struct pipe_batch *batch)
+{
+	unsigned i;
+
+	for (i = 0; i < batch->count; i++)
+		json_object_put(batch->ev[i].jobj);
+
+	free(batch);
+}
+
+static struct pipe_chunk *
+pipe_chunk_create(size_t alloc)
+{
+	struct pipe_chunk *chunk;
+
+	chunk = malloc(sizeof *chunk + alloc);
+	if (!chunk)
+		return ERROR_NULL;
+
+	chunk->len = 0;
+	chunk->alloc = alloc;
+	chunk->count = 0;
+
+	return chunk;
+}
+
+/* Moves what follows the last whole object of chunk to a new chunk. */
+static struct pipe_chunk *
+pipe_chunk_split(struct pipe_chunk *chunk)
+{
+	size_t last = chunk->ends[chunk->count - 1];
+	size_t rest = chunk->len - last;
+	struct pipe_chunk *next;
+
+	next = pipe_chunk_create(rest < PIPE_CHUNK_SIZE ?
+				 PIPE_CHUNK_SIZE : rest * 2);
+	if (!next)
+		return NULL;
+
+	memcpy(next->data, chunk->data + last, rest);
+	next->len = rest;
+	chunk->len = last;
+
+	return next;
+}
+
+/* Finds the objects that end in the unscanned part of a chunk. */
+static void
+pipe_chunk_scan(struct pipe_chunk *chunk, struct json_scanner *scanner,
+		size_t *scanned)
+{
+	size_t found, done;
+	unsigned i;
+
+	while (*scanned < chunk->len) {
+		found = json_scanner_scan(scanner, chunk->data + *scanned,
+					  chunk->len - *scanned,
+					  chunk->ends + chunk->count,
+					  PIPE_CHUNK_OBJECTS - chunk->count,
+					  &done);
+		for (i = 0; i < found; i++)
+			chunk->ends[chunk->count + i] += *scanned;
+		chunk->count += found;
+		*scanned += done;
+
+		/* no room for more objects */
+		if (done == 0)
+			return;
+	}
+}
+
+static void *
+pipeline_read(void *data)
+{
+	struct pipeline *p = data;
+	struct json_scanner scanner;
+	struct pipe_chunk *chunk, *next;
+	size_t scanned = 0;	/* bytes of chunk seen by the scanner */
+	size_t len;
+
+	json_scanner_init(&scanner);
+	chunk = pipe_chunk_create(PIPE_CHUNK_SIZE);
+	if (!chunk)
+		goto err;
+
+	while (!atomic_load(&p->cancel)) {
+		/* an object larger than the chunk */
+		if (chunk->len == chunk->alloc) {
+			next = realloc(chunk, sizeof *chunk + chunk->alloc * 2);
+			if (!next)
+				goto err;
+			chunk = next;
+			chunk->alloc *= 2;
+		}
+
+		len = fread(chunk->data + chunk->len, 1,
+			    chunk->alloc - chunk->len, p->fp);
+		if (len == 0) {
+			if (ferror(p->fp))
+				goto err;
+			break;
+		}
+
+		chunk->len += len;
+		pipe_chunk_scan(chunk, &scanner, &scanned);
+
+		/* filled up with data, or with objects */
+		if (chunk->count == 0 ||
+		    (chunk->len < chunk->alloc && scanned == chunk->len))
+			continue;
+
+		next = pipe_chunk_split(chunk);
+		if (!next)
+			goto err;
+		scanned -= chunk->len;
+
+		if (spsc_ring_push(&p->chunks, chunk, &p->cancel) < 0) {
+			free(chunk);
+			free(next);
+			return NULL;
+		}
+		chunk = next;
+	}
+
+	if (chunk->len > 0 &&
+	    spsc_ring_push(&p->chunks, chunk, &p->cancel) == 0)
+		chunk = NULL;
+	free(chunk);
+
+	spsc_ring_push(&p->chunks, NULL, &p->cancel);
+
+	return NULL;
+
+err:
+	free(chunk);
+	p->read_error = ERROR;
+	spsc_ring_push(&p->chunks, NULL, &p->cancel);
+
+	return NULL;
+}
+
+static void
+profile_tokenize_end(struct parse_context *ctx, uint64_t since)
+{
+	if (ctx->prof)
+		profile_counter_add(&ctx->prof->phase[PROFILE_TOKENIZE], since);
+}
+
+/*
+ * Tokenizes len bytes into batches, usually exactly one object. Returns
+ * -1 on error or cancel.
+ */
+static int
+pipeline_tokenize_span(struct pipeline *p, struct json_tokener *jtok,
+		       const char *pos, size_t len, struct pipe_batch **batch)
+{
+	struct parse_context *ctx = p->ctx;
+	const char *end = pos + len;
+	struct json_object *jobj;
+	enum json_tokener_error jerr;
+	uint64_t since = 0;
+
+	while (1) {
+		if (ctx->prof)
+			since = profile_now();
+
+		jobj = json_tokener_parse_ex(jtok, pos, end - pos);
+		jerr = json_tokener_get_error(jtok);
+		if (!jobj && jerr == json_tokener_continue) {
+			profile_tokenize_end(ctx, since);
+			return 0;
+		}
+
+		if (!jobj) {
+			fprintf(stderr, "JSON parse failure: %d\n", jerr);
+			return -1;
+		}
+
+		pos += jtok->char_offset;
+		parse_context_decode(jobj, &(*batch)->ev[(*batch)->count++]);
+		profile_tokenize_end(ctx, since);
+
+		if ((*batch)->count == PIPE_BATCH_SIZE) {
+			if (spsc_ring_push(&p->batches, *batch,
+					   &p->cancel) < 0)
+				return -1;
+
+			*batch = calloc(1, sizeof **batch);
+			if (!*batch)
+				return ERROR;
+		}
+
+		if (pos == end)
+			return 0;
+	}
+}
+
+static int
+pipeline_tokenize_chunk(struct pipeline *p, struct json_tokener *jtok,
+			const struct pipe_chunk *chunk,
+			struct pipe_batch **batch)
+{
+	size_t start = 0;
+	unsigned i;
+
+	for (i = 0; i < chunk->count; i++) {
+		if (pipeline_tokenize_span(p, jtok, chunk->data + start,
+					   chunk->ends[i] - start, batch) < 0)
+			return -1;
+		start = chunk->ends[i];
+	}
+
+	if (start == chunk->len)
+		return 0;
+
+	return pipeline_tokenize_span(p, jtok, chunk->data + start,
+				      chunk->len - start, batch);
+}
+
+static void *
+pipeline_tokenize(void *data)
+{
+	struct pipeline *p = data;
+	struct json_tokener *jtok;
+	struct pipe_chunk *chunk;
+	struct pipe_batch *batch;
+
+	jtok = json_tokener_new();
+	batch = calloc(1, sizeof *batch);
+	if (!jtok || !batch) {
+		p->parse_error = ERROR;
+		goto out;
+	}
+
+	while (spsc_ring_pop(&p->chunks, (void **)&chunk, &p->cancel) == 0 &&
+	       chunk) {
+		if (p->ctx->prof)
+			p->ctx->prof->bytes += chunk->len;
+
+		if (pipeline_tokenize_chunk(p, jtok, chunk, &batch) < 0)
+			p->parse_error = -1;
+		free(chunk);
+
+		if (p->parse_error < 0)
+			break;
+	}
+
+	/* the events before an error are still handled, as when serial */
+	if (batch->count > 0 &&
+	    spsc_ring_push(&p->batches, batch, &p->cancel) == 0)
+		batch = NULL;
+
+out:
+	if (batch)
+		pipe_batch_destroy(batch);
+	if (jtok)
+		json_tokener_free(jtok);
+
+	spsc_ring_push(&p->batches, NULL, &p->cancel);
+
+	return NULL;
+}
+
+static void
+shard_event_run(struct shard *s, struct shard_event *ev)
+{
+	const struct tp_handler_item *item = &tp_handler_list[ev->handler];
+	uint64_t since = 0;
+	int ret = 0;
+
+	if (s->handler)
+		since = profile_now();
+
+	/* after an error, handoffs still run so that nothing is lost */
+	if (item->surface)
+		ret = surface_handoff_run(&ev->handoff);
+	else if (atomic_load_explicit(&s->error, memory_order_relaxed) == 0)
+		ret = item->func(s->ctx, &ev->ts, ev->jobj);
+
+	/* surface timepoints were counted by the dispatcher */
+	if (s->handler && item->surface)
+		s->handler[ev->handler].nsec += profile_now() - since;
+	else if (s->handler)
+		profile_counter_add(&s->handler[ev->handler], since);
+
+	if (ret < 0)
+		atomic_store(&s->error, -1);
+
+	json_object_put(ev->jobj);
+}
+
+static void *
+shard_run(void *data)
+{
+	struct shard *s = data;
+	struct shard_batch *batch;
+	unsigned i;
+
+	while (spsc_ring_pop(&s->todo, (void **)&batch, s->never) == 0 &&
+	       batch) {
+		for (i = 0; i < batch->count; i++)
+			shard_event_run(s, &batch->ev[i]);
+
+		batch->count = 0;
+		spsc_ring_push(&s->done, batch, s->never);
+	}
+
+	return NULL;
+}
+
+static void
+shard_destroy(struct shard *s)
+{
+	unsigned i;
+
+	for (i = 0; i < s->spares; i++)
+		free(s->spare[i]);
+
+	spsc_ring_release(&s->todo);
+	spsc_ring_release(&s->done);
+	free(s->handler);
+	free(s);
+}
+
+static struct shard *
+shard_create(struct dispatcher *d)
+{
+	struct profile *prof = d->ctx->prof;
+	struct shard *s;
+
+	s = calloc(1, sizeof *s);
+	if (!s)
+		return ERROR_NULL;
+
+	s->ctx = d->ctx;
+	s->never = &d->never;
+	atomic_init(&s->error, 0);
+	spsc_ring_init(&s->todo, SHARD_BATCHES);
+	spsc_ring_init(&s->done, SHARD_BATCHES);
+
+	if (prof) {
+		s->handler = calloc(prof->handler_count, sizeof *s->handler);
+		if (!s->handler)
+			goto err;
+	}
+
+	if (pthread_create(&s->thread, NULL, shard_run, s) != 0)
+		goto err;
+
+	return s;
+
+err:
+	shard_destroy(s);
+
+	return ERROR_NULL;
+}
+
+/* An empty batch, waiting for the worker to hand one back if need be */
+static struct shard_batch *
+shard_get_batch(struct shard *s)
+{
+	struct shard_batch *batch;
+
+	if (s->spares > 0)
+		return s->spare[--s->spares];
+
+	if (s->allocated < SHARD_BATCHES) {
+		batch = calloc(1, sizeof *batch);
+		if (!batch)
+			return ERROR_NULL;
+
+		s->allocated++;
+		return batch;
+	}
+
+	if (spsc_ring_pop(&s->done, (void **)&batch, s->never) < 0)
+		return NULL;
+
+	return batch;
+}
+
+static void
+shard_flush(struct shard *s)
+{
+	if (!s->batch)
+		return;
+
+	spsc_ring_push(&s->todo, s->batch, s->never);
+	s->batch = NULL;
+}
+
+/* Returns -1 if the worker failed on an earlier timepoint. */
+static int
+shard_post(struct shard *s, const struct shard_event *ev)
+{
+	if (!s->batch) {
+		s->batch = shard_get_batch(s);
+		if (!s->batch)
+			return -1;
+	}
+
+	s->batch->ev[s->batch->count++] = *ev;
+	if (s->batch->count == SHARD_BATCH_SIZE)
+		shard_flush(s);
+
+	return atomic_load(&s->error);
+}
+
+/* Waits for the workers to handle all they were given. */
+static int
+dispatcher_quiesce(struct dispatcher *d)
+{
+	struct shard *s;
+	unsigned i;
+	int ret = 0;
+
+	for (i = 1; i < d->shards; i++) {
+		s = d->shard[i];
+		if (!s)
+			continue;
+
+		shard_flush(s);
+		while (s->spares < s->allocated)
+			spsc_ring_pop(&s->done, (void **)&s->spare[s->spares++],
+				      s->never);
+
+		if (atomic_load(&s->error) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+static void
+dispatcher_init(struct dispatcher *d, struct parse_context *ctx)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	memset(d, 0, sizeof *d);
+	d->ctx = ctx;
+	d->shards = cpus < 1 ? 1 : cpus < SHARD_MAX ? cpus : SHARD_MAX;
+	atomic_init(&d->never, 0);
+
+	/* callbacks are promised in the order of the file */
+	if (ctx->gdata->hooks)
+		d->shards = 1;
+}
+
+/*
+ * Stops the workers, and adds up what they were timed at. Returns -1 if
+ * one of them failed.
+ */
+static int
+dispatcher_finish(struct dispatcher *d)
+{
+	struct profile *prof = d->ctx->prof;
+	struct shard *s;
+	unsigned i, j;
+	int ret = 0;
+
+	for (i = 1; i < d->shards; i++) {
+		s = d->shard[i];
+		if (!s)
+			continue;
+
+		shard_flush(s);
+		spsc_ring_push(&s->todo, NULL, s->never);
+		pthread_join(s->thread, NULL);
+
+		/* handled batches left in the ring */
+		while (spsc_ring_can_pop(&s->done))
+			spsc_ring_pop(&s->done, (void **)&s->spare[s->spares++],
+				      s->never);
+
+		if (atomic_load(&s->error) < 0)
+			ret = -1;
+
+		for (j = 0; prof && j < prof->handler_count; j++) {
+			prof->handler[j].count += s->handler[j].count;
+			prof->handler[j].nsec += s->handler[j].nsec;
+		}
+
+		shard_destroy(s);
+	}
+
+	free(d->route);
+
+	return ret;
+}
+
+/* The thread of an output, assigning the outputs in turn when first seen */
+static int
+dispatcher_route(struct dispatcher *d, struct output_graph *og)
+{
+	struct shard_route *route;
+	unsigned i, shard;
+
+	for (i = 0; i < d->routes; i++)
+		if (d->route[i].og == og)
+			return d->route[i].shard;
+
+	route = realloc(d->route, (d->routes + 1) * sizeof *route);
+	if (!route)
+		return ERROR;
+	d->route = route;
+
+	shard = d->routes % d->shards;
+	if (shard > 0 && !d->shard[shard]) {
+		d->shard[shard] = shard_create(d);
+		if (!d->shard[shard])
+			return -1;
+	}
+
+	d->route[d->routes].og = og;
+	d->route[d->routes].shard = shard;
+	d->routes++;
+
+	return shard;
+}
+
+/* Calls a handler or a surface part of one on this thread. */
+static int
+dispatcher_call(struct dispatcher *d, const struct decoded_event *ev,
+		struct surface_handoff *h)
+{
+	const struct tp_handler_item *item = &tp_handler_list[ev->handler];
+	struct profile *prof = d->ctx->prof;
+	uint64_t since = 0;
+	int ret;
+
+	if (prof)
+		since = profile_now();
+
+	if (h)
+		ret = item->surface(d->ctx, &ev->ts, ev->jobj, h);
+	else
+		ret = item->func(d->ctx, &ev->ts, ev->jobj);
+
+	if (prof)
+		profile_counter_add(&prof->handler[ev->handler], since);
+
+	return ret;
+}
+
+/*
+ * Like parse_context_dispatch(), but may leave the handler to a worker,
+ * taking ev->jobj along.
+ */
+static int
+dispatcher_dispatch(struct dispatcher *d, struct decoded_event *ev)
+{
+	struct shard_event sev = { .handler = ev->handler, .ts = ev->ts };
+	struct surface_handoff *h = &sev.handoff;
+	struct output_graph *og;
+	int shard, ret;
+
+	if (d->shards == 1)
+		return parse_context_dispatch(d->ctx, ev);
+
+	if (ev->handler == DECODED_INFO) {
+		if (dispatcher_quiesce(d) < 0)
+			return -1;
+
+		return parse_context_dispatch(d->ctx, ev);
+	}
+
+	if (ev->handler < 0)
+		return parse_context_dispatch(d->ctx, ev);
+
+	if (graph_data_evicts_at(d->ctx->gdata, &ev->ts) &&
+	    dispatcher_quiesce(d) < 0)
+		return -1;
+
+	if (!parse_context_begin_timepoint(d->ctx, ev))
+		return 0;
+
+	if (tp_handler_list[ev->handler].surface) {
+		ret = dispatcher_call(d, ev, h);
+		og = h->og;
+	} else {
+		/* fails in the handler, if the output is not known */
+		og = timepoint_output_graph(d->ctx, ev->jobj);
+		if (!og)
+			return dispatcher_call(d, ev, NULL);
+
+		sev.jobj = ev->jobj;
+		ret = 0;
+	}
+
+	if (!og)
+		return ret;
+
+	/* a new output is nobody's yet, even if routing it failed */
+	shard = dispatcher_route(d, og);
+	if (shard <= 0) {
+		if (sev.jobj)
+			ret = dispatcher_call(d, ev, NULL);
+		else if (surface_handoff_run(h) < 0)
+			ret = ERROR;
+
+		return shard < 0 ? -1 : ret;
+	}
+
+	if (sev.jobj)
+		ev->jobj = NULL;
+
+	if (shard_post(d->shard[shard], &sev) < 0)
+		return -1;
+
+	return ret;
+}
+
+/* Frees whatever the stages left in the rings after they stopped. */
+static void
+pipeline_drain(struct pipeline *p)
+{
+	unsigned i;
+
+	for (i = atomic_load(&p->chunks.tail);
+	     i != atomic_load(&p->chunks.head); i++)
+		free(p->chunks.slot[i & (p->chunks.size - 1)]);
+
+	for (i = atomic_load(&p->batches.tail);
+	     i != atomic_load(&p->batches.head); i++)
+		if (p->batches.slot[i & (p->batches.size - 1)])
+			pipe_batch_destroy(
+				p->batches.slot[i & (p->batches.size - 1)]);
+}
+
+/*
+ * Parses all of fp with the parse context, which must not be touched by
+ * others until this returns.
+ */
+int
+parse_pipeline_run(struct parse_context *ctx, FILE *fp)
+{
+	struct pipeline p = { .ctx = ctx, .fp = fp };
+	struct pipe_batch *batch;
+	struct dispatcher d;
+	pthread_t reader, tokenizer;
+	int ret = 0;
+	unsigned i;
+
+	dispatcher_init(&d, ctx);
+	atomic_init(&p.cancel, 0);
+	spsc_ring_init(&p.chunks, PIPE_CHUNKS);
+	spsc_ring_init(&p.batches, PIPE_BATCHES);
+
+	if (pthread_create(&reader, NULL, pipeline_read, &p) != 0) {
+		ret = ERROR;
+		goto out;
+	}
+
+	if (pthread_create(&tokenizer, NULL, pipeline_tokenize, &p) != 0) {
+		pipeline_cancel(&p);
+		pthread_join(reader, NULL);
+		ret = ERROR;
+		goto out;
+	}
+
+	while (spsc_ring_pop(&p.batches, (void **)&batch, &p.cancel) == 0 &&
+	       batch) {
+		for (i = 0; i < batch->count && ret == 0; i++) {
+			if (dispatcher_dispatch(&d, &batch->ev[i]) < 0) {
+				fprintf(stderr, "JSON interpretation error\n");
+				ret = -1;
+			}
+		}
+
+		pipe_batch_destroy(batch);
+
+		if (ret < 0)
+			break;
+	}
+
+	/* stops the reader, if the tokenizer stopped early */
+	pipeline_cancel(&p);
+	pthread_join(tokenizer, NULL);
+	pthread_join(reader, NULL);
+	pipeline_drain(&p);
+
+	if (dispatcher_finish(&d) < 0 && ret == 0) {
+		fprintf(stderr, "JSON interpretation error\n");
+		ret = -1;
+	}
+
+	if (p.read_error < 0 || p.parse_error < 0)
+		ret = -1;
+
+out:
+	spsc_ring_release(&p.chunks);
+	spsc_ring_release(&p.batches);
+
+	return ret;
+}
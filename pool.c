@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Chunked storage for the nodes of a graph set.
+ *
+ * Every node is pushed to the head of its set's list as soon as it is
+ * allocated, so the list runs from the newest to the oldest node in
+ * allocation order. The oldest node of a chunk therefore links to the
+ * newest node of the previous chunk, and a whole chunk of old nodes is
+ * dropped by cutting that one link.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "wesgr.h"
+
+#define NODES_PER_CHUNK 256
+
+struct node_chunk {
+	struct node_chunk *newer;
+	unsigned used;
+	_Alignas(max_align_t) char nodes[];	/* for any node struct */
+};
+
+void
+node_pool_init(struct node_pool *pool, size_t node_size, size_t next_offset,
+	       const struct timespec *(*node_time)(const void *node),
+	       void (*node_release)(void *node))
+{
+	memset(pool, 0, sizeof *pool);
+	pool->node_size = node_size;
+	pool->next_offset = next_offset;
+	pool->node_time = node_time;
+	pool->node_release = node_release;
+}
+
+static void *
+node_chunk_get(struct node_pool *pool, struct node_chunk *chunk, unsigned i)
+{
+	return chunk->nodes + (size_t)i * pool->node_size;
+}
+
+static void
+node_chunk_destroy(struct node_pool *pool, struct node_chunk *chunk)
+{
+	unsigned i;
+
+	if (pool->node_release)
+		for (i = 0; i < chunk->used; i++)
+			pool->node_release(node_chunk_get(pool, chunk, i));
+
+	free(chunk);
+}
+
+void
+node_pool_release(struct node_pool *pool)
+{
+	struct node_chunk *chunk, *tmp;
+
+	for (chunk = pool->oldest; chunk; chunk = tmp) {
+		tmp = chunk->newer;
+		node_chunk_destroy(pool, chunk);
+	}
+
+	pool->oldest = NULL;
+	pool->newest = NULL;
+}
+
+/*
+ * Drops the oldest chunks whose every node is from before horizon. The
+ * newest chunk is always kept, so the list head stays valid.
+ */
+void
+node_pool_evict(struct node_pool *pool, const struct timespec *horizon)
+{
+	struct node_chunk *chunk;
+	const struct timespec *ts;
+	void *first;
+
+	while (pool->oldest && pool->oldest != pool->newest) {
+		chunk = pool->oldest;
+		ts = pool->node_time(node_chunk_get(pool, chunk,
+						    chunk->used - 1));
+		if (!timespec_is_valid(ts) || timespec_cmp(ts, horizon) >= 0)
+			break;
+
+		first = node_chunk_get(pool, chunk->newer, 0);
+		*(void **)((char *)first + pool->next_offset) = NULL;
+
+		pool->oldest = chunk->newer;
+		pool->evicted += chunk->used;
+		node_chunk_destroy(pool, chunk);
+	}
+}
+
+/* Returns a zeroed node, which the caller must link to its list. */
+void *
+node_pool_alloc(struct node_pool *pool)
+{
+	struct node_chunk *chunk = pool->newest;
+	void *node;
+
+	if (!chunk || chunk->used == NODES_PER_CHUNK) {
+		chunk = calloc(1, sizeof *chunk +
+				  NODES_PER_CHUNK * pool->node_size);
+		if (!chunk)
+			return ERROR_NULL;
+
+		if (pool->newest)
+			pool->newest->newer = chunk;
+		else
+			pool->oldest = chunk;
+		pool->newest = chunk;
+	}
+
+	node = node_chunk_get(pool, chunk, chunk->used++);
+	pool->allocated++;
+
+	return node;
+}
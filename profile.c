@@ -0,0 +1,260 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Instrumentation of wesgr itself: what a recording contains, and where
+ * the time and memory go while graphing it. Nothing is measured unless
+ * a profile is attached to the parse context.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "wesgr.h"
+
+static const char * const profile_phase_names[] = {
+	[PROFILE_PARSE] = "parse",
+	[PROFILE_TOKENIZE] = "tokenize",
+	[PROFILE_INFO] = "object_info",
+	[PROFILE_UNHANDLED] = "unhandled",
+	[PROFILE_SVG] = "svg",
+	[PROFILE_TRACE] = "trace",
+	[PROFILE_PERFETTO] = "perfetto",
+	[PROFILE_REPORT] = "report",
+	[PROFILE_FOLDED] = "folded",
+	[PROFILE_ARROW] = "arrow",
+	[PROFILE_WRITE] = "write",	/* all the outputs, at once */
+};
+
+int
+profile_init(struct profile *prof)
+{
+	memset(prof, 0, sizeof *prof);
+
+	while (tp_handler_list[prof->handler_count].tp_name)
+		prof->handler_count++;
+
+	prof->handler = calloc(prof->handler_count, sizeof *prof->handler);
+	if (!prof->handler)
+		return ERROR;
+
+	prof->start = profile_now();
+
+	return 0;
+}
+
+void
+profile_release(struct profile *prof)
+{
+	free(prof->handler);
+	prof->handler = NULL;
+}
+
+uint64_t
+profile_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return timespec_to_nsec(&ts);
+}
+
+void
+profile_counter_add(struct profile_counter *c, uint64_t since)
+{
+	c->count++;
+	c->nsec += profile_now() - since;
+}
+
+/*
+ * Times a phase run once, such as writing an output, and notes the peak
+ * memory use so far.
+ */
+void
+profile_phase_add(struct profile *prof, enum profile_phase phase,
+		  uint64_t since)
+{
+	struct rusage ru;
+
+	profile_counter_add(&prof->phase[phase], since);
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		prof->peak_rss_kib[phase] = ru.ru_maxrss;
+}
+
+static uint64_t
+timeval_to_nsec(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * NSEC_PER_SEC + tv->tv_usec * 1000;
+}
+
+struct pool_usage {
+	const char *name;
+	uint64_t allocated;
+	uint64_t evicted;
+	uint64_t bytes;
+};
+
+enum pool_kind {
+	POOL_LINE_BLOCK,
+	POOL_ACTIVITY,
+	POOL_TRANSITION,
+	POOL_VBLANK,
+	POOL_UPDATE,
+	POOL_KIND_COUNT
+};
+
+static void
+pool_usage_add(struct pool_usage *pu, const struct node_pool *pool)
+{
+	pu->allocated += pool->allocated;
+	pu->evicted += pool->evicted;
+	pu->bytes += (pool->allocated - pool->evicted) * pool->node_size;
+}
+
+static void
+graph_data_pool_usage(struct graph_data *gdata, struct pool_usage *pu)
+{
+	struct output_graph *og;
+	struct update_graph *upg;
+
+	pu[POOL_LINE_BLOCK].name = "line_block";
+	pu[POOL_ACTIVITY].name = "activity";
+	pu[POOL_TRANSITION].name = "transition";
+	pu[POOL_VBLANK].name = "vblank";
+	pu[POOL_UPDATE].name = "update";
+
+	for (og = gdata->output; og; og = og->next) {
+		pool_usage_add(&pu[POOL_LINE_BLOCK], &og->delay_line.pool);
+		pool_usage_add(&pu[POOL_LINE_BLOCK], &og->submit_line.pool);
+		pool_usage_add(&pu[POOL_LINE_BLOCK], &og->gpu_line.pool);
+		pool_usage_add(&pu[POOL_LINE_BLOCK],
+			       &og->renderer_gpu_line.pool);
+		pool_usage_add(&pu[POOL_ACTIVITY], &og->not_looping.pool);
+		pool_usage_add(&pu[POOL_TRANSITION], &og->begins.pool);
+		pool_usage_add(&pu[POOL_TRANSITION], &og->posts.pool);
+		pool_usage_add(&pu[POOL_VBLANK], &og->vblanks.pool);
+
+		for (upg = og->updates; upg; upg = upg->next)
+			pool_usage_add(&pu[POOL_UPDATE], &upg->pool);
+	}
+}
+
+static void
+object_events_to_report(struct object_info *oi, void *data)
+{
+	struct report *r = data;
+	const char *name;
+	char *key;
+
+	if (oi->events == 0)
+		return;
+
+	if (oi->type == TYPE_WESTON_OUTPUT)
+		name = oi->info.wo.name ? oi->info.wo.name : "(unnamed)";
+	else
+		name = oi->info.ws.description;
+
+	/* descriptions are not unique */
+	if (asprintf(&key, "%s [%u]", name, oi->id) < 0)
+		return;
+
+	report_uint(r, key, oi->events);
+	free(key);
+}
+
+int
+profile_to_report(struct profile *prof, struct parse_context *ctx,
+		  const char *filename, enum report_format format)
+{
+	struct pool_usage pu[POOL_KIND_COUNT] = { { 0 } };
+	uint64_t parse_nsec = prof->phase[PROFILE_PARSE].nsec;
+	uint64_t events;
+	struct rusage ru;
+	struct report r;
+	unsigned i;
+
+	events = prof->phase[PROFILE_INFO].count +
+		 prof->phase[PROFILE_UNHANDLED].count;
+	for (i = 0; i < prof->handler_count; i++)
+		events += prof->handler[i].count;
+
+	if (report_init(&r, filename, format, ctx->gdata) < 0)
+		return ERROR;
+
+	report_msec(&r, "wall_time", profile_now() - prof->start);
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		report_msec(&r, "user_time", timeval_to_nsec(&ru.ru_utime));
+		report_msec(&r, "system_time", timeval_to_nsec(&ru.ru_stime));
+		report_uint(&r, "peak_rss_kib", ru.ru_maxrss);
+	}
+	report_uint(&r, "bytes_read", prof->bytes);
+	report_uint(&r, "events", events);
+	if (parse_nsec > 0) {
+		report_double(&r, "parse_mib_per_sec",
+			      prof->bytes / 1048576.0 * NSEC_PER_SEC /
+			      parse_nsec);
+		report_double(&r, "events_per_sec",
+			      (double)events * NSEC_PER_SEC / parse_nsec);
+	}
+
+	report_begin_object(&r, "phases");
+	report_counter_header(&r);
+	for (i = 0; i < PROFILE_PHASE_COUNT; i++)
+		report_counter(&r, profile_phase_names[i], &prof->phase[i]);
+	report_end_object(&r);
+
+	report_begin_object(&r, "peak_rss_kib_after");
+	for (i = 0; i < PROFILE_PHASE_COUNT; i++)
+		if (prof->peak_rss_kib[i])
+			report_uint(&r, profile_phase_names[i],
+				    prof->peak_rss_kib[i]);
+	report_end_object(&r);
+
+	report_begin_object(&r, "timepoints");
+	report_counter_header(&r);
+	for (i = 0; i < prof->handler_count; i++)
+		report_counter(&r, tp_handler_list[i].tp_name,
+			       &prof->handler[i]);
+	report_end_object(&r);
+
+	report_begin_object(&r, "events_per_object");
+	parse_context_for_each_object(ctx, object_events_to_report, &r);
+	report_end_object(&r);
+
+	graph_data_pool_usage(ctx->gdata, pu);
+	report_begin_object(&r, "graph_nodes");
+	for (i = 0; i < POOL_KIND_COUNT; i++) {
+		report_begin_object(&r, pu[i].name);
+		report_uint(&r, "allocated", pu[i].allocated);
+		report_uint(&r, "evicted", pu[i].evicted);
+		report_uint(&r, "live_bytes", pu[i].bytes);
+		report_end_object(&r);
+	}
+	report_end_object(&r);
+
+	return report_finish(&r);
+}
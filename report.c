@@ -0,0 +1,675 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The report writer produces the same tree of keys and values either as
+ * indented plain text or as JSON. All times are in milliseconds.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "wesgr.h"
+
+static void
+report_json_string(FILE *fp, const char *str)
+{
+	const unsigned char *s;
+
+	fputc('"', fp);
+	for (s = (const unsigned char *)str; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if (*s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+void
+report_indent(struct report *r)
+{
+	int i;
+
+	for (i = 0; i < r->depth; i++)
+		fputs("  ", r->fp);
+}
+
+/* Starts a new member or array element, and prints its key. */
+static void
+report_key(struct report *r, const char *key)
+{
+	if (r->format == REPORT_TEXT) {
+		report_indent(r);
+		if (key)
+			fprintf(r->fp, "%s:", key);
+		else
+			fputc('-', r->fp);
+		return;
+	}
+
+	if (r->need_comma)
+		fputc(',', r->fp);
+	fputc('\n', r->fp);
+	report_indent(r);
+
+	if (key) {
+		report_json_string(r->fp, key);
+		fputc(':', r->fp);
+	}
+
+	r->need_comma = 1;
+}
+
+static void
+report_open(struct report *r, const char *key, char bracket)
+{
+	report_key(r, key);
+
+	if (r->format == REPORT_TEXT)
+		fputc('\n', r->fp);
+	else
+		fputc(bracket, r->fp);
+
+	r->depth++;
+	r->need_comma = 0;
+}
+
+static void
+report_close(struct report *r, char bracket)
+{
+	r->depth--;
+
+	if (r->format == REPORT_TEXT)
+		return;
+
+	fputc('\n', r->fp);
+	report_indent(r);
+	fputc(bracket, r->fp);
+	r->need_comma = 1;
+}
+
+void
+report_begin_object(struct report *r, const char *key)
+{
+	report_open(r, key, '{');
+}
+
+void
+report_end_object(struct report *r)
+{
+	report_close(r, '}');
+}
+
+void
+report_begin_array(struct report *r, const char *key)
+{
+	report_open(r, key, '[');
+}
+
+void
+report_end_array(struct report *r)
+{
+	report_close(r, ']');
+}
+
+void
+report_string(struct report *r, const char *key, const char *value)
+{
+	report_key(r, key);
+
+	if (r->format == REPORT_TEXT)
+		fprintf(r->fp, " %s\n", value);
+	else
+		report_json_string(r->fp, value);
+}
+
+void
+report_uint(struct report *r, const char *key, uint64_t value)
+{
+	report_key(r, key);
+	fprintf(r->fp, r->format == REPORT_TEXT ? " %" PRIu64 "\n" :
+		"%" PRIu64, value);
+}
+
+void
+report_double(struct report *r, const char *key, double value)
+{
+	report_key(r, key);
+	fprintf(r->fp, r->format == REPORT_TEXT ? " %.3f\n" : "%.6f", value);
+}
+
+void
+report_msec(struct report *r, const char *key, uint64_t nsec)
+{
+	report_key(r, key);
+	fprintf(r->fp, r->format == REPORT_TEXT ? " %.3f ms\n" : "%.6f",
+		nsec * 1e-6);
+}
+
+/* A point in time, as milliseconds from the beginning of the recording. */
+void
+report_time(struct report *r, const char *key, const struct timespec *ts)
+{
+	if (!timespec_is_valid(ts)) {
+		report_key(r, key);
+		fputs(r->format == REPORT_TEXT ? " -\n" : "null", r->fp);
+		return;
+	}
+
+	report_msec(r, key, timespec_sub_to_nsec(ts, &r->begin));
+}
+
+static const struct {
+	const char *key;
+	double q;
+} report_quantiles[] = {
+	{ "p50", 0.50 },
+	{ "p90", 0.90 },
+	{ "p99", 0.99 },
+	{ "p99.9", 0.999 },
+};
+
+void
+report_histogram(struct report *r, const char *key,
+		 const struct histogram *h)
+{
+	unsigned i;
+
+	if (r->format == REPORT_JSON) {
+		report_begin_object(r, key);
+		report_uint(r, "count", h->count);
+		if (h->count > 0) {
+			report_msec(r, "mean", histogram_mean(h));
+			for (i = 0; i < ARRAY_LENGTH(report_quantiles); i++)
+				report_msec(r, report_quantiles[i].key,
+					    histogram_quantile(h,
+						report_quantiles[i].q));
+			report_msec(r, "max", h->max);
+		}
+		report_end_object(r);
+		return;
+	}
+
+	/* In text, one histogram is one table row. */
+	report_indent(r);
+	fprintf(r->fp, "%-20s %8" PRIu64, key, h->count);
+	if (h->count > 0) {
+		fprintf(r->fp, " %9.3f", histogram_mean(h) * 1e-6);
+		for (i = 0; i < ARRAY_LENGTH(report_quantiles); i++)
+			fprintf(r->fp, " %9.3f",
+				histogram_quantile(h, report_quantiles[i].q) *
+				1e-6);
+		fprintf(r->fp, " %9.3f", h->max * 1e-6);
+	}
+	fputc('\n', r->fp);
+}
+
+/* The column titles for the text rows of report_histogram(). */
+void
+report_histogram_header(struct report *r)
+{
+	unsigned i;
+
+	if (r->format == REPORT_JSON)
+		return;
+
+	report_indent(r);
+	fprintf(r->fp, "%-20s %8s %9s", "(ms)", "count", "mean");
+	for (i = 0; i < ARRAY_LENGTH(report_quantiles); i++)
+		fprintf(r->fp, " %9s", report_quantiles[i].key);
+	fprintf(r->fp, " %9s\n", "max");
+}
+
+void
+report_counter(struct report *r, const char *key,
+	       const struct profile_counter *c)
+{
+	double mean = c->count ? (double)c->nsec / c->count : 0.0;
+
+	if (r->format == REPORT_JSON) {
+		report_begin_object(r, key);
+		report_uint(r, "count", c->count);
+		report_msec(r, "total", c->nsec);
+		report_msec(r, "mean", mean);
+		report_end_object(r);
+		return;
+	}
+
+	/* one table row, like report_histogram() */
+	report_indent(r);
+	fprintf(r->fp, "%-24s %10" PRIu64 " %12.3f %10.3f\n", key, c->count,
+		c->nsec * 1e-6, mean * 1e-3);
+}
+
+/* The column titles for the text rows of report_counter(). */
+void
+report_counter_header(struct report *r)
+{
+	if (r->format == REPORT_JSON)
+		return;
+
+	report_indent(r);
+	fprintf(r->fp, "%-24s %10s %12s %10s\n", "", "count", "total (ms)",
+		"mean (us)");
+}
+
+/* Writes into fp, which is left open by report_finish(). */
+void
+report_init_fp(struct report *r, FILE *fp, enum report_format format,
+	       struct graph_data *gdata)
+{
+	memset(r, 0, sizeof *r);
+	r->fp = fp;
+	r->format = format;
+	r->begin = gdata->begin;
+
+	if (r->format == REPORT_JSON) {
+		fputc('{', r->fp);
+		r->depth = 1;
+	}
+}
+
+int
+report_init(struct report *r, const char *filename,
+	    enum report_format format, struct graph_data *gdata)
+{
+	FILE *fp;
+
+	if (strcmp(filename, "-") == 0)
+		fp = stdout;
+	else
+		fp = fopen(filename, "w");
+
+	if (!fp)
+		return ERROR;
+
+	report_init_fp(r, fp, format, gdata);
+	r->close = fp != stdout;
+
+	return 0;
+}
+
+int
+report_finish(struct report *r)
+{
+	if (r->format == REPORT_JSON)
+		fputs("\n}\n", r->fp);
+
+	if (!r->close)
+		return fflush(r->fp) == 0 ? 0 : ERROR;
+
+	if (fclose(r->fp) != 0)
+		return ERROR;
+
+	return 0;
+}
+
+static void
+frame_misses_to_report(struct frame_miss_stats *fms, struct report *r)
+{
+	const struct frame_miss *miss;
+	unsigned i;
+
+	report_begin_object(r, "missed_frames");
+	report_msec(r, "refresh_period", fms->refresh.period);
+	report_uint(r, "frames", fms->frames);
+	report_uint(r, "vblank_timestamps", fms->stamped);
+	report_uint(r, "snapped_vblanks", fms->snapped);
+	report_uint(r, "missed_frames", fms->missed_frames);
+
+	report_begin_object(r, "misses_by_cause");
+	for (i = 0; i < MISS_CAUSE_COUNT; i++)
+		report_uint(r, miss_cause_to_str(i), fms->count[i]);
+	report_end_object(r);
+
+	report_begin_array(r, "worst");
+	for (i = 0; i < fms->worst_count; i++) {
+		miss = &fms->worst[i];
+		report_begin_object(r, NULL);
+		report_time(r, "vblank", &miss->ts);
+		report_msec(r, "interval", miss->interval);
+		report_uint(r, "missed", miss->missed);
+		report_string(r, "cause", miss_cause_to_str(miss->cause));
+		report_end_object(r);
+	}
+	report_end_array(r);
+
+	report_end_object(r);
+}
+
+static void
+repaint_loops_to_report(struct output_graph *og, struct graph_data *gdata,
+			struct report *r)
+{
+	struct loop_stats *ls = &og->loops;
+	const struct wasted_loop *wl;
+	uint64_t recording = timespec_sub_to_nsec(&gdata->end, &gdata->begin);
+	uint64_t idle = ls->idle_total;
+	unsigned i;
+
+	report_begin_object(r, "repaint_loop");
+	report_msec(r, "recording", recording);
+	report_msec(r, "looping", recording - idle);
+	report_msec(r, "idle", idle);
+	report_double(r, "duty_cycle_percent", recording ?
+		      (double)(recording - idle) / recording * 100.0 : 0.0);
+	report_uint(r, "loops", ls->loops);
+
+	report_begin_object(r, "periods");
+	report_histogram_header(r);
+	report_histogram(r, "looping", &ls->busy);
+	report_histogram(r, "idle", &ls->idle);
+	report_end_object(r);
+
+	/* Logs without damage events cannot tell wasted repaints apart. */
+	if (gdata->damage_seen) {
+		report_uint(r, "repaints", ls->repaints);
+		report_uint(r, "repaints_without_damage", ls->empty_repaints);
+		report_uint(r, "wasted_loops", ls->wasted_loops);
+
+		report_begin_array(r, "wasted");
+		for (i = 0; i < ls->worst_count; i++) {
+			wl = &ls->worst[i];
+			report_begin_object(r, NULL);
+			report_time(r, "begin", &wl->begin);
+			report_time(r, "end", &wl->end);
+			report_msec(r, "duration",
+				    timespec_sub_to_nsec(&wl->end, &wl->begin));
+			report_uint(r, "repaints", wl->repaints);
+			report_end_object(r);
+		}
+		report_end_array(r);
+	}
+
+	report_end_object(r);
+}
+
+static double
+percent(uint64_t part, uint64_t whole)
+{
+	if (whole == 0)
+		return 0.0;
+
+	if (part > whole)
+		return 100.0;
+
+	return (double)part / whole * 100.0;
+}
+
+static void
+gpu_to_report(struct output_graph *og, struct graph_data *gdata,
+	      struct report *r)
+{
+	const struct gpu_stats *gs = &og->gpu;
+	uint64_t span = timespec_sub_to_nsec(&gdata->end, &gdata->begin);
+
+	report_begin_object(r, "gpu");
+	report_double(r, "busy_percent", percent(gs->busy, span));
+	report_msec(r, "window", gs->window);
+	report_double(r, "peak_busy_percent",
+		      percent(gs->peak_busy, gs->window));
+	report_uint(r, "frames", gs->frames);
+	report_uint(r, "overlapping_frames", gs->overlapping);
+	report_double(r, "overlapping_percent",
+		      percent(gs->overlapping, gs->frames));
+
+	report_begin_object(r, "durations");
+	report_histogram_header(r);
+	report_histogram(r, "render", &og->renderer_gpu_line.durations);
+	report_histogram(r, "overlap", &gs->overlap);
+	report_end_object(r);
+
+	report_end_object(r);
+}
+
+static int
+output_graph_to_report(struct output_graph *og, struct graph_data *gdata,
+		       struct report *r)
+{
+	report_begin_object(r, output_graph_name(og));
+
+	report_begin_object(r, "frame_timing");
+	report_histogram_header(r);
+	report_histogram(r, og->delay_line.style, &og->delay_line.durations);
+	report_histogram(r, og->submit_line.style, &og->submit_line.durations);
+	report_histogram(r, og->gpu_line.style, &og->gpu_line.durations);
+	report_histogram(r, og->renderer_gpu_line.style,
+			 &og->renderer_gpu_line.durations);
+	report_histogram(r, "vblank_interval", &og->vblank_intervals);
+	report_end_object(r);
+
+	frame_misses_to_report(&og->misses, r);
+	repaint_loops_to_report(og, gdata, r);
+
+	gpu_to_report(og, gdata, r);
+
+	if (repaint_requests_to_report(&og->requests, gdata->damage_seen,
+				       r) < 0)
+		return ERROR;
+
+	report_end_object(r);
+
+	return 0;
+}
+
+static struct surface_report *
+get_surface_report(struct surface_report **list, const char *label)
+{
+	struct surface_report *sr;
+
+	for (sr = *list; sr; sr = sr->next)
+		if (strcmp(sr->label, label) == 0)
+			return sr;
+
+	sr = calloc(1, sizeof *sr);
+	if (!sr)
+		return ERROR_NULL;
+
+	sr->label = label;
+	histogram_init(&sr->commit_to_flush);
+	histogram_init(&sr->flush_to_vblank);
+	sr->next = *list;
+	*list = sr;
+
+	return sr;
+}
+
+static int
+surface_report_add(struct surface_report *sr, struct update_graph *upg,
+		   struct output_graph *og)
+{
+	const struct update_latency *lat = &upg->latency;
+	struct surface_worst *arr;
+	unsigned i;
+
+	if (histogram_merge(&sr->commit_to_flush, &lat->commit_to_flush) < 0)
+		return ERROR;
+
+	if (histogram_merge(&sr->flush_to_vblank, &lat->flush_to_vblank) < 0)
+		return ERROR;
+
+	arr = realloc(sr->worst, (sr->worst_count + lat->worst_count) *
+			       sizeof *arr);
+	if (!arr && lat->worst_count > 0)
+		return ERROR;
+	sr->worst = arr;
+
+	for (i = 0; i < lat->worst_count; i++) {
+		arr[sr->worst_count].update = &lat->worst[i];
+		arr[sr->worst_count].output = output_graph_name(og);
+		sr->worst_count++;
+	}
+
+	return 0;
+}
+
+void
+surface_report_list_destroy(struct surface_report *list)
+{
+	struct surface_report *sr, *tmp;
+
+	for (sr = list; sr; sr = tmp) {
+		tmp = sr->next;
+		histogram_release(&sr->commit_to_flush);
+		histogram_release(&sr->flush_to_vblank);
+		free(sr->worst);
+		free(sr);
+	}
+}
+
+static int
+compare_surface_worst(const void *a, const void *b)
+{
+	uint64_t ta = update_latency_total(((const struct surface_worst *)a)->update);
+	uint64_t tb = update_latency_total(((const struct surface_worst *)b)->update);
+
+	if (ta > tb)
+		return -1;
+
+	return ta < tb;
+}
+
+static void
+surface_report_to_report(struct surface_report *sr, struct report *r)
+{
+	const struct update *up;
+	unsigned i;
+
+	qsort(sr->worst, sr->worst_count, sizeof sr->worst[0],
+	      compare_surface_worst);
+
+	report_begin_object(r, sr->label);
+
+	report_begin_object(r, "latency");
+	report_histogram_header(r);
+	report_histogram(r, "commit_to_flush", &sr->commit_to_flush);
+	report_histogram(r, "flush_to_vblank", &sr->flush_to_vblank);
+	report_end_object(r);
+
+	report_begin_array(r, "worst");
+	for (i = 0; i < sr->worst_count && i < WORST_COUNT; i++) {
+		up = sr->worst[i].update;
+		report_begin_object(r, NULL);
+		report_string(r, "output", sr->worst[i].output);
+		report_time(r, "commit", &up->damage);
+		report_time(r, "flush", &up->flush);
+		report_time(r, "vblank", &up->vblank);
+		report_msec(r, "latency", update_latency_total(up));
+		report_end_object(r);
+	}
+	report_end_array(r);
+
+	report_end_object(r);
+}
+
+int
+surface_report_list_collect(struct graph_data *gdata,
+			    struct surface_report **list)
+{
+	struct surface_report *sr;
+	struct output_graph *og;
+	struct update_graph *upg;
+
+	*list = NULL;
+
+	for (og = gdata->output; og; og = og->next) {
+		for (upg = og->updates; upg; upg = upg->next) {
+			sr = get_surface_report(list, upg->label);
+			if (!sr || surface_report_add(sr, upg, og) < 0) {
+				surface_report_list_destroy(*list);
+				*list = NULL;
+				return ERROR;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+surfaces_to_report(struct graph_data *gdata, struct report *r)
+{
+	struct surface_report *list;
+	struct surface_report *sr;
+
+	if (surface_report_list_collect(gdata, &list) < 0)
+		return ERROR;
+
+	report_begin_object(r, "surfaces");
+	for (sr = list; sr; sr = sr->next)
+		surface_report_to_report(sr, r);
+	report_end_object(r);
+
+	surface_report_list_destroy(list);
+
+	return 0;
+}
+
+static int
+report_graph_data(struct report *r, struct graph_data *gdata)
+{
+	struct output_graph *og;
+
+	report_begin_object(r, "outputs");
+	for (og = gdata->output; og; og = og->next) {
+		if (output_graph_to_report(og, gdata, r) < 0) {
+			report_finish(r);
+			return ERROR;
+		}
+	}
+	report_end_object(r);
+
+	if (surfaces_to_report(gdata, r) < 0) {
+		report_finish(r);
+		return ERROR;
+	}
+
+	return report_finish(r);
+}
+
+int
+graph_data_to_report(struct graph_data *gdata, const char *filename,
+		     enum report_format format)
+{
+	struct report r;
+
+	if (report_init(&r, filename, format, gdata) < 0)
+		return ERROR;
+
+	return report_graph_data(&r, gdata);
+}
+
+int
+graph_data_to_report_fp(struct graph_data *gdata, FILE *fp,
+			enum report_format format)
+{
+	struct report r;
+
+	report_init_fp(&r, fp, format, gdata);
+
+	return report_graph_data(&r, gdata);
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Checks the structural scanner: the byte by byte code and the vector
+ * code picked for this machine must find the same object ends as a
+ * plain reading of the input, over the given logs and over random
+ * input, whole and split into random pieces.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wesgr.h"
+
+/* Random pieces each file is scanned in, and random inputs */
+#define SPLIT_ROUNDS 20
+#define RANDOM_INPUTS 2000
+#define RANDOM_MAX_LEN 700
+
+struct ends {
+	size_t *offset;
+	size_t count;
+	size_t alloc;
+};
+
+static uint64_t rng_state = 1;
+
+static uint64_t
+rng_next(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+
+	return rng_state;
+}
+
+static int
+ends_add(struct ends *e, size_t offset)
+{
+	size_t *arr;
+
+	if (e->count == e->alloc) {
+		size_t n = e->alloc ? e->alloc * 2 : 256;
+
+		arr = realloc(e->offset, n * sizeof *arr);
+		if (!arr)
+			return -1;
+
+		e->offset = arr;
+		e->alloc = n;
+	}
+
+	e->offset[e->count++] = offset;
+
+	return 0;
+}
+
+/* Where top-level objects end, one byte at a time */
+static int
+reference_scan(const char *buf, size_t len, struct ends *e)
+{
+	unsigned depth = 0;
+	int in_string = 0;
+	int escaped = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (in_string) {
+			if (escaped)
+				escaped = 0;
+			else if (buf[i] == '\\')
+				escaped = 1;
+			else if (buf[i] == '"')
+				in_string = 0;
+			continue;
+		}
+
+		if (buf[i] == '"') {
+			in_string = 1;
+			continue;
+		}
+
+		if (buf[i] == '{') {
+			depth++;
+		} else if (buf[i] == '}' && depth > 0) {
+			if (--depth == 0 && ends_add(e, i + 1) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Scans in pieces of at most max_piece bytes, random ones if random is
+ * set, with little room for ends to also stop scans early.
+ */
+static int
+scanner_scan(struct json_scanner *s, const char *buf, size_t len,
+	     size_t max_piece, int random, struct ends *e)
+{
+	size_t ends[JSON_SCAN_BLOCK_ENDS * 3];
+	size_t pos = 0;
+	size_t piece, end, scanned, found, i;
+
+	while (pos < len) {
+		piece = random ? 1 + rng_next() % max_piece : max_piece;
+		end = len - pos < piece ? len : pos + piece;
+
+		while (pos < end) {
+			found = json_scanner_scan(s, buf + pos, end - pos, ends,
+						  ARRAY_LENGTH(ends), &scanned);
+			for (i = 0; i < found; i++)
+				if (ends_add(e, pos + ends[i]) < 0)
+					return -1;
+			pos += scanned;
+		}
+	}
+
+	return 0;
+}
+
+static int
+check_buffer(const char *name, const char *buf, size_t len)
+{
+	static const size_t whole = SIZE_MAX;
+	struct json_scanner s;
+	struct ends ref = { 0 };
+	struct ends got;
+	unsigned round;
+	int vector;
+	int ret = -1;
+
+	if (reference_scan(buf, len, &ref) < 0)
+		goto out;
+
+	for (round = 0; round <= SPLIT_ROUNDS; round++) {
+		for (vector = 0; vector < 2; vector++) {
+			if (vector)
+				json_scanner_init(&s);
+			else
+				json_scanner_init_scalar(&s);
+
+			memset(&got, 0, sizeof got);
+			if (scanner_scan(&s, buf, len,
+					 round ? 1 + rng_next() % 512 : whole,
+					 round > 0, &got) < 0) {
+				free(got.offset);
+				goto out;
+			}
+
+			if (got.count != ref.count ||
+			    memcmp(got.offset, ref.offset,
+				   ref.count * sizeof ref.offset[0]) != 0) {
+				fprintf(stderr, "Error: the %s scanner finds "
+					"other ends than the reference in %s "
+					"%s.\n", vector ? "vector" : "scalar",
+					name, round ? "split" : "whole");
+				free(got.offset);
+				goto out;
+			}
+
+			free(got.offset);
+		}
+	}
+
+	ret = 0;
+
+out:
+	free(ref.offset);
+
+	return ret;
+}
+
+static int
+check_file(const char *filename)
+{
+	FILE *fp;
+	char *buf = NULL;
+	size_t len = 0;
+	int ret = -1;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Error: cannot open %s.\n", filename);
+		return -1;
+	}
+
+	if (fseek(fp, 0, SEEK_END) == 0) {
+		len = ftell(fp);
+		rewind(fp);
+		buf = malloc(len ? len : 1);
+	}
+
+	if (buf && fread(buf, 1, len, fp) == len)
+		ret = check_buffer(filename, buf, len);
+
+	free(buf);
+	fclose(fp);
+
+	return ret;
+}
+
+/*
+ * Mostly the characters the scanner looks for, to hit every corner, but
+ * with backslashes only in strings as in JSON: outside of them, the
+ * scanner takes them for escapes and the tokenizer rejects them.
+ */
+static int
+check_random(void)
+{
+	static const char outside[] = "{}{}a :\"";
+	static const char inside[] = "\\\\\\{}a\"";
+	char buf[RANDOM_MAX_LEN];
+	size_t len, i;
+	unsigned n;
+	int in_string, escaped;
+
+	for (n = 0; n < RANDOM_INPUTS; n++) {
+		len = rng_next() % sizeof buf;
+		in_string = 0;
+		escaped = 0;
+
+		for (i = 0; i < len; i++) {
+			if (in_string)
+				buf[i] = inside[rng_next() % (sizeof inside - 1)];
+			else
+				buf[i] = outside[rng_next() %
+						 (sizeof outside - 1)];
+
+			if (escaped)
+				escaped = 0;
+			else if (in_string && buf[i] == '\\')
+				escaped = 1;
+			else if (buf[i] == '"')
+				in_string = !in_string;
+		}
+
+		if (check_buffer("random input", buf, len) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++)
+		if (check_file(argv[i]) < 0)
+			return 1;
+
+	if (check_random() < 0)
+		return 1;
+
+	printf("The scanner agrees with the reference on %d file(s) and "
+	       "%d random inputs.\n", argc - 1, RANDOM_INPUTS);
+
+	return 0;
+}
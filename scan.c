@@ -0,0 +1,333 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Finds where the top-level objects of a log end, without tokenizing
+ * it, in the manner of simdjson's first stage: every 64 bytes are
+ * turned into bitmasks of quotes, backslashes and braces, escaped
+ * quotes and then strings are masked out with a few word operations,
+ * and only the braces left are looked at one by one. Blocks that
+ * cannot close a top-level object are not even looked into.
+ *
+ * The bitmasks are built with AVX2 or SSE2 where available, and byte by
+ * byte otherwise.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#include "wesgr.h"
+
+#define EVEN_BITS UINT64_C(0x5555555555555555)
+
+struct scan_masks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t open;
+	uint64_t close;
+};
+
+static void
+scan_classify_scalar(const char *block, struct scan_masks *m)
+{
+	unsigned i;
+
+	memset(m, 0, sizeof *m);
+
+	for (i = 0; i < 64; i++) {
+		uint64_t bit = UINT64_C(1) << i;
+
+		switch (block[i]) {
+		case '"':
+			m->quote |= bit;
+			break;
+		case '\\':
+			m->backslash |= bit;
+			break;
+		case '{':
+			m->open |= bit;
+			break;
+		case '}':
+			m->close |= bit;
+			break;
+		}
+	}
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static uint64_t
+sse2_eq_mask(const __m128i v[4], char c)
+{
+	__m128i cv = _mm_set1_epi8(c);
+	uint64_t m = 0;
+	unsigned i;
+
+	for (i = 0; i < 4; i++)
+		m |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+			_mm_cmpeq_epi8(v[i], cv)) << (16 * i);
+
+	return m;
+}
+
+__attribute__((target("sse2")))
+static void
+scan_classify_sse2(const char *block, struct scan_masks *m)
+{
+	__m128i v[4];
+	unsigned i;
+
+	for (i = 0; i < 4; i++)
+		v[i] = _mm_loadu_si128((const __m128i *)(block + 16 * i));
+
+	m->quote = sse2_eq_mask(v, '"');
+	m->backslash = sse2_eq_mask(v, '\\');
+	m->open = sse2_eq_mask(v, '{');
+	m->close = sse2_eq_mask(v, '}');
+}
+
+__attribute__((target("avx2")))
+static uint64_t
+avx2_eq_mask(__m256i lo, __m256i hi, char c)
+{
+	__m256i cv = _mm256_set1_epi8(c);
+
+	return (uint64_t)(uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(lo, cv)) |
+	       (uint64_t)(uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(hi, cv)) << 32;
+}
+
+__attribute__((target("avx2")))
+static void
+scan_classify_avx2(const char *block, struct scan_masks *m)
+{
+	__m256i lo = _mm256_loadu_si256((const __m256i *)block);
+	__m256i hi = _mm256_loadu_si256((const __m256i *)(block + 32));
+
+	m->quote = avx2_eq_mask(lo, hi, '"');
+	m->backslash = avx2_eq_mask(lo, hi, '\\');
+	m->open = avx2_eq_mask(lo, hi, '{');
+	m->close = avx2_eq_mask(lo, hi, '}');
+}
+#endif
+
+/* Each bit becomes the parity of the set bits at and below it. */
+static inline uint64_t
+prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+
+	return x;
+}
+
+/*
+ * The characters escaped by a backslash: those after an odd run of
+ * backslashes. The carry says whether the first character of the next
+ * block is escaped, for a block of n bytes.
+ */
+static inline uint64_t
+find_escaped(uint64_t backslash, uint64_t *carry, unsigned n)
+{
+	uint64_t follows_escape, odd_starts, sum, escaped;
+	int overflow;
+
+	backslash &= ~*carry;
+	follows_escape = backslash << 1 | *carry;
+	odd_starts = backslash & ~EVEN_BITS & ~follows_escape;
+	overflow = __builtin_add_overflow(odd_starts, backslash, &sum);
+	escaped = (EVEN_BITS ^ (sum << 1)) & follows_escape;
+
+	/* an escape beyond the block is the first bit of the next one */
+	if (n == 64)
+		*carry = overflow;
+	else
+		*carry = (escaped >> n) & 1;
+
+	return escaped;
+}
+
+/*
+ * Scans the first n bytes of a 64-byte block, and stores where the
+ * top-level objects end, relative to base.
+ */
+static inline size_t
+scan_block(struct json_scanner *s, const struct scan_masks *m, unsigned n,
+	   size_t base, size_t *ends)
+{
+	uint64_t valid = n == 64 ? ~UINT64_C(0) : (UINT64_C(1) << n) - 1;
+	uint64_t escaped, quotes, in_string, open, close, braces, bit;
+	unsigned nopen, nclose;
+	size_t found = 0;
+
+	escaped = find_escaped(m->backslash & valid, &s->escape_carry, n);
+	quotes = m->quote & valid & ~escaped;
+	in_string = prefix_xor(quotes) ^ s->string_carry;
+	s->string_carry = (uint64_t)((int64_t)(in_string << (64 - n)) >> 63);
+
+	open = m->open & valid & ~in_string;
+	close = m->close & valid & ~in_string;
+	nopen = __builtin_popcountll(open);
+	nclose = __builtin_popcountll(close);
+
+	/* the depth cannot reach zero within this block */
+	if (nclose < s->depth) {
+		s->depth += nopen - nclose;
+		return 0;
+	}
+
+	for (braces = open | close; braces; braces &= braces - 1) {
+		bit = braces & -braces;
+
+		if (open & bit) {
+			s->depth++;
+			continue;
+		}
+
+		/* stray closing braces are left to the tokenizer */
+		if (s->depth == 0)
+			continue;
+
+		if (--s->depth == 0)
+			ends[found++] = base + __builtin_ctzll(bit) + 1;
+	}
+
+	return found;
+}
+
+/*
+ * The loop over whole blocks, inlined into a copy for each classifier
+ * so that the classifier is inlined too.
+ */
+static inline __attribute__((always_inline)) size_t
+scan_blocks(struct json_scanner *s, const char *buf, size_t len,
+	    size_t *ends, size_t max_ends, size_t *pos,
+	    void (*classify)(const char *block, struct scan_masks *m))
+{
+	struct scan_masks m;
+	size_t found = 0;
+
+	while (len - *pos >= 64 && max_ends - found >= JSON_SCAN_BLOCK_ENDS) {
+		classify(buf + *pos, &m);
+		found += scan_block(s, &m, 64, *pos, ends + found);
+		*pos += 64;
+	}
+
+	return found;
+}
+
+static size_t
+scan_blocks_scalar(struct json_scanner *s, const char *buf, size_t len,
+		   size_t *ends, size_t max_ends, size_t *pos)
+{
+	return scan_blocks(s, buf, len, ends, max_ends, pos,
+			   scan_classify_scalar);
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static size_t
+scan_blocks_sse2(struct json_scanner *s, const char *buf, size_t len,
+		 size_t *ends, size_t max_ends, size_t *pos)
+{
+	return scan_blocks(s, buf, len, ends, max_ends, pos,
+			   scan_classify_sse2);
+}
+
+__attribute__((target("avx2")))
+static size_t
+scan_blocks_avx2(struct json_scanner *s, const char *buf, size_t len,
+		 size_t *ends, size_t max_ends, size_t *pos)
+{
+	return scan_blocks(s, buf, len, ends, max_ends, pos,
+			   scan_classify_avx2);
+}
+#endif
+
+/*
+ * Scans len bytes following whatever the scanner has seen so far, and
+ * stores into ends the offsets just past the closing brace of every
+ * top-level object that ends in them. Scanning stops early when ends
+ * has room for fewer than JSON_SCAN_BLOCK_ENDS more offsets.
+ *
+ * Returns the number of offsets stored, and sets *scanned to the number
+ * of bytes scanned, to be continued from.
+ */
+size_t
+json_scanner_scan(struct json_scanner *s, const char *buf, size_t len,
+		  size_t *ends, size_t max_ends, size_t *scanned)
+{
+	struct scan_masks m;
+	char tail[64];
+	size_t pos = 0;
+	size_t found;
+
+	found = s->scan_blocks(s, buf, len, ends, max_ends, &pos);
+
+	/* the rest is scanned as a block padded with spaces */
+	if (pos < len && len - pos < 64 &&
+	    max_ends - found >= JSON_SCAN_BLOCK_ENDS) {
+		memset(tail, ' ', sizeof tail);
+		memcpy(tail, buf + pos, len - pos);
+		scan_classify_scalar(tail, &m);
+		found += scan_block(s, &m, len - pos, pos, ends + found);
+		pos = len;
+	}
+
+	*scanned = pos;
+
+	return found;
+}
+
+void
+json_scanner_init(struct json_scanner *s)
+{
+	memset(s, 0, sizeof *s);
+	s->scan_blocks = scan_blocks_scalar;
+
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		s->scan_blocks = scan_blocks_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		s->scan_blocks = scan_blocks_sse2;
+#endif
+}
+
+/* Scans byte by byte, for testing the vector code against. */
+void
+json_scanner_init_scalar(struct json_scanner *s)
+{
+	json_scanner_init(s);
+	s->scan_blocks = scan_blocks_scalar;
+}
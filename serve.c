@@ -0,0 +1,486 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Answers requests about a parsed log over a Unix domain socket, so
+ * that a recording is parsed once however many times it is drawn.
+ *
+ * A client connects, sends one request line and reads the answer until
+ * the connection is closed:
+ *
+ *   svg [from=MS] [to=MS] [anomalies[=MS]] [threshold=LANE:LIMIT]...
+ *   report [json]
+ *   stats OUTPUT LANE
+ *   trace
+ *   perfetto
+ *   arrow DIR
+ *
+ * Failed requests are answered with a line starting with "Error:".
+ * Connections are handled by a pool of worker threads, which only read
+ * the graph data. The one exception is a drawing with thresholds of its
+ * own, which lays the lanes out again; drawings, the only readers of
+ * the layout, are locked out meanwhile.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "wesgr.h"
+
+#define SERVE_WORKERS_MAX 16
+#define SERVE_QUEUE 64
+#define SERVE_REQUEST_MAX 4096
+
+/* How long a worker waits for the request line */
+#define SERVE_READ_TIMEOUT_SEC 5
+
+struct server {
+	struct graph_data *gdata;
+	const struct svg_options *defaults;
+	pthread_rwlock_t layout_lock;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t more;
+	pthread_cond_t room;
+	int queue[SERVE_QUEUE];	/* accepted connections */
+	unsigned head;
+	unsigned count;
+	int stop;
+
+	pthread_t workers[SERVE_WORKERS_MAX];
+	unsigned nworkers;
+};
+
+static volatile sig_atomic_t serve_stop;
+
+static void
+serve_signal(int sig)
+{
+	serve_stop = 1;
+}
+
+static int
+serve_svg(struct server *s, char **save, FILE *fp)
+{
+	struct svg_options opts = *s->defaults;
+	struct threshold *thresholds = NULL;
+	struct threshold **last = &thresholds;
+	char *arg, *value;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *mem;
+	int ret = -1;
+
+	while ((arg = strtok_r(NULL, " \t\r\n", save))) {
+		value = strchr(arg, '=');
+		if (value)
+			*value++ = '\0';
+
+		if (strcmp(arg, "from") == 0 && value) {
+			opts.from_ms = atoi(value);
+		} else if (strcmp(arg, "to") == 0 && value) {
+			opts.to_ms = atoi(value);
+		} else if (strcmp(arg, "anomalies") == 0) {
+			opts.anomalies_only = 1;
+			if (value)
+				opts.context_ns =
+					(uint64_t)atoi(value) * 1000000;
+		} else if (strcmp(arg, "threshold") == 0 && value) {
+			*last = threshold_parse(value);
+			if (!*last) {
+				fprintf(fp, "Error: bad threshold '%s'.\n",
+					value);
+				goto out;
+			}
+			last = &(*last)->next;
+		} else {
+			fprintf(fp, "Error: bad svg argument '%s'.\n", arg);
+			goto out;
+		}
+	}
+
+	if (!thresholds) {
+		pthread_rwlock_rdlock(&s->layout_lock);
+		ret = graph_data_write_svg_fp(s->gdata, &opts, fp);
+		pthread_rwlock_unlock(&s->layout_lock);
+		goto out;
+	}
+
+	/* drawn in memory, not to hold the lock while the client reads */
+	mem = open_memstream(&buf, &len);
+	if (!mem)
+		goto out;
+
+	opts.thresholds = thresholds;
+	pthread_rwlock_wrlock(&s->layout_lock);
+	graph_data_layout_svg(s->gdata, &opts);
+	ret = graph_data_write_svg_fp(s->gdata, &opts, mem);
+	graph_data_layout_svg(s->gdata, s->defaults);
+	pthread_rwlock_unlock(&s->layout_lock);
+
+	if (fclose(mem) != 0)
+		ret = ERROR;
+	if (ret == 0 && fwrite(buf, 1, len, fp) != len)
+		ret = -1;
+	free(buf);
+
+out:
+	threshold_list_destroy(thresholds);
+
+	return ret;
+}
+
+static int
+serve_report(struct server *s, char **save, FILE *fp)
+{
+	enum report_format format = REPORT_TEXT;
+	char *arg;
+
+	arg = strtok_r(NULL, " \t\r\n", save);
+	if (arg && strcmp(arg, "json") == 0) {
+		format = REPORT_JSON;
+	} else if (arg) {
+		fprintf(fp, "Error: bad report argument '%s'.\n", arg);
+		return -1;
+	}
+
+	return graph_data_to_report_fp(s->gdata, fp, format);
+}
+
+static int
+serve_stats(struct server *s, char **save, FILE *fp)
+{
+	struct output_graph *og;
+	struct histogram *h = NULL;
+	struct report r;
+	const char *output;
+	const char *lane;
+
+	output = strtok_r(NULL, " \t\r\n", save);
+	lane = strtok_r(NULL, " \t\r\n", save);
+	if (!output || !lane) {
+		fprintf(fp, "Error: stats needs an output and a lane.\n");
+		return -1;
+	}
+
+	for (og = s->gdata->output; og; og = og->next)
+		if (strcmp(output_graph_name(og), output) == 0)
+			h = output_graph_get_histogram(og, lane);
+
+	if (!h) {
+		fprintf(fp, "Error: no lane '%s' of output '%s'.\n", lane,
+			output);
+		return -1;
+	}
+
+	report_init_fp(&r, fp, REPORT_JSON, s->gdata);
+	report_histogram(&r, lane, h);
+
+	return report_finish(&r);
+}
+
+static int
+serve_arrow(struct server *s, char **save, FILE *fp)
+{
+	const char *dir;
+
+	dir = strtok_r(NULL, " \t\r\n", save);
+	if (!dir) {
+		fprintf(fp, "Error: arrow needs a directory.\n");
+		return -1;
+	}
+
+	if (graph_data_to_arrow(s->gdata, dir) < 0) {
+		fprintf(fp, "Error: cannot write '%s'.\n", dir);
+		return -1;
+	}
+
+	fprintf(fp, "Wrote %s.\n", dir);
+
+	return 0;
+}
+
+static int
+serve_request(struct server *s, char *line, FILE *fp)
+{
+	char *save;
+	char *cmd;
+
+	cmd = strtok_r(line, " \t\r\n", &save);
+	if (!cmd) {
+		fprintf(fp, "Error: empty request.\n");
+		return -1;
+	}
+
+	if (strcmp(cmd, "svg") == 0)
+		return serve_svg(s, &save, fp);
+
+	if (strcmp(cmd, "report") == 0)
+		return serve_report(s, &save, fp);
+
+	if (strcmp(cmd, "stats") == 0)
+		return serve_stats(s, &save, fp);
+
+	if (strcmp(cmd, "trace") == 0)
+		return graph_data_to_trace_json_fp(s->gdata, fp);
+
+	if (strcmp(cmd, "perfetto") == 0)
+		return graph_data_to_perfetto_fp(s->gdata, fp);
+
+	if (strcmp(cmd, "arrow") == 0)
+		return serve_arrow(s, &save, fp);
+
+	fprintf(fp, "Error: unknown request '%s'.\n", cmd);
+
+	return -1;
+}
+
+/* Reads the request line, answers it and closes the connection. */
+static void
+serve_connection(struct server *s, int fd)
+{
+	struct timeval timeout = { SERVE_READ_TIMEOUT_SEC, 0 };
+	char line[SERVE_REQUEST_MAX];
+	size_t len = 0;
+	ssize_t n;
+	FILE *fp;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+	while (len < sizeof line - 1) {
+		n = read(fd, line + len, sizeof line - 1 - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		len += n;
+		if (memchr(line + len - n, '\n', n))
+			break;
+	}
+	line[len] = '\0';
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		return;
+	}
+
+	serve_request(s, line, fp);
+	fclose(fp);
+}
+
+/* Returns the next connection, or -1 once stopped with none left. */
+static int
+server_next(struct server *s)
+{
+	int fd = -1;
+
+	pthread_mutex_lock(&s->mutex);
+	while (s->count == 0 && !s->stop)
+		pthread_cond_wait(&s->more, &s->mutex);
+
+	if (s->count > 0) {
+		fd = s->queue[s->head];
+		s->head = (s->head + 1) % SERVE_QUEUE;
+		s->count--;
+		pthread_cond_signal(&s->room);
+	}
+	pthread_mutex_unlock(&s->mutex);
+
+	return fd;
+}
+
+static void
+server_push(struct server *s, int fd)
+{
+	pthread_mutex_lock(&s->mutex);
+	while (s->count == SERVE_QUEUE)
+		pthread_cond_wait(&s->room, &s->mutex);
+
+	s->queue[(s->head + s->count) % SERVE_QUEUE] = fd;
+	s->count++;
+	pthread_cond_signal(&s->more);
+	pthread_mutex_unlock(&s->mutex);
+}
+
+static void *
+serve_worker(void *data)
+{
+	struct server *s = data;
+	int fd;
+
+	while ((fd = server_next(s)) >= 0)
+		serve_connection(s, fd);
+
+	return NULL;
+}
+
+static int
+server_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	mode_t mask;
+	int fd, ret;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "Error: socket path '%s' is too long.\n",
+			path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return ERROR;
+
+	/*
+	 * A socket nobody accepts on was left behind by an earlier
+	 * server, and can go. One still served is not ours to take.
+	 */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0) {
+			fprintf(stderr, "Error: a server is already "
+				"listening on '%s'.\n", path);
+			close(fd);
+			return -1;
+		}
+
+		if (errno == ECONNREFUSED)
+			unlink(path);
+	}
+
+	/* only we may connect, from the moment the socket exists */
+	mask = umask(0177);
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+	umask(mask);
+
+	if (ret < 0 || listen(fd, SERVE_QUEUE) < 0) {
+		fprintf(stderr, "Error: cannot listen on '%s': %s\n", path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Serves the graph data on the Unix socket at path until SIGINT or
+ * SIGTERM. Drawings are laid out as the defaults say, and use them for
+ * what their requests do not.
+ */
+int
+serve_run(struct graph_data *gdata, const struct svg_options *defaults,
+	  const char *path)
+{
+	struct sigaction sa = { .sa_handler = serve_signal };
+	struct server s;
+	long cpus;
+	int lfd, fd;
+	int ret = 0;
+	unsigned i;
+
+	lfd = server_listen(path);
+	if (lfd < 0)
+		return -1;
+
+	memset(&s, 0, sizeof s);
+	s.gdata = gdata;
+	s.defaults = defaults;
+	pthread_rwlock_init(&s.layout_lock, NULL);
+	pthread_mutex_init(&s.mutex, NULL);
+	pthread_cond_init(&s.more, NULL);
+	pthread_cond_init(&s.room, NULL);
+
+	graph_data_layout_svg(gdata, defaults);
+
+	/* at least two, so that a long drawing does not hold up the rest */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	s.nworkers = cpus < 2 ? 2 : cpus < SERVE_WORKERS_MAX ? cpus :
+							      SERVE_WORKERS_MAX;
+	for (i = 0; i < s.nworkers; i++) {
+		if (pthread_create(&s.workers[i], NULL, serve_worker,
+				   &s) != 0) {
+			s.nworkers = i;
+			break;
+		}
+	}
+
+	if (s.nworkers == 0) {
+		ret = ERROR;
+		goto out;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	fprintf(stderr, "Serving requests on %s.\n", path);
+
+	while (!serve_stop) {
+		fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			ret = ERROR;
+			break;
+		}
+
+		server_push(&s, fd);
+	}
+
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGPIPE, &sa, NULL);
+
+out:
+	/* the workers answer what was accepted before they stop */
+	pthread_mutex_lock(&s.mutex);
+	s.stop = 1;
+	pthread_cond_broadcast(&s.more);
+	pthread_mutex_unlock(&s.mutex);
+
+	for (i = 0; i < s.nworkers; i++)
+		pthread_join(s.workers[i], NULL);
+
+	close(lfd);
+	unlink(path);
+
+	pthread_cond_destroy(&s.room);
+	pthread_cond_destroy(&s.more);
+	pthread_mutex_destroy(&s.mutex);
+	pthread_rwlock_destroy(&s.layout_lock);
+
+	return ret;
+}
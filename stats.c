@@ -0,0 +1,377 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A log-linear histogram in the spirit of HDR histogram: values below
+ * 2^HISTOGRAM_SUB_BITS nanoseconds are counted exactly, and every power
+ * of two above that is split into 2^HISTOGRAM_SUB_BITS equal buckets.
+ * The relative error of a quantile is therefore below 2^-HISTOGRAM_SUB_BITS
+ * no matter how many samples are added, and the memory use depends only
+ * on the largest value seen.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "wesgr.h"
+
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_SUB_COUNT (1u << HISTOGRAM_SUB_BITS)
+
+/* Intervals needed before a refresh period estimate is trusted. */
+#define REFRESH_MIN_SAMPLES 8
+
+/*
+ * The vblank grid creeps up by this fraction of the lag of every frame,
+ * and is not extrapolated over more than PHASE_MAX_PERIODS.
+ */
+#define PHASE_FOLLOW 16
+#define PHASE_MAX_PERIODS 8
+
+/* Values are clamped to about 18 minutes. */
+#define HISTOGRAM_MAX_VALUE ((UINT64_C(1) << 40) - 1)
+
+void
+histogram_init(struct histogram *h)
+{
+	memset(h, 0, sizeof *h);
+	h->min = UINT64_MAX;
+}
+
+void
+histogram_release(struct histogram *h)
+{
+	free(h->bucket);
+	histogram_init(h);
+}
+
+static unsigned
+histogram_index(uint64_t value)
+{
+	unsigned msb;
+	unsigned shift;
+
+	if (value < HISTOGRAM_SUB_COUNT)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+	shift = msb - HISTOGRAM_SUB_BITS;
+
+	return (shift + 1) << HISTOGRAM_SUB_BITS |
+	       ((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+static uint64_t
+histogram_bucket_low(unsigned index)
+{
+	unsigned shift;
+
+	if (index < HISTOGRAM_SUB_COUNT)
+		return index;
+
+	shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+
+	return (uint64_t)((index & (HISTOGRAM_SUB_COUNT - 1)) |
+			  HISTOGRAM_SUB_COUNT) << shift;
+}
+
+static uint64_t
+histogram_bucket_width(unsigned index)
+{
+	if (index < HISTOGRAM_SUB_COUNT)
+		return 1;
+
+	return UINT64_C(1) << ((index >> HISTOGRAM_SUB_BITS) - 1);
+}
+
+static int
+histogram_ensure(struct histogram *h, unsigned n)
+{
+	uint64_t *arr;
+
+	if (n <= h->nbuckets)
+		return 0;
+
+	n = (n / HISTOGRAM_SUB_COUNT + 1) * HISTOGRAM_SUB_COUNT;
+	arr = realloc(h->bucket, n * sizeof *arr);
+	if (!arr)
+		return ERROR;
+
+	memset(arr + h->nbuckets, 0, (n - h->nbuckets) * sizeof *arr);
+	h->bucket = arr;
+	h->nbuckets = n;
+
+	return 0;
+}
+
+int
+histogram_add(struct histogram *h, uint64_t value)
+{
+	unsigned i;
+
+	if (value > HISTOGRAM_MAX_VALUE)
+		value = HISTOGRAM_MAX_VALUE;
+
+	i = histogram_index(value);
+	if (histogram_ensure(h, i + 1) < 0)
+		return ERROR;
+
+	h->bucket[i]++;
+	h->count++;
+	h->sum += value;
+	h->sum_sq += (double)value * value;
+
+	if (value < h->min)
+		h->min = value;
+
+	if (value > h->max)
+		h->max = value;
+
+	return 0;
+}
+
+int
+histogram_merge(struct histogram *h, const struct histogram *other)
+{
+	unsigned i;
+
+	if (other->count == 0)
+		return 0;
+
+	if (histogram_ensure(h, other->nbuckets) < 0)
+		return ERROR;
+
+	for (i = 0; i < other->nbuckets; i++)
+		h->bucket[i] += other->bucket[i];
+
+	h->count += other->count;
+	h->sum += other->sum;
+	h->sum_sq += other->sum_sq;
+
+	if (other->min < h->min)
+		h->min = other->min;
+
+	if (other->max > h->max)
+		h->max = other->max;
+
+	return 0;
+}
+
+double
+histogram_mean(const struct histogram *h)
+{
+	if (h->count == 0)
+		return 0.0;
+
+	return h->sum / h->count;
+}
+
+double
+histogram_stddev(const struct histogram *h)
+{
+	double mean;
+	double var;
+
+	if (h->count < 2)
+		return 0.0;
+
+	mean = histogram_mean(h);
+	var = (h->sum_sq - h->count * mean * mean) / (h->count - 1);
+	if (var < 0.0)
+		return 0.0;
+
+	return sqrt(var);
+}
+
+/* q is the fraction of samples at or below the returned value. */
+uint64_t
+histogram_quantile(const struct histogram *h, double q)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	uint64_t value;
+	unsigned i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = ceil(q * h->count);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < h->nbuckets; i++) {
+		seen += h->bucket[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == h->nbuckets)
+		return h->max;
+
+	/* Assume the samples are spread evenly over the bucket. */
+	value = histogram_bucket_low(i) + histogram_bucket_width(i) *
+		(rank - (seen - h->bucket[i]) - 0.5) / h->bucket[i];
+	if (value < h->min)
+		return h->min;
+
+	if (value > h->max)
+		return h->max;
+
+	return value;
+}
+
+/*
+ * The two-sided p-value of the Mann-Whitney U test for the samples of a
+ * and b coming from the same distribution. Samples in the same bucket
+ * count as ties, which the variance is corrected for.
+ */
+double
+histogram_mann_whitney(const struct histogram *a, const struct histogram *b)
+{
+	double n1 = a->count;
+	double n2 = b->count;
+	double n = n1 + n2;
+	double u = 0.0;
+	double below = 0.0;
+	double ties = 0.0;
+	double var, z;
+	unsigned nbuckets;
+	unsigned i;
+
+	if (a->count == 0 || b->count == 0)
+		return 1.0;
+
+	nbuckets = a->nbuckets > b->nbuckets ? a->nbuckets : b->nbuckets;
+	for (i = 0; i < nbuckets; i++) {
+		double ca = i < a->nbuckets ? a->bucket[i] : 0;
+		double cb = i < b->nbuckets ? b->bucket[i] : 0;
+		double t = ca + cb;
+
+		u += ca * (below + cb * 0.5);
+		below += cb;
+		ties += t * t * t - t;
+	}
+
+	var = n1 * n2 / 12.0 * ((n + 1.0) - ties / (n * (n - 1.0)));
+	if (var <= 0.0)
+		return 1.0;
+
+	z = (u - n1 * n2 * 0.5) / sqrt(var);
+
+	return erfc(fabs(z) / M_SQRT2);
+}
+
+void
+refresh_estimate_init(struct refresh_estimate *est)
+{
+	est->period = 0;
+	est->samples = 0;
+	timespec_invalidate(&est->phase);
+}
+
+/*
+ * Feeds one vblank-to-vblank interval from within a repaint loop to the
+ * refresh period estimate. Intervals close to the current estimate
+ * refine it, a clearly shorter interval restarts it, and longer ones
+ * are left out as they are likely missed frames.
+ *
+ * Returns how many refresh periods the interval spans, or 0 while the
+ * estimate is not yet reliable.
+ */
+unsigned
+refresh_estimate_add(struct refresh_estimate *est, uint64_t interval)
+{
+	if (est->period == 0 || interval < est->period * 3 / 4) {
+		est->period = interval;
+		est->samples = 1;
+		return 0;
+	}
+
+	if (interval <= est->period * 5 / 4) {
+		est->period = (est->period * 7 + interval) / 8;
+		est->samples++;
+		return 1;
+	}
+
+	if (est->samples < REFRESH_MIN_SAMPLES)
+		return 0;
+
+	return (interval + est->period / 2) / est->period;
+}
+
+void
+refresh_estimate_set_phase(struct refresh_estimate *est,
+			   const struct timespec *vblank)
+{
+	est->phase = *vblank;
+}
+
+/*
+ * Estimates the time of the vblank that a core_repaint_finished at ts
+ * reports. The event comes some time after the vblank, so the grid of
+ * refresh periods follows the earliest events, and creeps up by a
+ * fraction of the lag to follow clock drift. The vblank cannot be
+ * before earliest, when the frame was submitted.
+ *
+ * Returns 1 if the vblank was snapped to the grid, or 0 if it is ts.
+ */
+int
+refresh_estimate_snap(struct refresh_estimate *est, const struct timespec *ts,
+		      const struct timespec *earliest, struct timespec *vblank)
+{
+	uint64_t since, lag;
+
+	*vblank = *ts;
+
+	if (est->samples < REFRESH_MIN_SAMPLES ||
+	    !timespec_is_valid(&est->phase) ||
+	    timespec_cmp(ts, &est->phase) < 0)
+		goto restart;
+
+	since = timespec_sub_to_nsec(ts, &est->phase);
+	if (since > est->period * PHASE_MAX_PERIODS)
+		goto restart;
+
+	/* an event this late is more likely an early vblank */
+	lag = since % est->period;
+	if (lag > est->period * 7 / 8)
+		goto restart;
+
+	timespec_add_nsec(vblank, ts,
+			  -(int64_t)(lag - lag / PHASE_FOLLOW));
+	if (timespec_is_valid(earliest) &&
+	    timespec_cmp(vblank, earliest) < 0) {
+		*vblank = *ts;
+		goto restart;
+	}
+
+	est->phase = *vblank;
+
+	return 1;
+
+restart:
+	est->phase = *ts;
+
+	return 0;
+}
@@ -0,0 +1,726 @@
+/*
+ * Copyright © 2015 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Export of the interpreted graph data as trace events, either in the
+ * Chrome JSON trace-event format or in the Perfetto protobuf encoding.
+ * Both are written straight from the graph_data lists, one record at
+ * a time, without building the whole trace in memory.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "wesgr.h"
+
+struct trace_track {
+	uint64_t uuid;
+	uint64_t parent;
+};
+
+struct pbuf {
+	uint8_t *data;
+	size_t len;
+	size_t alloc;
+};
+
+struct trace_writer;
+
+struct trace_writer_impl {
+	int (*header)(struct trace_writer *w);
+	int (*footer)(struct trace_writer *w);
+	int (*track)(struct trace_writer *w, const struct trace_track *t,
+		     const char *name);
+	int (*slice)(struct trace_writer *w, const struct trace_track *t,
+		     const char *name, uint64_t begin, uint64_t end);
+	int (*instant)(struct trace_writer *w, const struct trace_track *t,
+		       const char *name, uint64_t ts);
+};
+
+struct trace_writer {
+	FILE *fp;
+	const struct trace_writer_impl *impl;
+	uint64_t next_uuid;
+	uint64_t begin;
+	uint64_t end;
+
+	/* JSON */
+	int need_comma;
+
+	/* Perfetto */
+	struct pbuf msg;
+	struct pbuf pkt;
+};
+
+static void
+json_write_string(FILE *fp, const char *str)
+{
+	const unsigned char *s;
+
+	fputc('"', fp);
+	for (s = (const unsigned char *)str; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if (*s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void
+json_write_usec(FILE *fp, uint64_t nsec)
+{
+	fprintf(fp, "%" PRIu64 ".%03u", nsec / 1000, (unsigned)(nsec % 1000));
+}
+
+static void
+json_event_begin(struct trace_writer *w, const struct trace_track *t,
+		 const char *ph, const char *name)
+{
+	fprintf(w->fp, "%s\n{\"ph\":\"%s\",\"pid\":%" PRIu64
+		",\"tid\":%" PRIu64 ",\"name\":",
+		w->need_comma ? "," : "", ph,
+		t->parent ? t->parent : t->uuid, t->uuid);
+	json_write_string(w->fp, name);
+	w->need_comma = 1;
+}
+
+static int
+json_header(struct trace_writer *w)
+{
+	fprintf(w->fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	return 0;
+}
+
+static int
+json_footer(struct trace_writer *w)
+{
+	fprintf(w->fp, "\n]}\n");
+
+	return 0;
+}
+
+static int
+json_track(struct trace_writer *w, const struct trace_track *t,
+	   const char *name)
+{
+	json_event_begin(w, t, "M",
+			 t->parent ? "thread_name" : "process_name");
+	fprintf(w->fp, ",\"args\":{\"name\":");
+	json_write_string(w->fp, name);
+	fprintf(w->fp, "}}");
+
+	json_event_begin(w, t, "M",
+			 t->parent ? "thread_sort_index" : "process_sort_index");
+	fprintf(w->fp, ",\"args\":{\"sort_index\":%" PRIu64 "}}", t->uuid);
+
+	return 0;
+}
+
+static int
+json_slice(struct trace_writer *w, const struct trace_track *t,
+	   const char *name, uint64_t begin, uint64_t end)
+{
+	json_event_begin(w, t, "X", name);
+	fprintf(w->fp, ",\"ts\":");
+	json_write_usec(w->fp, begin);
+	fprintf(w->fp, ",\"dur\":");
+	json_write_usec(w->fp, end - begin);
+	fprintf(w->fp, "}");
+
+	return 0;
+}
+
+static int
+json_instant(struct trace_writer *w, const struct trace_track *t,
+	     const char *name, uint64_t ts)
+{
+	json_event_begin(w, t, "i", name);
+	fprintf(w->fp, ",\"s\":\"t\",\"ts\":");
+	json_write_usec(w->fp, ts);
+	fprintf(w->fp, "}");
+
+	return 0;
+}
+
+static const struct trace_writer_impl json_impl = {
+	json_header,
+	json_footer,
+	json_track,
+	json_slice,
+	json_instant,
+};
+
+/*
+ * Minimal protobuf encoding, enough for the Perfetto TracePacket,
+ * TrackDescriptor and TrackEvent messages.
+ */
+
+enum {
+	PB_VARINT = 0,
+	PB_LEN = 2,
+};
+
+enum {
+	TRACE_PACKET = 1,
+	PACKET_TIMESTAMP = 8,
+	PACKET_SEQUENCE_ID = 10,
+	PACKET_TRACK_EVENT = 11,
+	PACKET_TRACK_DESCRIPTOR = 60,
+	DESCRIPTOR_UUID = 1,
+	DESCRIPTOR_NAME = 2,
+	DESCRIPTOR_PARENT_UUID = 5,
+	EVENT_TYPE = 9,
+	EVENT_TRACK_UUID = 11,
+	EVENT_NAME = 23,
+};
+
+enum {
+	TYPE_SLICE_BEGIN = 1,
+	TYPE_SLICE_END = 2,
+	TYPE_INSTANT = 3,
+};
+
+/* Any non-zero value works, we only write one sequence. */
+#define PERFETTO_SEQUENCE_ID 1
+
+static void
+pbuf_init(struct pbuf *pb)
+{
+	pb->data = NULL;
+	pb->len = 0;
+	pb->alloc = 0;
+}
+
+static void
+pbuf_release(struct pbuf *pb)
+{
+	free(pb->data);
+	pbuf_init(pb);
+}
+
+static int
+pbuf_append(struct pbuf *pb, const void *data, size_t len)
+{
+	uint8_t *d;
+	size_t sz;
+
+	if (pb->len + len > pb->alloc) {
+		sz = (pb->len + len) * 2;
+		d = realloc(pb->data, sz);
+		if (!d)
+			return ERROR;
+
+		pb->data = d;
+		pb->alloc = sz;
+	}
+
+	memcpy(pb->data + pb->len, data, len);
+	pb->len += len;
+
+	return 0;
+}
+
+static int
+pbuf_varint(struct pbuf *pb, uint64_t v)
+{
+	uint8_t buf[10];
+	size_t n = 0;
+
+	do {
+		buf[n] = v & 0x7f;
+		v >>= 7;
+		if (v)
+			buf[n] |= 0x80;
+		n++;
+	} while (v);
+
+	return pbuf_append(pb, buf, n);
+}
+
+static int
+pbuf_uint(struct pbuf *pb, unsigned field, uint64_t v)
+{
+	if (pbuf_varint(pb, field << 3 | PB_VARINT) < 0)
+		return ERROR;
+
+	return pbuf_varint(pb, v);
+}
+
+static int
+pbuf_bytes(struct pbuf *pb, unsigned field, const void *data, size_t len)
+{
+	if (pbuf_varint(pb, field << 3 | PB_LEN) < 0)
+		return ERROR;
+
+	if (pbuf_varint(pb, len) < 0)
+		return ERROR;
+
+	return pbuf_append(pb, data, len);
+}
+
+static int
+pbuf_string(struct pbuf *pb, unsigned field, const char *str)
+{
+	return pbuf_bytes(pb, field, str, strlen(str));
+}
+
+static int
+perfetto_write_packet(struct trace_writer *w, unsigned field,
+		      uint64_t timestamp)
+{
+	struct pbuf *pkt = &w->pkt;
+	struct pbuf frame;
+	uint8_t hdr[16];
+	int ret;
+
+	pkt->len = 0;
+	if (field == PACKET_TRACK_EVENT &&
+	    pbuf_uint(pkt, PACKET_TIMESTAMP, timestamp) < 0)
+		return ERROR;
+
+	if (pbuf_uint(pkt, PACKET_SEQUENCE_ID, PERFETTO_SEQUENCE_ID) < 0)
+		return ERROR;
+
+	if (pbuf_bytes(pkt, field, w->msg.data, w->msg.len) < 0)
+		return ERROR;
+
+	/* The frame header of a packet in the top level Trace message. */
+	frame.data = hdr;
+	frame.len = 0;
+	frame.alloc = sizeof hdr;
+	if (pbuf_varint(&frame, TRACE_PACKET << 3 | PB_LEN) < 0 ||
+	    pbuf_varint(&frame, pkt->len) < 0)
+		return ERROR;
+
+	ret = fwrite(hdr, 1, frame.len, w->fp) == frame.len &&
+	      fwrite(pkt->data, 1, pkt->len, w->fp) == pkt->len;
+	w->msg.len = 0;
+
+	return ret ? 0 : ERROR;
+}
+
+static int
+perfetto_event(struct trace_writer *w, const struct trace_track *t,
+	       unsigned type, const char *name, uint64_t ts)
+{
+	w->msg.len = 0;
+	if (pbuf_uint(&w->msg, EVENT_TYPE, type) < 0)
+		return ERROR;
+
+	if (pbuf_uint(&w->msg, EVENT_TRACK_UUID, t->uuid) < 0)
+		return ERROR;
+
+	if (name && pbuf_string(&w->msg, EVENT_NAME, name) < 0)
+		return ERROR;
+
+	return perfetto_write_packet(w, PACKET_TRACK_EVENT, ts);
+}
+
+static int
+perfetto_nop(struct trace_writer *w)
+{
+	return 0;
+}
+
+static int
+perfetto_track(struct trace_writer *w, const struct trace_track *t,
+	       const char *name)
+{
+	w->msg.len = 0;
+	if (pbuf_uint(&w->msg, DESCRIPTOR_UUID, t->uuid) < 0)
+		return ERROR;
+
+	if (pbuf_string(&w->msg, DESCRIPTOR_NAME, name) < 0)
+		return ERROR;
+
+	if (t->parent &&
+	    pbuf_uint(&w->msg, DESCRIPTOR_PARENT_UUID, t->parent) < 0)
+		return ERROR;
+
+	return perfetto_write_packet(w, PACKET_TRACK_DESCRIPTOR, 0);
+}
+
+static int
+perfetto_slice(struct trace_writer *w, const struct trace_track *t,
+	       const char *name, uint64_t begin, uint64_t end)
+{
+	if (perfetto_event(w, t, TYPE_SLICE_BEGIN, name, begin) < 0)
+		return ERROR;
+
+	return perfetto_event(w, t, TYPE_SLICE_END, NULL, end);
+}
+
+static int
+perfetto_instant(struct trace_writer *w, const struct trace_track *t,
+		 const char *name, uint64_t ts)
+{
+	return perfetto_event(w, t, TYPE_INSTANT, name, ts);
+}
+
+static const struct trace_writer_impl perfetto_impl = {
+	perfetto_nop,
+	perfetto_nop,
+	perfetto_track,
+	perfetto_slice,
+	perfetto_instant,
+};
+
+static int
+trace_track_create(struct trace_writer *w, struct trace_track *t,
+		   const struct trace_track *parent, const char *name)
+{
+	t->uuid = w->next_uuid++;
+	t->parent = parent ? parent->uuid : 0;
+
+	return w->impl->track(w, t, name);
+}
+
+/* Clamps open-ended or unknown times to the recording range. */
+static uint64_t
+trace_time(struct trace_writer *w, const struct timespec *ts)
+{
+	uint64_t t;
+
+	if (!timespec_is_valid(ts))
+		return w->end;
+
+	t = timespec_to_nsec(ts);
+	if (t < w->begin)
+		return w->begin;
+
+	return t;
+}
+
+static int
+line_graph_to_trace(struct line_graph *linegr, struct trace_writer *w,
+		    const struct trace_track *parent)
+{
+	struct trace_track track;
+	struct line_block *lb;
+
+	if (!linegr->block)
+		return 0;
+
+	if (trace_track_create(w, &track, parent, linegr->label) < 0)
+		return ERROR;
+
+	for (lb = linegr->block; lb; lb = lb->next) {
+		if (!timespec_is_valid(&lb->begin) ||
+		    !timespec_is_valid(&lb->end))
+			continue;
+
+		if (w->impl->slice(w, &track, lb->desc ? lb->desc : linegr->label,
+				   trace_time(w, &lb->begin),
+				   trace_time(w, &lb->end)) < 0)
+			return ERROR;
+	}
+
+	return 0;
+}
+
+static int
+activity_set_to_trace(struct activity_set *acts, struct trace_writer *w,
+		      const struct trace_track *parent, const char *name)
+{
+	struct trace_track track;
+	struct activity *act;
+
+	if (!acts->act)
+		return 0;
+
+	if (trace_track_create(w, &track, parent, name) < 0)
+		return ERROR;
+
+	for (act = acts->act; act; act = act->next)
+		if (w->impl->slice(w, &track, name,
+				   trace_time(w, &act->begin),
+				   trace_time(w, &act->end)) < 0)
+			return ERROR;
+
+	return 0;
+}
+
+static int
+vblank_set_to_trace(struct vblank_set *vblanks, struct trace_writer *w,
+		    const struct trace_track *track)
+{
+	struct vblank *vbl;
+
+	for (vbl = vblanks->vbl; vbl; vbl = vbl->next)
+		if (w->impl->instant(w, track, "vblank",
+				     trace_time(w, &vbl->ts)) < 0)
+			return ERROR;
+
+	return 0;
+}
+
+struct update_track {
+	struct trace_track track;
+	uint64_t earliest;
+};
+
+/*
+ * The update list is sorted from the newest to the oldest vblank, so
+ * each update goes on the first track whose earliest update begins no
+ * sooner than this one ends, or on a new one. This keeps the slices on
+ * a track disjoint.
+ */
+static struct update_track *
+get_update_track(struct update_track **tracks, unsigned *n, unsigned *alloc,
+		 struct trace_writer *w, const struct trace_track *parent,
+		 const char *label, uint64_t begin, uint64_t end)
+{
+	struct update_track *ut;
+	char *name;
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < *n; i++) {
+		if ((*tracks)[i].earliest >= end)
+			break;
+	}
+
+	if (i == *alloc) {
+		unsigned count = *alloc ? *alloc * 2 : 4;
+
+		ut = realloc(*tracks, count * sizeof *ut);
+		if (!ut)
+			return ERROR_NULL;
+
+		*tracks = ut;
+		*alloc = count;
+	}
+
+	ut = &(*tracks)[i];
+	if (i == *n) {
+		ut->earliest = UINT64_MAX;
+		if (i == 0)
+			ret = trace_track_create(w, &ut->track, parent, label);
+		else if (asprintf(&name, "%s (%u)", label, i + 1) < 0)
+			ret = -1;
+		else {
+			ret = trace_track_create(w, &ut->track, parent, name);
+			free(name);
+		}
+
+		if (ret < 0)
+			return ERROR_NULL;
+
+		(*n)++;
+	}
+
+	if (begin < ut->earliest)
+		ut->earliest = begin;
+
+	return ut;
+}
+
+static int
+update_graph_to_trace(struct update_graph *update_gr, struct trace_writer *w,
+		      const struct trace_track *parent)
+{
+	struct update_track *tracks = NULL;
+	struct update_track *ut;
+	struct update *up;
+	const struct timespec *begin;
+	unsigned n = 0;
+	unsigned alloc = 0;
+	int ret = -1;
+
+	for (up = update_gr->updates; up; up = up->next) {
+		if (timespec_is_valid(&up->damage))
+			begin = &up->damage;
+		else if (timespec_is_valid(&up->flush))
+			begin = &up->flush;
+		else
+			continue;
+
+		/* a commit never flushed is only an instant */
+		ut = get_update_track(&tracks, &n, &alloc, w, parent,
+				      update_gr->label, trace_time(w, begin),
+				      timespec_is_valid(&up->flush) ?
+				      trace_time(w, &up->vblank) :
+				      trace_time(w, begin));
+		if (!ut)
+			goto out;
+
+		if (!timespec_is_valid(&up->flush)) {
+			if (w->impl->instant(w, &ut->track, "commit",
+					     trace_time(w, begin)) < 0)
+				goto out;
+			continue;
+		}
+
+		if (w->impl->slice(w, &ut->track, "update",
+				   trace_time(w, begin),
+				   trace_time(w, &up->vblank)) < 0)
+			goto out;
+
+		if (w->impl->instant(w, &ut->track, "flush",
+				     trace_time(w, &up->flush)) < 0)
+			goto out;
+	}
+
+	ret = 0;
+
+out:
+	free(tracks);
+
+	if (ret < 0)
+		return ERROR;
+
+	return 0;
+}
+
+static int
+output_graph_to_trace(struct output_graph *og, struct trace_writer *w)
+{
+	struct trace_track track;
+	struct update_graph *upg;
+	char *name;
+	int ret;
+
+	if (asprintf(&name, "Output %s", output_graph_name(og)) < 0)
+		return ERROR;
+
+	ret = trace_track_create(w, &track, NULL, name);
+	free(name);
+	if (ret < 0)
+		return ERROR;
+
+	if (vblank_set_to_trace(&og->vblanks, w, &track) < 0)
+		return ERROR;
+
+	if (activity_set_to_trace(&og->not_looping, w, &track,
+				  "not looping") < 0)
+		return ERROR;
+
+	if (line_graph_to_trace(&og->delay_line, w, &track) < 0)
+		return ERROR;
+
+	if (line_graph_to_trace(&og->submit_line, w, &track) < 0)
+		return ERROR;
+
+	if (line_graph_to_trace(&og->gpu_line, w, &track) < 0)
+		return ERROR;
+
+	if (line_graph_to_trace(&og->renderer_gpu_line, w, &track) < 0)
+		return ERROR;
+
+	for (upg = og->updates; upg; upg = upg->next)
+		if (update_graph_to_trace(upg, w, &track) < 0)
+			return ERROR;
+
+	return 0;
+}
+
+static int
+graph_data_to_trace(struct graph_data *gdata, FILE *fp,
+		    const struct trace_writer_impl *impl)
+{
+	struct trace_writer w;
+	struct output_graph *og;
+	int ret = -1;
+
+	memset(&w, 0, sizeof w);
+	w.impl = impl;
+	w.next_uuid = 1;
+	pbuf_init(&w.msg);
+	pbuf_init(&w.pkt);
+
+	if (timespec_is_valid(&gdata->begin)) {
+		w.begin = timespec_to_nsec(&gdata->begin);
+		w.end = timespec_to_nsec(&gdata->end);
+	}
+
+	w.fp = fp;
+
+	if (impl->header(&w) < 0)
+		goto out;
+
+	for (og = gdata->output; og; og = og->next)
+		if (output_graph_to_trace(og, &w) < 0)
+			goto out;
+
+	if (impl->footer(&w) < 0)
+		goto out;
+
+	ret = 0;
+
+out:
+	pbuf_release(&w.msg);
+	pbuf_release(&w.pkt);
+
+	if (ret < 0)
+		return ERROR;
+
+	return 0;
+}
+
+static int
+graph_data_to_trace_file(struct graph_data *gdata, const char *filename,
+			 const struct trace_writer_impl *impl)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(filename, "w");
+	if (!fp)
+		return ERROR;
+
+	ret = graph_data_to_trace(gdata, fp, impl);
+
+	if (fclose(fp) != 0 || ret < 0)
+		return ERROR;
+
+	return 0;
+}
+
+int
+graph_data_to_trace_json(struct graph_data *gdata, const char *filename)
+{
+	return graph_data_to_trace_file(gdata, filename, &json_impl);
+}
+
+int
+graph_data_to_trace_json_fp(struct graph_data *gdata, FILE *fp)
+{
+	return graph_data_to_trace(gdata, fp, &json_impl);
+}
+
+int
+graph_data_to_perfetto(struct graph_data *gdata, const char *filename)
+{
+	return graph_data_to_trace_file(gdata, filename, &perfetto_impl);
+}
+
+int
+graph_data_to_perfetto_fp(struct graph_data *gdata, FILE *fp)
+{
+	return graph_data_to_trace(gdata, fp, &perfetto_impl);
+}
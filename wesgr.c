@@ -23,144 +23,115 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
-
-#include <json.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 #include "wesgr.h"
-
-struct bytebuf {
-	uint8_t *data;
-	size_t alloc;
-	size_t len;
-	size_t pos;
-};
+#include "libwesgr.h"
 
 static void
-bytebuf_init(struct bytebuf *bb)
+profile_phase_end(struct parse_context *ctx, enum profile_phase phase,
+		  uint64_t since)
 {
-	bb->data = NULL;
-	bb->alloc = 0;
-	bb->len = 0;
-	bb->pos = 0;
+	if (ctx->prof)
+		profile_phase_add(ctx->prof, phase, since);
 }
 
-static void
-bytebuf_release(struct bytebuf *bb)
-{
-	free(bb->data);
-	bytebuf_init(bb);
-}
+struct parse_job {
+	const char *filename;
+	struct wesgr *w;
+	pthread_t thread;
+	int ret;
+};
 
 static int
-bytebuf_ensure(struct bytebuf *bb, size_t sz)
+parse_job_init(struct parse_job *job, const char *filename, int streaming,
+	       const char *output, const char *surface)
 {
-	uint8_t *data;
-
-	if (bb->alloc >= sz)
-		return 0;
-
-	data = realloc(bb->data, sz);
-	if (!data)
+	job->filename = filename;
+	job->ret = -1;
+	job->w = wesgr_create(NULL, NULL, streaming ? WESGR_STREAMING : 0);
+	if (!job->w)
 		return ERROR;
 
-	bb->data = data;
-	bb->alloc = sz;
+	if (wesgr_set_filter(job->w, output, surface) < 0) {
+		fprintf(stderr, "Error: bad surface filter '%s'.\n", surface);
+		wesgr_destroy(job->w);
+		return -1;
+	}
 
 	return 0;
 }
 
-static int
-bytebuf_read_from_file(struct bytebuf *bb, FILE *fp, size_t sz)
+static void
+parse_job_release(struct parse_job *job)
 {
-	size_t ret;
-
-	if (bytebuf_ensure(bb, sz) < 0)
-		return ERROR;
+	wesgr_destroy(job->w);
+}
 
-	ret = fread(bb->data, 1, sz, fp);
-	if (ferror(fp))
-		return ERROR;
+static void *
+parse_job_run(void *data)
+{
+	struct parse_job *job = data;
 
-	bb->len = ret;
-	bb->pos = 0;
+	job->ret = wesgr_parse_file(job->w, job->filename);
 
-	return 0;
+	return NULL;
 }
 
+/* Parses both files at the same time, each in its own thread. */
 static int
-parse_file(const char *name, struct parse_context *ctx)
+parse_job_run_pair(struct parse_job *a, struct parse_job *b)
 {
-	int ret = -1;
-	struct bytebuf bb;
-	FILE *fp;
-	struct json_tokener *jtok;
-	struct json_object *jobj;
-
-	bytebuf_init(&bb);
-	jtok = json_tokener_new();
-	if (!jtok)
+	if (pthread_create(&b->thread, NULL, parse_job_run, b) != 0)
 		return ERROR;
 
-	fp = fopen(name, "r");
-	if (!fp)
-		goto out_release;
-
-	while (1) {
-		enum json_tokener_error jerr;
-		int r;
-
-		jobj = json_tokener_parse_ex(jtok,
-					     (char *)(bb.data + bb.pos),
-					     bb.len - bb.pos);
-		jerr = json_tokener_get_error(jtok);
-		if (!jobj && jerr == json_tokener_continue) {
-			if (feof(fp)) {
-				ret = 0;
-				break;
-			}
-
-			if (bytebuf_read_from_file(&bb, fp, 8192) < 0)
-				break;
-
-			continue;
-		}
-
-		if (!jobj) {
-			fprintf(stderr, "JSON parse failure: %d\n", jerr);
-			break;
-		}
-
-		bb.pos += jtok->char_offset;
-
-		r = parse_context_process_object(ctx, jobj);
-		json_object_put(jobj);
+	parse_job_run(a);
+	pthread_join(b->thread, NULL);
 
-		if (r < 0) {
-			fprintf(stderr, "JSON interpretation error\n");
-			break;
-		}
-	}
-
-	fclose(fp);
+	if (a->ret < 0 || b->ret < 0)
+		return -1;
 
-	if (ret != -1)
-		ret = graph_data_end(ctx->gdata);
+	return 0;
+}
 
-out_release:
-	bytebuf_release(&bb);
-	json_tokener_free(jtok);
+/* Context drawn around anomalies by default with --anomalies-only */
+#define DEFAULT_CONTEXT_MS 50
 
-	if (ret == -1)
-		return ERROR;
-	return ret;
-}
+/* Defaults for --follow */
+#define DEFAULT_FOLLOW_SEC 10
+#define DEFAULT_INTERVAL_MS 1000
 
 struct prog_args {
-	int from_ms;
-	int to_ms;
+	struct svg_options svg;
 	const char *infile;
+	const char *comparefile;
+	struct budget *budgets;
+	int align;		/* vblank of the SVG diff, or DIFF_ALIGN_MISS */
 	const char *svgfile;
+	const char *tracefile;
+	const char *perfettofile;
+	const char *reportfile;
+	const char *profilefile;
+	const char *foldedfile;
+	const char *arrowdir;
+	const char *serve_socket;
+	enum report_format report_format;
+	int follow_sec;		/* 0 unless following */
+	int interval_ms;
+	int streaming;
+	int retain_sec;		/* 0 keeps the whole recording */
+	const char *only_output;
+	const char *surface_filter;
 };
 
 static void
@@ -172,23 +143,95 @@ print_usage(const char *prog)
 	"  -i, --input=FILE          Read FILE as the input data.\n"
 	"  -o, --output=FILE         Write FILE as the output SVG.\n"
 	"  -a, --from-ms=MS          Start the graph at MS milliseconds.\n"
-	"  -b, --to-ms=MS            End the graph at MS milliseconds.\n",
-	prog);
+	"  -b, --to-ms=MS            End the graph at MS milliseconds.\n"
+	"  -A, --threshold=LANE:LIMIT\n"
+	"                            Highlight blocks of LANE longer than\n"
+	"                            LIMIT, in milliseconds or as pNN of\n"
+	"                            the lane. LANE is a lane style or\n"
+	"                            update. Can be repeated.\n"
+	"  -x, --anomalies-only[=MS] Draw only what lies within MS (default\n"
+	"                            %d) milliseconds of an anomaly.\n"
+	"  -f, --follow[=SEC]        Keep reading the input as it grows, and\n"
+	"                            redraw the last SEC (default %d) seconds\n"
+	"                            to the output SVG periodically. Input '-'\n"
+	"                            is standard input.\n"
+	"  -I, --interval=MS         Redraw every MS (default %d) milliseconds\n"
+	"                            when following.\n"
+	"  -S, --stream              Only compute the report, in memory that\n"
+	"                            does not grow with the recording length.\n"
+	"  -R, --retain=SEC          Keep graph data for only the last SEC\n"
+	"                            seconds, and draw those by default.\n"
+	"                            Following retains its window.\n"
+	"  -O, --only-output=NAME    Graph and report only the output NAME.\n"
+	"  -s, --surface=REGEX       Graph and report only the surfaces with\n"
+	"                            a description matching the extended\n"
+	"                            regular expression REGEX.\n"
+	"  -t, --trace=FILE          Write FILE as Chrome JSON trace events.\n"
+	"  -p, --perfetto=FILE       Write FILE as a Perfetto protobuf trace.\n"
+	"  -r, --report=FILE         Write timing statistics to FILE,\n"
+	"                            '-' for standard output.\n"
+	"  -F, --folded=FILE         Write the call sites that requested\n"
+	"                            repaints to FILE as folded stacks for\n"
+	"                            flame graph tools.\n"
+	"  -T, --arrow=DIR           Write the graph as tables in Arrow IPC\n"
+	"                            files into DIR.\n"
+	"  -L, --serve=SOCKET        Then keep the graph in memory, and answer\n"
+	"                            drawing, report and export requests on\n"
+	"                            the Unix socket SOCKET until interrupted.\n"
+	"  -P, --profile=FILE        Write event counts per timepoint and\n"
+	"                            object, and the time and memory wesgr\n"
+	"                            used, to FILE, '-' for standard output.\n"
+	"  -j, --json                Write reports as JSON instead of text.\n"
+	"  -c, --compare=FILE        Compare FILE to the input, and write the\n"
+	"                            differences as the report, or with -o\n"
+	"                            draw both below one another.\n"
+	"  -V, --align=VBLANK        With -c and -o, time both recordings\n"
+	"                            from their VBLANK-th vblank (default 0),\n"
+	"                            or with 'miss' from their first missed\n"
+	"                            frame.\n"
+	"  -B, --budget=LANE:STAT:MS With -c, exit with status 2 if STAT\n"
+	"                            (mean, max or pNN) of LANE is over MS\n"
+	"                            milliseconds in FILE. LANE is a lane\n"
+	"                            style, vblank_interval, commit_to_flush\n"
+	"                            or flush_to_vblank. Can be repeated.\n",
+	prog, DEFAULT_CONTEXT_MS, DEFAULT_FOLLOW_SEC, DEFAULT_INTERVAL_MS);
 }
 
 static int
 parse_opts(struct prog_args *args, int argc, char *argv[])
 {
-	static const char short_opts[] = "hi:a:b:o:";
+	static const char short_opts[] = "hi:a:b:o:t:p:r:P:F:T:L:jc:V:B:A:x::f::I:SR:O:s:";
 	static const struct option opts[] = {
 		{ "help",              no_argument,       0, 'h' },
 		{ "input",             required_argument, 0, 'i' },
 		{ "from-ms",           required_argument, 0, 'a' },
 		{ "to-ms",             required_argument, 0, 'b' },
 		{ "output",            required_argument, 0, 'o' },
+		{ "trace",             required_argument, 0, 't' },
+		{ "perfetto",          required_argument, 0, 'p' },
+		{ "report",            required_argument, 0, 'r' },
+		{ "profile",           required_argument, 0, 'P' },
+		{ "folded",            required_argument, 0, 'F' },
+		{ "arrow",             required_argument, 0, 'T' },
+		{ "serve",             required_argument, 0, 'L' },
+		{ "json",              no_argument,       0, 'j' },
+		{ "compare",           required_argument, 0, 'c' },
+		{ "align",             required_argument, 0, 'V' },
+		{ "budget",            required_argument, 0, 'B' },
+		{ "threshold",         required_argument, 0, 'A' },
+		{ "anomalies-only",    optional_argument, 0, 'x' },
+		{ "follow",            optional_argument, 0, 'f' },
+		{ "interval",          required_argument, 0, 'I' },
+		{ "stream",            no_argument,       0, 'S' },
+		{ "retain",            required_argument, 0, 'R' },
+		{ "only-output",       required_argument, 0, 'O' },
+		{ "surface",           required_argument, 0, 's' },
 		{ NULL, 0, 0, 0 }
 	};
 
+	struct budget **last_budget = &args->budgets;
+	struct threshold **last_threshold = &args->svg.thresholds;
+
 	while (1) {
 		int c;
 		int longindex;
@@ -207,14 +250,107 @@ parse_opts(struct prog_args *args, int argc, char *argv[])
 			args->infile = optarg;
 			break;
 		case 'a':
-			args->from_ms = atoi(optarg);
+			args->svg.from_ms = atoi(optarg);
 			break;
 		case 'b':
-			args->to_ms = atoi(optarg);
+			args->svg.to_ms = atoi(optarg);
 			break;
 		case 'o':
 			args->svgfile = optarg;
 			break;
+		case 't':
+			args->tracefile = optarg;
+			break;
+		case 'p':
+			args->perfettofile = optarg;
+			break;
+		case 'r':
+			args->reportfile = optarg;
+			break;
+		case 'P':
+			args->profilefile = optarg;
+			break;
+		case 'F':
+			args->foldedfile = optarg;
+			break;
+		case 'T':
+			args->arrowdir = optarg;
+			break;
+		case 'L':
+			args->serve_socket = optarg;
+			break;
+		case 'j':
+			args->report_format = REPORT_JSON;
+			break;
+		case 'c':
+			args->comparefile = optarg;
+			break;
+		case 'V':
+			if (strcmp(optarg, "miss") == 0) {
+				args->align = DIFF_ALIGN_MISS;
+				break;
+			}
+			args->align = atoi(optarg);
+			if (args->align < 0) {
+				fprintf(stderr, "Error: bad vblank to align on.\n");
+				return -1;
+			}
+			break;
+		case 'B':
+			*last_budget = budget_parse(optarg);
+			if (!*last_budget) {
+				fprintf(stderr, "Error: bad budget '%s'.\n",
+					optarg);
+				return -1;
+			}
+			last_budget = &(*last_budget)->next;
+			break;
+		case 'A':
+			*last_threshold = threshold_parse(optarg);
+			if (!*last_threshold) {
+				fprintf(stderr, "Error: bad threshold '%s'.\n",
+					optarg);
+				return -1;
+			}
+			last_threshold = &(*last_threshold)->next;
+			break;
+		case 'x':
+			args->svg.anomalies_only = 1;
+			if (optarg)
+				args->svg.context_ns =
+					(uint64_t)atoi(optarg) * 1000000;
+			break;
+		case 'f':
+			args->follow_sec = optarg ? atoi(optarg) :
+						    DEFAULT_FOLLOW_SEC;
+			if (args->follow_sec <= 0) {
+				fprintf(stderr, "Error: bad follow window.\n");
+				return -1;
+			}
+			break;
+		case 'S':
+			args->streaming = 1;
+			break;
+		case 'I':
+			args->interval_ms = atoi(optarg);
+			if (args->interval_ms <= 0) {
+				fprintf(stderr, "Error: bad interval.\n");
+				return -1;
+			}
+			break;
+		case 'R':
+			args->retain_sec = atoi(optarg);
+			if (args->retain_sec <= 0) {
+				fprintf(stderr, "Error: bad retention.\n");
+				return -1;
+			}
+			break;
+		case 'O':
+			args->only_output = optarg;
+			break;
+		case 's':
+			args->surface_filter = optarg;
+			break;
 		default:
 			break;
 		}
@@ -232,12 +368,380 @@ parse_opts(struct prog_args *args, int argc, char *argv[])
 	return 0;
 }
 
+static volatile sig_atomic_t follow_stop;
+
+static void
+follow_signal(int sig)
+{
+	follow_stop = 1;
+}
+
+static int64_t
+monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct sink;
+
+typedef int (*sink_write_t)(struct sink *sink);
+
+/* An output file written from the graph data once it is complete */
+struct sink {
+	const char *filename;
+	sink_write_t write;
+	enum profile_phase phase;
+	struct parse_context *ctx;
+	const struct prog_args *args;
+	pthread_t thread;
+	int threaded;
+	int ret;
+};
+
+static int
+sink_write_svg(struct sink *sink)
+{
+	return graph_data_write_svg(sink->ctx->gdata, &sink->args->svg,
+				    sink->filename);
+}
+
+static int
+sink_write_trace(struct sink *sink)
+{
+	return graph_data_to_trace_json(sink->ctx->gdata, sink->filename);
+}
+
+static int
+sink_write_perfetto(struct sink *sink)
+{
+	return graph_data_to_perfetto(sink->ctx->gdata, sink->filename);
+}
+
+static int
+sink_write_report(struct sink *sink)
+{
+	return graph_data_to_report(sink->ctx->gdata, sink->filename,
+				    sink->args->report_format);
+}
+
+static int
+sink_write_folded(struct sink *sink)
+{
+	return graph_data_to_folded(sink->ctx->gdata, sink->filename);
+}
+
+static int
+sink_write_arrow(struct sink *sink)
+{
+	return graph_data_to_arrow(sink->ctx->gdata, sink->filename);
+}
+
+static void
+sink_add(struct sink *sinks, unsigned *count, const char *filename,
+	 sink_write_t write, enum profile_phase phase)
+{
+	if (!filename)
+		return;
+
+	sinks[*count].filename = filename;
+	sinks[*count].write = write;
+	sinks[*count].phase = phase;
+	(*count)++;
+}
+
+static void *
+sink_run(void *data)
+{
+	struct sink *sink = data;
+	uint64_t since = profile_now();
+
+	sink->ret = sink->write(sink);
+	if (sink->ret == 0)
+		profile_phase_end(sink->ctx, sink->phase, since);
+
+	return NULL;
+}
+
+/*
+ * Writes every output asked for on the command line from the one parse.
+ * They only read the graph data, so each gets a thread of its own,
+ * except those to standard output, which are written one after another
+ * on this thread.
+ */
+static int
+write_sinks(struct parse_context *ctx, const struct prog_args *args)
+{
+	struct sink sinks[6];
+	unsigned count = 0;
+	uint64_t since = profile_now();
+	unsigned i;
+	int ret = 0;
+
+	/* SVGs are written while following */
+	if (!args->follow_sec)
+		sink_add(sinks, &count, args->svgfile, sink_write_svg,
+			 PROFILE_SVG);
+	sink_add(sinks, &count, args->tracefile, sink_write_trace,
+		 PROFILE_TRACE);
+	sink_add(sinks, &count, args->perfettofile, sink_write_perfetto,
+		 PROFILE_PERFETTO);
+	sink_add(sinks, &count, args->reportfile, sink_write_report,
+		 PROFILE_REPORT);
+	sink_add(sinks, &count, args->foldedfile, sink_write_folded,
+		 PROFILE_FOLDED);
+	sink_add(sinks, &count, args->arrowdir, sink_write_arrow,
+		 PROFILE_ARROW);
+
+	for (i = 0; i < count; i++) {
+		sinks[i].ctx = ctx;
+		sinks[i].args = args;
+		sinks[i].threaded = count > 1 &&
+				    strcmp(sinks[i].filename, "-") != 0 &&
+				    pthread_create(&sinks[i].thread, NULL,
+						   sink_run, &sinks[i]) == 0;
+	}
+
+	for (i = 0; i < count; i++)
+		if (!sinks[i].threaded)
+			sink_run(&sinks[i]);
+
+	for (i = 0; i < count; i++) {
+		if (sinks[i].threaded)
+			pthread_join(sinks[i].thread, NULL);
+		if (sinks[i].ret < 0)
+			ret = -1;
+	}
+
+	if (count > 0)
+		profile_phase_end(ctx, PROFILE_WRITE, since);
+
+	return ret;
+}
+
+/* Draws the last follow_sec seconds, replacing the SVG atomically. */
+static int
+follow_render(struct parse_context *ctx, struct prog_args *args)
+{
+	struct graph_data *gdata = ctx->gdata;
+	struct svg_options opts = args->svg;
+	uint64_t since = profile_now();
+	uint64_t span;
+	char *tmp;
+	int ret;
+
+	if (!timespec_is_valid(&gdata->begin))
+		return 0;
+
+	span = timespec_sub_to_nsec(&gdata->end, &gdata->begin) / 1000000;
+	if (span == 0)
+		return 0;
+
+	opts.from_ms = 0;
+	if (span > (uint64_t)args->follow_sec * 1000)
+		opts.from_ms = span - (uint64_t)args->follow_sec * 1000;
+	opts.to_ms = -1;
+
+	if (asprintf(&tmp, "%s.tmp", args->svgfile) < 0)
+		return ERROR;
+
+	ret = graph_data_to_svg(gdata, &opts, tmp);
+	if (ret == 0 && rename(tmp, args->svgfile) < 0)
+		ret = ERROR;
+
+	free(tmp);
+
+	profile_phase_end(ctx, PROFILE_SVG, since);
+
+	return ret;
+}
+
+/*
+ * Parses the input as it is being written, until a pipe is closed or
+ * the user interrupts. A regular file is watched with inotify for more
+ * data, anything else is polled.
+ */
+static int
+follow_file(struct prog_args *args, struct wesgr *w)
+{
+	struct parse_context *ctx = wesgr_get_parse_context(w);
+	struct sigaction sa = { .sa_handler = follow_signal };
+	struct pollfd pfd;
+	struct stat st;
+	char events[4096];
+	char buf[8192];
+	int64_t next_render;
+	int regular;
+	int at_eof = 0;
+	int ifd = -1;
+	int fd;
+	int ret = -1;
+
+	if (strcmp(args->infile, "-") == 0)
+		fd = STDIN_FILENO;
+	else
+		fd = open(args->infile, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		goto out;
+
+	regular = S_ISREG(st.st_mode);
+	if (regular) {
+		ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (ifd < 0 ||
+		    inotify_add_watch(ifd, args->infile, IN_MODIFY) < 0)
+			goto out;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	next_render = monotonic_ms() + args->interval_ms;
+
+	while (!follow_stop) {
+		int64_t now = monotonic_ms();
+		ssize_t len;
+
+		if (now >= next_render) {
+			if (follow_render(ctx, args) < 0)
+				goto out;
+			next_render = now + args->interval_ms;
+		}
+
+		if (!regular || at_eof) {
+			pfd.fd = regular ? ifd : fd;
+			pfd.events = POLLIN;
+
+			switch (poll(&pfd, 1, next_render - now)) {
+			case -1:
+				if (errno != EINTR)
+					goto out;
+				/* fall through */
+			case 0:
+				continue;
+			}
+
+			if (regular) {
+				while (read(ifd, events, sizeof events) > 0)
+					;
+				at_eof = 0;
+			}
+		}
+
+		len = read(fd, buf, sizeof buf);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			goto out;
+		}
+
+		if (len == 0) {
+			if (!regular)
+				break;
+			at_eof = 1;
+			continue;
+		}
+
+		if (wesgr_feed(w, buf, len) < 0)
+			goto out;
+	}
+
+	ret = wesgr_finish(w);
+
+out:
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (ifd >= 0)
+		close(ifd);
+	if (fd > STDIN_FILENO)
+		close(fd);
+
+	if (ret == -1)
+		return ERROR;
+	return ret;
+}
+
+static int
+run_compare(struct prog_args *args)
+{
+	struct parse_job before;
+	struct parse_job after;
+	int streaming;
+	int ret = 0;
+
+	if (args->tracefile || args->perfettofile || args->profilefile ||
+	    args->foldedfile || args->arrowdir || args->serve_socket) {
+		fprintf(stderr, "Error: comparison only writes a report "
+			"and an SVG.\n");
+		return 1;
+	}
+
+	if (args->svgfile && args->streaming) {
+		fprintf(stderr, "Error: streaming only writes a report.\n");
+		return 1;
+	}
+
+	/* only statistics are compared, so no graph is needed to report */
+	streaming = !args->svgfile;
+
+	if (parse_job_init(&before, args->infile, streaming, args->only_output,
+			   args->surface_filter) < 0 ||
+	    parse_job_init(&after, args->comparefile, streaming,
+			   args->only_output, args->surface_filter) < 0)
+		return 1;
+
+	if (parse_job_run_pair(&before, &after) < 0)
+		return 1;
+
+	if (args->svgfile &&
+	    graph_data_diff_to_svg(wesgr_get_graph_data(before.w),
+				   wesgr_get_graph_data(after.w),
+				   &args->svg, args->align, args->only_output,
+				   args->svgfile) < 0)
+		ret = -1;
+
+	if (ret == 0 && (!args->svgfile || args->reportfile || args->budgets))
+		ret = graph_data_compare_to_report(
+				wesgr_get_graph_data(before.w),
+				wesgr_get_graph_data(after.w),
+				args->budgets,
+				args->reportfile ? args->reportfile : "-",
+				args->report_format);
+	if (ret > 0)
+		fprintf(stderr, "%d latency budget(s) exceeded.\n", ret);
+
+	parse_job_release(&before);
+	parse_job_release(&after);
+	budget_list_destroy(args->budgets);
+	threshold_list_destroy(args->svg.thresholds);
+
+	if (ret < 0)
+		return 1;
+
+	return ret > 0 ? 2 : 0;
+}
+
 int
 main(int argc, char *argv[])
 {
-	struct prog_args args = { -1, -1, NULL, NULL };
-	struct graph_data gdata;
-	struct parse_context ctx;
+	struct prog_args args = {
+		.svg = {
+			.from_ms = -1,
+			.to_ms = -1,
+			.context_ns = (uint64_t)DEFAULT_CONTEXT_MS * 1000000,
+		},
+		.report_format = REPORT_TEXT,
+		.interval_ms = DEFAULT_INTERVAL_MS,
+	};
+	struct parse_job job;
+	struct graph_data *gdata;
+	struct parse_context *ctx;
+	struct profile prof;
+	uint64_t since;
 
 	if (parse_opts(&args, argc, argv) < 0)
 		return 1;
@@ -247,33 +751,87 @@ main(int argc, char *argv[])
 		return 1;
 	}
 
-	if (!args.svgfile) {
+	if (args.comparefile)
+		return run_compare(&args);
+
+	if (!args.svgfile && !args.tracefile && !args.perfettofile &&
+	    !args.reportfile && !args.profilefile && !args.foldedfile &&
+	    !args.arrowdir && !args.serve_socket) {
 		fprintf(stderr, "Error: output file not specified.\n");
 		return 1;
 	}
 
-	if (graph_data_init(&gdata) < 0)
+	if (args.streaming && (args.svgfile || args.tracefile ||
+			       args.perfettofile || args.arrowdir ||
+			       args.follow_sec)) {
+		fprintf(stderr, "Error: streaming only writes a report.\n");
 		return 1;
+	}
 
-	if (parse_context_init(&ctx, &gdata) < 0)
+	if (args.streaming && args.retain_sec) {
+		fprintf(stderr, "Error: streaming retains no graph.\n");
 		return 1;
+	}
 
-	if (parse_file(args.infile, &ctx) < 0)
+	if (parse_job_init(&job, args.infile, args.streaming, args.only_output,
+			   args.surface_filter) < 0)
 		return 1;
 
-	if (graph_data_to_svg(&gdata, args.from_ms, args.to_ms,
-			      args.svgfile) < 0)
+	gdata = wesgr_get_graph_data(job.w);
+	ctx = wesgr_get_parse_context(job.w);
+
+	if (args.profilefile) {
+		if (profile_init(&prof) < 0)
+			return 1;
+		ctx->prof = &prof;
+	}
+
+	/* a followed graph never draws more than its window */
+	if (!args.retain_sec)
+		args.retain_sec = args.follow_sec;
+	wesgr_set_retention(job.w, (uint64_t)args.retain_sec * NSEC_PER_SEC);
+
+	if (args.follow_sec) {
+		if (args.serve_socket) {
+			fprintf(stderr, "Error: cannot serve while following.\n");
+			return 1;
+		}
+
+		if (!args.svgfile) {
+			fprintf(stderr, "Error: following needs an SVG output.\n");
+			return 1;
+		}
+
+		if (follow_file(&args, job.w) < 0 ||
+		    follow_render(ctx, &args) < 0)
+			return 1;
+	} else {
+		since = profile_now();
+		if (wesgr_parse_file(job.w, args.infile) < 0)
+			return 1;
+		profile_phase_end(ctx, PROFILE_PARSE, since);
+
+		if (args.svgfile)
+			graph_data_layout_svg(gdata, &args.svg);
+	}
+
+	if (write_sinks(ctx, &args) < 0)
 		return 1;
 
-	parse_context_release(&ctx);
-	graph_data_release(&gdata);
+	if (args.profilefile) {
+		if (profile_to_report(&prof, ctx, args.profilefile,
+				      args.report_format) < 0)
+			return 1;
+		profile_release(&prof);
+	}
 
-	return 0;
-}
+	if (args.serve_socket &&
+	    serve_run(gdata, &args.svg, args.serve_socket) < 0)
+		return 1;
 
-void
-generic_error(const char *file, int line, const char *func)
-{
-	fprintf(stderr, "Error in %s(), %s:%d\n", func, file, line);
+	parse_job_release(&job);
+	threshold_list_destroy(args.svg.thresholds);
+
+	return 0;
 }
 
@@ -24,15 +24,45 @@
 #define WESGR_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
+#include <assert.h>
+#include <regex.h>
 
 #define ARRAY_LENGTH(a) (sizeof(a) / sizeof((a)[0]))
 
+/* The length of the lists of worst cases kept for reports */
+#define WORST_COUNT 10
+
 struct json_object;
 
 struct info_weston_output;
 struct info_weston_surface;
 
+struct histogram {
+	uint64_t *bucket;
+	unsigned nbuckets;
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	double sum;
+	double sum_sq;
+};
+
+struct node_chunk;
+
+struct node_pool {
+	size_t node_size;
+	size_t next_offset;
+	const struct timespec *(*node_time)(const void *node);
+	void (*node_release)(void *node);
+
+	struct node_chunk *oldest;
+	struct node_chunk *newest;
+	uint64_t allocated;
+	uint64_t evicted;
+};
+
 struct update {
 	struct timespec damage;
 	struct timespec flush;
@@ -40,11 +70,24 @@ struct update {
 	struct update *next;
 };
 
+struct update_latency {
+	struct histogram commit_to_flush;
+	struct histogram flush_to_vblank;
+	struct histogram total;
+
+	unsigned worst_count;
+	struct update worst[WORST_COUNT];
+};
+
 struct update_graph {
 	struct update_graph *next;
 	struct update *updates;
 	const char *style;
 	char *label;
+	struct update_latency latency;
+	struct node_pool pool;
+	uint64_t threshold;	/* anomaly limit for the total, or 0 */
+	int streaming;		/* from graph_data */
 
 	double y;
 
@@ -59,15 +102,109 @@ struct activity {
 
 struct activity_set {
 	struct activity *act;
+	struct node_pool pool;
+};
+
+enum miss_cause {
+	MISS_CAUSE_DELAY,
+	MISS_CAUSE_REPAINT,
+	MISS_CAUSE_GPU,
+	MISS_CAUSE_COUNT
 };
 
 struct vblank {
 	struct timespec ts;
+	uint64_t interval;	/* from the previous vblank, or 0 */
+	unsigned missed;	/* refresh periods missed before this one */
+	enum miss_cause cause;
 	struct vblank *next;
 };
 
 struct vblank_set {
 	struct vblank *vbl;
+	struct node_pool pool;
+};
+
+struct refresh_estimate {
+	uint64_t period;
+	unsigned samples;
+	struct timespec phase;	/* the last vblank on the estimated grid */
+};
+
+struct frame_miss {
+	struct timespec ts;
+	uint64_t interval;
+	unsigned missed;
+	enum miss_cause cause;
+};
+
+struct frame_miss_stats {
+	struct refresh_estimate refresh;
+	uint64_t frame_delay;
+	uint64_t frame_submit;
+	uint64_t typical[MISS_CAUSE_COUNT];
+	uint64_t count[MISS_CAUSE_COUNT];	/* frames missed, by cause */
+	uint64_t missed_frames;
+	uint64_t frames;
+	uint64_t stamped;	/* frames with the vblank time in the log */
+	uint64_t snapped;	/* frames with the vblank time estimated */
+
+	unsigned worst_count;
+	struct frame_miss worst[WORST_COUNT];
+};
+
+struct wasted_loop {
+	struct timespec begin;
+	struct timespec end;
+	unsigned repaints;
+};
+
+/* Repaint loop durations, and the loops that flushed no damage */
+struct loop_stats {
+	struct histogram busy;		/* complete repaint loops */
+	struct histogram idle;		/* complete periods between loops */
+	uint64_t loops;
+	uint64_t wasted_loops;
+	uint64_t repaints;
+	uint64_t empty_repaints;	/* repaints that flushed no damage */
+	uint64_t idle_total;		/* clipped to the recording */
+
+	unsigned worst_count;
+	struct wasted_loop worst[WORST_COUNT];	/* the longest wasted loops */
+
+	struct timespec loop_begin;
+	unsigned loop_repaints;
+	unsigned loop_flushes;
+	unsigned repaint_flushes;
+};
+
+/* GPU utilization is reported in windows of this length */
+#define GPU_WINDOW_NSEC UINT64_C(1000000000)
+#define GPU_WINDOW_RING 4
+
+/* output_repaint() calls waiting for later GPU timestamps */
+#define GPU_PENDING 8
+
+struct gpu_interval {
+	struct timespec begin;
+	struct timespec end;
+};
+
+struct gpu_stats {
+	uint64_t busy;
+	uint64_t window;
+	uint64_t peak_busy;	/* in the busiest window */
+
+	uint64_t frames;	/* output_repaint() calls after GPU work */
+	uint64_t overlapping;	/* of those, started while the GPU was busy */
+	struct histogram overlap;
+
+	uint64_t window_first;
+	uint64_t window_busy[GPU_WINDOW_RING];
+	struct timespec last_begin;
+	struct timespec last_end;
+	struct gpu_interval pending[GPU_PENDING];
+	unsigned pending_count;
 };
 
 struct transition {
@@ -78,6 +215,7 @@ struct transition {
 struct transition_set {
 	struct transition *trans;
 	const char *style;
+	struct node_pool pool;
 };
 
 struct line_block {
@@ -92,10 +230,49 @@ struct line_graph {
 	struct line_block *block;
 	const char *style;
 	const char *label;
+	struct histogram durations;
+	struct node_pool pool;
+	uint64_t threshold;	/* anomaly limit for a block, or 0 */
 
 	double y;
 };
 
+/* Where in the compositor repaints were requested, and for what */
+struct callsite {
+	struct callsite *next;
+	char *func;
+	int64_t line;
+	unsigned object_id;	/* the surface or output of the request */
+	char *label;		/* of that object, once its info is known */
+	uint64_t count;
+	uint64_t redundant;	/* for a frame already requested */
+	uint64_t without_damage;	/* triggered repaints that flushed none */
+};
+
+struct repaint_requests {
+	struct callsite *sites;
+	uint64_t requests;	/* call sites seen */
+	uint64_t redundant;
+	uint64_t without_damage;
+	uint64_t frames;	/* repaints with at least one request */
+	unsigned max_per_frame;
+	unsigned pending;	/* call sites since the last repaint began */
+	struct callsite *trigger;	/* the first of the pending ones */
+	struct callsite *serving;	/* trigger of the current repaint */
+};
+
+struct output_graph;
+
+/* Observers of the graph as it is built, for libwesgr callbacks */
+struct graph_hooks {
+	void (*interval)(void *data, const struct output_graph *og,
+			 const char *lane, const struct timespec *begin,
+			 const struct timespec *end);
+	void (*vblank)(void *data, const struct output_graph *og,
+		       const struct vblank *vbl);
+	void *data;
+};
+
 struct output_graph {
 	struct info_weston_output *info;
 	struct output_graph *next;
@@ -109,9 +286,19 @@ struct output_graph {
 	struct vblank_set vblanks;
 	struct activity_set not_looping;
 	struct update_graph *updates;
+	struct histogram vblank_intervals;
+	struct frame_miss_stats misses;
+	struct loop_stats loops;
+	struct gpu_stats gpu;
+	struct repaint_requests requests;
+	int streaming;		/* from graph_data */
+	const struct graph_hooks *hooks;	/* from graph_data */
+	struct vblank stream_vblank;
 
 	double y1, y2;
 	double title_y;
+	double gpu_util_y;	/* 0 without GPU timestamps */
+	double fps_y;
 
 	struct timespec last_req;
 	struct timespec last_finished;
@@ -119,6 +306,7 @@ struct output_graph {
 	struct timespec last_posted;
 	struct timespec last_exit_loop;
 	struct timespec last_renderer_gpu_begin;
+	struct timespec last_vblank;
 };
 
 struct graph_data {
@@ -126,9 +314,70 @@ struct graph_data {
 
 	struct timespec begin;
 	struct timespec end;
+	int damage_seen;	/* whether the log has core_flush_damage */
+	int streaming;		/* aggregate only, keep no graph nodes */
+	uint64_t retain_ns;	/* drop graph nodes older than this, or 0 */
+	struct timespec next_evict;
+	const struct graph_hooks *hooks;	/* or NULL */
 
 	double time_axis_y;
 	double legend_y;
+	double width, height;	/* of the SVG */
+};
+
+enum report_format {
+	REPORT_TEXT,
+	REPORT_JSON,
+};
+
+struct report {
+	FILE *fp;
+	enum report_format format;
+	struct timespec begin;
+	int depth;
+	int need_comma;
+	int close;		/* fp was opened for the report */
+};
+
+struct surface_worst {
+	const struct update *update;
+	const char *output;
+};
+
+/* Latencies of all surfaces with the same description, on all outputs */
+struct surface_report {
+	struct surface_report *next;
+	const char *label;
+	struct histogram commit_to_flush;
+	struct histogram flush_to_vblank;
+
+	struct surface_worst *worst;
+	unsigned worst_count;
+};
+
+/* A limit on a statistic of a lane or a surface latency */
+struct budget {
+	struct budget *next;
+	char *name;
+	char *stat;
+	double quantile;	/* negative for the mean */
+	uint64_t limit;
+};
+
+/* A limit above which a block or an update is drawn as an anomaly */
+struct threshold {
+	struct threshold *next;
+	char *lane;
+	double quantile;	/* 0 for an absolute limit */
+	uint64_t limit;
+};
+
+struct svg_options {
+	int from_ms;
+	int to_ms;
+	struct threshold *thresholds;
+	int anomalies_only;
+	uint64_t context_ns;	/* drawn around anomalies when only those are */
 };
 
 struct surface_graph_list {
@@ -147,6 +396,13 @@ struct info_weston_output {
 	struct output_graph *output_gr;
 };
 
+/* Old logs have null output names. */
+static inline const char *
+output_graph_name(const struct output_graph *og)
+{
+	return og->info->name ? og->info->name : "(unnamed)";
+}
+
 struct info_weston_surface {
 	char *description;
 
@@ -159,6 +415,8 @@ struct object_info {
 	unsigned id;
 	enum object_type type;
 	struct json_object *jobj;
+	uint64_t events;	/* timepoints naming it, when profiling */
+	int excluded;		/* by the filter, so nothing is graphed */
 	union {
 		struct info_weston_output wo;
 		struct info_weston_surface ws;
@@ -171,18 +429,101 @@ struct lookup_table {
 	unsigned alloc;
 };
 
+enum profile_phase {
+	PROFILE_PARSE,
+	PROFILE_TOKENIZE,
+	PROFILE_INFO,
+	PROFILE_UNHANDLED,
+	PROFILE_SVG,
+	PROFILE_TRACE,
+	PROFILE_PERFETTO,
+	PROFILE_REPORT,
+	PROFILE_FOLDED,
+	PROFILE_ARROW,
+	PROFILE_WRITE,
+	PROFILE_PHASE_COUNT
+};
+
+struct profile_counter {
+	uint64_t count;
+	uint64_t nsec;
+};
+
+/* What a run of wesgr spends its time on, collected with --profile */
+struct profile {
+	uint64_t start;
+	uint64_t bytes;		/* read from the input */
+	struct profile_counter phase[PROFILE_PHASE_COUNT];
+	long peak_rss_kib[PROFILE_PHASE_COUNT];	/* when the phase ended */
+	struct profile_counter *handler;	/* as tp_handler_list */
+	unsigned handler_count;
+};
+
+/* The most top-level objects that can end in a 64-byte block */
+#define JSON_SCAN_BLOCK_ENDS 32
+
+/* The state of a structural scan between blocks */
+struct json_scanner {
+	size_t (*scan_blocks)(struct json_scanner *s, const char *buf,
+			      size_t len, size_t *ends, size_t max_ends,
+			      size_t *pos);
+	uint64_t escape_carry;	/* the next byte is escaped */
+	uint64_t string_carry;	/* all ones inside a string */
+	unsigned depth;		/* of braces outside strings */
+};
+
+/* handler values of a decoded_event that is not a timepoint */
+#define DECODED_INFO -1
+#define DECODED_UNHANDLED -2
+#define DECODED_INVALID -3
+
+/* A JSON object of the log, classified by parse_context_decode() */
+struct decoded_event {
+	struct json_object *jobj;
+	struct json_object *key;	/* "id" of an object info */
+	int handler;		/* index into tp_handler_list, or DECODED_* */
+	struct timespec ts;	/* of a timepoint */
+};
+
+/* The objects to graph, decided when their infos are parsed */
+struct parse_filter {
+	char *output;		/* the only output name, or NULL for all */
+	regex_t surface;	/* of surface descriptions */
+	int has_surface;
+};
+
 struct parse_context {
 	struct lookup_table idmap;
 	struct graph_data *gdata;
+	struct profile *prof;	/* NULL unless profiling */
+	struct parse_filter filter;
+};
+
+/*
+ * What a surface timepoint leaves to the output it is for, so that the
+ * surface state and the output can be handled on different threads
+ */
+struct surface_handoff {
+	struct output_graph *og;	/* or NULL for nothing */
+	struct update_graph *new_graph;	/* to be added to og */
+	struct update_graph *update_gr;	/* of og */
+	struct update *update;	/* to keep, or NULL */
+	int flush;		/* the update waits for a vblank */
 };
 
 typedef int (*tp_handler_t)(struct parse_context *ctx,
 			    const struct timespec *ts,
 			    struct json_object *jobj);
 
+typedef int (*tp_surface_handler_t)(struct parse_context *ctx,
+				    const struct timespec *ts,
+				    struct json_object *jobj,
+				    struct surface_handoff *h);
+
 struct tp_handler_item {
 	const char *tp_name;
 	tp_handler_t func;
+	tp_surface_handler_t surface;	/* the surface part of func */
 };
 
 extern const struct tp_handler_item tp_handler_list[];
@@ -196,27 +537,336 @@ graph_data_release(struct graph_data *gdata);
 int
 graph_data_end(struct graph_data *gdata);
 
+int
+graph_data_evicts_at(struct graph_data *gdata, const struct timespec *ts);
+
 void
 graph_data_time(struct graph_data *gdata, const struct timespec *ts);
 
 int
-graph_data_to_svg(struct graph_data *gdata, int from_ms, int to_ms,
+surface_handoff_run(struct surface_handoff *h);
+
+struct output_graph *
+timepoint_output_graph(struct parse_context *ctx, struct json_object *jobj);
+
+void
+node_pool_init(struct node_pool *pool, size_t node_size, size_t next_offset,
+	       const struct timespec *(*node_time)(const void *node),
+	       void (*node_release)(void *node));
+
+void
+node_pool_release(struct node_pool *pool);
+
+void
+node_pool_evict(struct node_pool *pool, const struct timespec *horizon);
+
+void *
+node_pool_alloc(struct node_pool *pool);
+
+int
+graph_data_to_svg(struct graph_data *gdata, const struct svg_options *opts,
 		  const char *filename);
 
+void
+graph_data_layout_svg(struct graph_data *gdata, const struct svg_options *opts);
+
+int
+graph_data_write_svg(struct graph_data *gdata, const struct svg_options *opts,
+		     const char *filename);
+
+int
+graph_data_write_svg_fp(struct graph_data *gdata,
+			const struct svg_options *opts, FILE *fp);
+
+struct output_graph *
+graph_data_find_output(struct graph_data *gdata, const char *name);
+
+/* The line lanes of an output */
+#define OUTPUT_LANES 4
+
+void
+output_graph_lanes(struct output_graph *og, struct line_graph **lanes);
+
+/* Aligns on the first vblank after a missed frame */
+#define DIFF_ALIGN_MISS -1
+
+int
+graph_data_diff_to_svg(struct graph_data *before, struct graph_data *after,
+		       const struct svg_options *opts, int align,
+		       const char *output, const char *filename);
+
+void
+line_graph_busy_time(const struct line_graph *lg,
+		     const struct timespec *begin,
+		     uint64_t from, uint64_t step, unsigned n,
+		     uint64_t *busy);
+
+void
+gpu_stats_init(struct gpu_stats *gs);
+
+void
+gpu_stats_release(struct gpu_stats *gs);
+
+int
+gpu_stats_add_submit(struct gpu_stats *gs, const struct timespec *begin,
+		     const struct timespec *end);
+
+int
+gpu_stats_add_render(struct gpu_stats *gs, const struct timespec *origin,
+		     const struct timespec *begin, const struct timespec *end);
+
+int
+gpu_stats_finish(struct gpu_stats *gs);
+
+void
+repaint_requests_release(struct repaint_requests *rr);
+
+int
+repaint_requests_add(struct repaint_requests *rr, const char *func,
+		     int64_t line, unsigned object_id, const char *label);
+
+void
+repaint_requests_frame(struct repaint_requests *rr);
+
+void
+repaint_requests_posted(struct repaint_requests *rr, int empty);
+
+int
+repaint_requests_to_report(struct repaint_requests *rr, int damage_seen,
+			   struct report *r);
+
+int
+graph_data_to_folded(struct graph_data *gdata, const char *filename);
+
+struct threshold *
+threshold_parse(const char *spec);
+
+void
+threshold_list_destroy(struct threshold *list);
+
+int
+graph_data_to_trace_json(struct graph_data *gdata, const char *filename);
+
+int
+graph_data_to_trace_json_fp(struct graph_data *gdata, FILE *fp);
+
+int
+graph_data_to_perfetto(struct graph_data *gdata, const char *filename);
+
+int
+graph_data_to_perfetto_fp(struct graph_data *gdata, FILE *fp);
+
+int
+graph_data_to_arrow(struct graph_data *gdata, const char *dir);
+
+int
+graph_data_to_report(struct graph_data *gdata, const char *filename,
+		     enum report_format format);
+
+int
+graph_data_to_report_fp(struct graph_data *gdata, FILE *fp,
+			enum report_format format);
+
+int
+profile_init(struct profile *prof);
+
+void
+profile_release(struct profile *prof);
+
+uint64_t
+profile_now(void);
+
+void
+profile_counter_add(struct profile_counter *c, uint64_t since);
+
+void
+profile_phase_add(struct profile *prof, enum profile_phase phase,
+		  uint64_t since);
+
+int
+profile_to_report(struct profile *prof, struct parse_context *ctx,
+		  const char *filename, enum report_format format);
+
+const char *
+miss_cause_to_str(enum miss_cause cause);
+
+uint64_t
+update_latency_total(const struct update *update);
+
+int
+update_latency_record_worst(struct update_latency *lat,
+			    const struct update *update);
+
+void
+refresh_estimate_init(struct refresh_estimate *est);
+
+unsigned
+refresh_estimate_add(struct refresh_estimate *est, uint64_t interval);
+
+int
+refresh_estimate_snap(struct refresh_estimate *est, const struct timespec *ts,
+		      const struct timespec *earliest, struct timespec *vblank);
+
+void
+refresh_estimate_set_phase(struct refresh_estimate *est,
+			   const struct timespec *vblank);
+
+int
+surface_report_list_collect(struct graph_data *gdata,
+			    struct surface_report **list);
+
+void
+surface_report_list_destroy(struct surface_report *list);
+
+struct histogram *
+output_graph_get_histogram(struct output_graph *og, const char *name);
+
+struct budget *
+budget_parse(const char *spec);
+
+void
+budget_list_destroy(struct budget *list);
+
+int
+graph_data_compare_to_report(struct graph_data *before,
+			     struct graph_data *after,
+			     struct budget *budgets, const char *filename,
+			     enum report_format format);
+
+void
+histogram_init(struct histogram *h);
+
+void
+histogram_release(struct histogram *h);
+
+int
+histogram_add(struct histogram *h, uint64_t value);
+
+int
+histogram_merge(struct histogram *h, const struct histogram *other);
+
+double
+histogram_mean(const struct histogram *h);
+
+double
+histogram_stddev(const struct histogram *h);
+
+uint64_t
+histogram_quantile(const struct histogram *h, double q);
+
+double
+histogram_mann_whitney(const struct histogram *a, const struct histogram *b);
+
+int
+report_init(struct report *r, const char *filename,
+	    enum report_format format, struct graph_data *gdata);
+
+void
+report_init_fp(struct report *r, FILE *fp, enum report_format format,
+	       struct graph_data *gdata);
+
+int
+report_finish(struct report *r);
+
+void
+report_indent(struct report *r);
+
+void
+report_begin_object(struct report *r, const char *key);
+
+void
+report_end_object(struct report *r);
+
+void
+report_begin_array(struct report *r, const char *key);
+
+void
+report_end_array(struct report *r);
+
+void
+report_string(struct report *r, const char *key, const char *value);
+
+void
+report_uint(struct report *r, const char *key, uint64_t value);
+
+void
+report_double(struct report *r, const char *key, double value);
+
+void
+report_msec(struct report *r, const char *key, uint64_t nsec);
+
+void
+report_time(struct report *r, const char *key, const struct timespec *ts);
+
+void
+report_histogram(struct report *r, const char *key,
+		 const struct histogram *h);
+
+void
+report_histogram_header(struct report *r);
+
+void
+report_counter(struct report *r, const char *key,
+	       const struct profile_counter *c);
+
+void
+report_counter_header(struct report *r);
+
 int
 parse_context_init(struct parse_context *ctx, struct graph_data *gdata);
 
 void
 parse_context_release(struct parse_context *ctx);
 
+int
+parse_context_set_filter(struct parse_context *ctx, const char *output,
+			 const char *surface);
+
+void
+parse_context_for_each_object(struct parse_context *ctx,
+			      void (*func)(struct object_info *oi, void *data),
+			      void *data);
+
 int
 parse_context_process_object(struct parse_context *ctx,
 			     struct json_object *jobj);
 
+void
+parse_context_decode(struct json_object *jobj, struct decoded_event *ev);
+
+int
+parse_context_dispatch(struct parse_context *ctx,
+		       const struct decoded_event *ev);
+
+int
+parse_context_begin_timepoint(struct parse_context *ctx,
+			      const struct decoded_event *ev);
+
+int
+parse_pipeline_run(struct parse_context *ctx, FILE *fp);
+
+void
+json_scanner_init(struct json_scanner *s);
+
+void
+json_scanner_init_scalar(struct json_scanner *s);
+
+int
+serve_run(struct graph_data *gdata, const struct svg_options *defaults,
+	  const char *path);
+
+size_t
+json_scanner_scan(struct json_scanner *s, const char *buf, size_t len,
+		  size_t *ends, size_t max_ends, size_t *scanned);
+
 struct object_info *
 get_object_info_from_timepoint(struct parse_context *ctx,
 			       struct json_object *jobj, const char *member);
 
+struct object_info *
+find_object_info(struct parse_context *ctx, struct json_object *jobj,
+		 const char *member);
+
 struct timespec
 get_timespec_from_timepoint(struct parse_context *ctx,
 			       struct json_object *jobj, const char *member);
@@ -233,6 +883,91 @@ timespec_is_valid(const struct timespec *ts)
 	return ts->tv_nsec >= 0;
 }
 
+#define NSEC_PER_SEC 1000000000
+
+static inline int
+timespec_cmp(const struct timespec *a, const struct timespec *b)
+{
+	assert(a->tv_nsec >= 0 && a->tv_nsec < NSEC_PER_SEC);
+	assert(b->tv_nsec >= 0 && b->tv_nsec < NSEC_PER_SEC);
+
+	if (a->tv_sec < b->tv_sec)
+		return -1;
+
+	if (a->tv_sec > b->tv_sec)
+		return 1;
+
+	if (a->tv_nsec < b->tv_nsec)
+		return -1;
+
+	if (a->tv_nsec > b->tv_nsec)
+		return 1;
+
+	return 0;
+}
+
+static inline void
+timespec_sub(struct timespec *r,
+	     const struct timespec *a, const struct timespec *b)
+{
+	r->tv_sec = a->tv_sec - b->tv_sec;
+	r->tv_nsec = a->tv_nsec - b->tv_nsec;
+	if (r->tv_nsec < 0) {
+		r->tv_sec--;
+		r->tv_nsec += NSEC_PER_SEC;
+	}
+}
+
+static inline void
+timespec_add_nsec(struct timespec *r, const struct timespec *a, int64_t nsec)
+{
+	r->tv_sec = a->tv_sec + nsec / NSEC_PER_SEC;
+	r->tv_nsec = a->tv_nsec + nsec % NSEC_PER_SEC;
+	if (r->tv_nsec < 0) {
+		r->tv_sec--;
+		r->tv_nsec += NSEC_PER_SEC;
+	} else if (r->tv_nsec >= NSEC_PER_SEC) {
+		r->tv_sec++;
+		r->tv_nsec -= NSEC_PER_SEC;
+	}
+}
+
+static inline uint64_t
+timespec_sub_to_nsec(const struct timespec *a, const struct timespec *b)
+{
+	struct timespec d;
+	uint64_t sec, nsec;
+
+	if (!timespec_is_valid(a))
+		return UINT64_MAX;
+
+	if (timespec_cmp(a, b) < 0)
+		return 0;
+
+	timespec_sub(&d, a, b);
+
+	sec  = d.tv_sec;
+	nsec = d.tv_nsec;
+
+	nsec = sec * NSEC_PER_SEC + nsec;
+
+	return nsec;
+}
+
+static inline uint64_t
+timespec_to_nsec(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+struct wesgr;
+
+struct graph_data *
+wesgr_get_graph_data(struct wesgr *w);
+
+struct parse_context *
+wesgr_get_parse_context(struct wesgr *w);
+
 void
 generic_error(const char *file, int line, const char *func);
 